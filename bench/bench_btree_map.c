@@ -0,0 +1,104 @@
+#include <tree_map.h>
+#include <btree_map.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * Measure random inserts and lookups of 64 bit keys in tree_map_t and in btree_map_t, with a
+ * compare_t function and with the built-in integer comparison, for maps of 10^3 keys up to
+ * 10^7 keys or the limit given as the first argument. The last column is the time per key of
+ * filling a B-tree from sorted keys with btree_map_load.
+ */
+
+#define BENCH_LOOKUPS 1000000
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static int int64_cmp(int64_t *a, int64_t *b) {
+    return (*a > *b) - (*a < *b);
+}
+
+typedef void (*set_t)(void *map, void *key, void *val);
+typedef void* (*get_t)(void *map, void *key);
+
+/* Insert the keys in order and then look up random ones, storing the ns per operation of each. */
+static void run(void *map, set_t set, get_t get, int64_t *keys, size_t count, double *insert, double *lookup) {
+    double start = now_ns();
+    for (size_t i = 0; i < count; i++) {
+        set(map, &keys[i], &keys[i]);
+    }
+    *insert = (now_ns() - start) / count;
+
+    uint64_t state = 2463534242;
+    int64_t sum = 0;
+    start = now_ns();
+    for (size_t i = 0; i < BENCH_LOOKUPS; i++) {
+        sum += *(int64_t*) get(map, &keys[next_random(&state) % count]);
+    }
+    *lookup = (now_ns() - start) / BENCH_LOOKUPS;
+    if (sum == 0) fprintf(stderr, "error: lookups found nothing\n");
+}
+
+int main(int argc, char *argv[]) {
+    size_t limit = argc > 1 ? strtoull(argv[1], NULL, 10) : 10000000;
+
+    printf("%-9s %21s %21s %21s %10s\n", "", "tree_map", "btree_map", "btree_map int", "load");
+    printf("%-9s %10s %10s %10s %10s %10s %10s %10s\n", "keys",
+        "insert", "lookup", "insert", "lookup", "insert", "lookup", "ns/key");
+    for (size_t count = 1000; count <= limit; count *= 10) {
+        /* a random permutation of the even numbers, so the sorted keys are known without sorting */
+        int64_t *keys = malloc(count * sizeof(int64_t));
+        int64_t *sorted = malloc(count * sizeof(int64_t));
+        uint64_t state = 88172645463325252ULL;
+        for (size_t i = 0; i < count; i++) {
+            keys[i] = sorted[i] = 2 * i;
+        }
+        for (size_t i = count - 1; i > 0; i--) {
+            size_t j = next_random(&state) % (i + 1);
+            int64_t tmp = keys[i];
+            keys[i] = keys[j];
+            keys[j] = tmp;
+        }
+
+        double results[6];
+        tree_map_t *tree = tree_map_create(sizeof(int64_t), sizeof(int64_t), (compare_t) int64_cmp, NULL, NULL);
+        run(tree, (set_t) tree_map_set, (get_t) tree_map_get, keys, count, &results[0], &results[1]);
+        tree_map_destroy(tree);
+
+        btree_map_t *btree = btree_map_create(sizeof(int64_t), sizeof(int64_t), (compare_t) int64_cmp, NULL, NULL);
+        run(btree, (set_t) btree_map_set, (get_t) btree_map_get, keys, count, &results[2], &results[3]);
+        btree_map_destroy(btree);
+
+        btree = btree_map_create_keyed(BTREE_KEY_INT, sizeof(int64_t), sizeof(int64_t), NULL, NULL);
+        run(btree, (set_t) btree_map_set, (get_t) btree_map_get, keys, count, &results[4], &results[5]);
+        btree_map_destroy(btree);
+
+        btree = btree_map_create_keyed(BTREE_KEY_INT, sizeof(int64_t), sizeof(int64_t), NULL, NULL);
+        double start = now_ns();
+        if (btree_map_load(btree, sorted, sorted, count) != 0) {
+            fprintf(stderr, "error: failed to load %zu keys\n", count);
+            return 1;
+        }
+        double load = (now_ns() - start) / count;
+        btree_map_destroy(btree);
+
+        printf("%-9zu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", count,
+            results[0], results[1], results[2], results[3], results[4], results[5], load);
+        free(keys);
+        free(sorted);
+    }
+}
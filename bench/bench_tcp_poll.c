@@ -0,0 +1,109 @@
+#include <tcp.h>
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Measure the cost of a single event loop wakeup as the number of idle connections grows. One
+ * active connection sends a byte and the server is polled until the byte is read. With an
+ * O(ready) event loop the time per wakeup should stay flat regardless of the idle count.
+ */
+
+#define BENCH_PORT 8100
+#define BENCH_ROUNDS 20000
+
+static size_t connected = 0;
+static size_t nread = 0;
+
+static void on_connect(tcp_server_t *server, tcp_client_t *client) {
+    connected++;
+}
+
+static void on_close(tcp_server_t *server, tcp_client_t *client) {
+    connected--;
+}
+
+static void on_read(tcp_server_t *server, tcp_client_t *client, buffer_t chunk) {
+    nread += chunk.length;
+}
+
+static void on_error(tcp_server_t *server, tcp_client_t *client, int errnum) {
+    fprintf(stderr, "error: %s\n", strerror(errnum));
+}
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int connect_client(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int));
+    return fd;
+}
+
+static void bench(int port, size_t n_idle) {
+    tcp_server_t *server = tcp_server_create(on_connect, on_close, on_read, on_error);
+    if (tcp_server_listen(server, port, 4096) != 0) {
+        fprintf(stderr, "listen: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    int *idle = calloc(n_idle, sizeof(int));
+    for (size_t i = 0; i < n_idle; i++) {
+        idle[i] = connect_client(port);
+        if (idle[i] < 0) {
+            fprintf(stderr, "connect: %s\n", strerror(errno));
+            exit(1);
+        }
+        if (i % 64 == 0) tcp_server_poll(server);
+    }
+    int active = connect_client(port);
+    while (connected < n_idle + 1) tcp_server_poll(server);
+
+    nread = 0;
+    size_t polls = 0;
+    double start = now_ns();
+    for (size_t i = 0; i < BENCH_ROUNDS; i++) {
+        write(active, "x", 1);
+        while (nread <= i) {
+            tcp_server_poll(server);
+            polls++;
+        }
+    }
+    double elapsed = now_ns() - start;
+
+    printf("%8zu idle connections: %8.0f ns/round trip, %6.2f polls/round trip\n",
+        n_idle, elapsed / BENCH_ROUNDS, (double) polls / BENCH_ROUNDS);
+
+    close(active);
+    for (size_t i = 0; i < n_idle; i++) close(idle[i]);
+    free(idle);
+    tcp_server_destroy(server);
+}
+
+int main(int argc, char *argv[]) {
+    int port = argc > 1 ? atoi(argv[1]) : BENCH_PORT;
+    size_t sizes[] = {0, 100, 1000, 4000, 8000};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        bench(port, sizes[i]);
+    }
+}
@@ -0,0 +1,116 @@
+#include <tcp.h>
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Measure echo throughput of a tcp_cluster_t with 1, 2, 4 and 8 workers. A fixed pool of
+ * client threads performs blocking request/response round trips for a fixed duration, so
+ * throughput should scale with the number of workers up to the number of available cores.
+ */
+
+#define BENCH_PORT 8200
+#define BENCH_CLIENTS 32
+#define BENCH_MESSAGE_SIZE 64
+#define BENCH_DURATION_MS 1000
+
+static atomic_bool running;
+static atomic_size_t round_trips;
+
+static void on_connect(tcp_server_t *server, tcp_client_t *client) {}
+static void on_close(tcp_server_t *server, tcp_client_t *client) {}
+
+static void on_read(tcp_server_t *server, tcp_client_t *client, buffer_t chunk) {
+    ssize_t res = write(tcp_client_fd(client), chunk.data, chunk.length);
+    (void) res;
+}
+
+static void on_error(tcp_server_t *server, tcp_client_t *client, int errnum) {
+    fprintf(stderr, "worker %zu: %s\n", tcp_server_worker(server), strerror(errnum));
+}
+
+static void* client_run(void *arg) {
+    int port = *(int*) arg;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "connect: %s\n", strerror(errno));
+        exit(1);
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int));
+
+    uint8_t message[BENCH_MESSAGE_SIZE] = {0};
+    size_t count = 0;
+    while (atomic_load(&running)) {
+        if (write(fd, message, sizeof(message)) != sizeof(message)) break;
+        size_t received = 0;
+        while (received < sizeof(message)) {
+            ssize_t n = read(fd, message + received, sizeof(message) - received);
+            if (n <= 0) goto done;
+            received += n;
+        }
+        count++;
+    }
+done:
+    atomic_fetch_add(&round_trips, count);
+    close(fd);
+    return NULL;
+}
+
+static void* cluster_run(void *arg) {
+    tcp_cluster_run(arg);
+    return NULL;
+}
+
+static void bench(int port, size_t workers) {
+    tcp_cluster_t *cluster = tcp_cluster_create(workers, on_connect, on_close, on_read, on_error);
+    if (tcp_cluster_listen(cluster, port, 1024) != 0) {
+        fprintf(stderr, "listen: %s\n", strerror(errno));
+        exit(1);
+    }
+    pthread_t server_thread;
+    pthread_create(&server_thread, NULL, cluster_run, cluster);
+
+    atomic_store(&running, true);
+    atomic_store(&round_trips, 0);
+    pthread_t clients[BENCH_CLIENTS];
+    for (size_t i = 0; i < BENCH_CLIENTS; i++) {
+        pthread_create(&clients[i], NULL, client_run, &port);
+    }
+    struct timespec duration = {BENCH_DURATION_MS / 1000, (BENCH_DURATION_MS % 1000) * 1000000};
+    nanosleep(&duration, NULL);
+    atomic_store(&running, false);
+    for (size_t i = 0; i < BENCH_CLIENTS; i++) {
+        pthread_join(clients[i], NULL);
+    }
+
+    tcp_cluster_stop(cluster);
+    pthread_join(server_thread, NULL);
+    tcp_cluster_destroy(cluster);
+
+    double seconds = BENCH_DURATION_MS / 1000.0;
+    printf("%2zu workers: %10.0f round trips/s\n", workers, atomic_load(&round_trips) / seconds);
+}
+
+int main(int argc, char *argv[]) {
+    int port = argc > 1 ? atoi(argv[1]) : BENCH_PORT;
+    printf("%ld cores available\n", sysconf(_SC_NPROCESSORS_ONLN));
+    size_t sizes[] = {1, 2, 4, 8};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        bench(port, sizes[i]);
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+/**
+ * @file arena.h
+ * @brief A bump allocator whose allocations are all released at once.
+ * @author Thomas Barrett
+ */
+
+#include <stddef.h>
+
+/**
+ * The arena_t allocator hands out memory from a list of large blocks by advancing a pointer.
+ * Individual allocations are never freed; instead the whole arena is reset, which makes every
+ * block available again without returning it to the system. An arena that is reset after each
+ * unit of work therefore stops calling malloc once it has grown to fit the largest one.
+ */
+typedef struct arena arena_t;
+
+/**
+ * Create an empty arena which allocates blocks of at least `block_size` bytes.
+ *
+ * @param block_size the minimum size of each block
+ * @return the arena
+ */
+arena_t* arena_create(size_t block_size);
+
+/**
+ * Destroy the arena and free every block, invalidating all memory allocated from it.
+ *
+ * @param arena the arena
+ */
+void arena_destroy(arena_t *arena);
+
+/**
+ * Allocate `size` bytes from the arena. The memory is suitably aligned for any type and is not
+ * initialised.
+ *
+ * @param arena the arena
+ * @param size the number of bytes to allocate
+ * @return the allocated memory
+ */
+void* arena_alloc(arena_t *arena, size_t size);
+
+/**
+ * Allocate `size` zero-initialised bytes from the arena.
+ *
+ * @param arena the arena
+ * @param size the number of bytes to allocate
+ * @return the allocated memory
+ */
+void* arena_calloc(arena_t *arena, size_t size);
+
+/**
+ * Invalidate all memory allocated from the arena in constant time. The blocks are kept and
+ * reused by subsequent allocations.
+ *
+ * @param arena the arena
+ */
+void arena_reset(arena_t *arena);
+
+/**
+ * Return the number of bytes allocated from the arena since it was created or last reset,
+ * including alignment padding.
+ *
+ * @param arena the arena
+ * @return the number of allocated bytes
+ */
+size_t arena_used(arena_t *arena);
+
+#endif /* ARENA_H */
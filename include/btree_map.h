@@ -0,0 +1,127 @@
+#ifndef BTREE_MAP_H
+#define BTREE_MAP_H
+
+/**
+ * @file btree_map.h
+ * @brief A generic B-tree map implementation
+ * @author Thomas Barrett
+ */
+
+#include <tree_map.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * The btree_map_t struct is a map with the same interface as tree_map_t, for maps which are
+ * large enough that cache misses dominate. Keys and values are stored inline in nodes which
+ * hold many of them, with the keys of a node next to each other in a few cache lines, so a
+ * lookup touches one node per level of a much shallower tree.
+ *
+ * Unlike with tree_map_t, entries move when the map changes, so a value returned by
+ * btree_map_get is only valid until the next call to btree_map_set or btree_map_remove.
+ */
+typedef struct btree_map btree_map_t;
+
+/**
+ * The ways in which keys can be compared. The built-in comparisons are inlined into the search
+ * of a node, which avoids an indirect call for every key.
+ */
+typedef enum btree_key {
+    BTREE_KEY_COMPARE,  /* by the compare_t function of the map */
+    BTREE_KEY_BYTES,    /* by memcmp over the whole key */
+    BTREE_KEY_INT,      /* as signed integers of 4 or 8 bytes */
+    BTREE_KEY_UINT,     /* as unsigned integers of 4 or 8 bytes */
+} btree_key_t;
+
+/**
+ * Create a new map with with key type and value type of the given size, whose keys are
+ * compared by `cmp_key`.
+ *
+ * @param key_size the size of the key type in bytes
+ * @param val_size the size of the val type in bytes.
+ * @param key_cmp the key type comparison function
+ * @param key_free the key type destructor
+ * @param val_free the val type destructor
+ * @return a new map
+ */
+btree_map_t* btree_map_create(
+    size_t key_size,
+    size_t val_size,
+    compare_t cmp_key,
+    destroy_t key_free,
+    destroy_t val_free
+);
+
+/**
+ * Create a new map like btree_map_create whose keys are compared by one of the built-in
+ * comparisons other than BTREE_KEY_COMPARE.
+ *
+ * @param key_type the comparison of the keys
+ * @param key_size the size of the key type in bytes
+ * @param val_size the size of the val type in bytes.
+ * @param key_free the key type destructor
+ * @param val_free the val type destructor
+ * @return a new map
+ */
+btree_map_t* btree_map_create_keyed(
+    btree_key_t key_type,
+    size_t key_size,
+    size_t val_size,
+    destroy_t key_free,
+    destroy_t val_free
+);
+
+/**
+ * Destroy the map and free all memory owned by the map.
+ *
+ * @param map the map
+ */
+void btree_map_destroy(btree_map_t *map);
+
+/**
+ * Return the value associated with the given key or null if no such value exists.
+ *
+ * @param map the map
+ * @param key the key
+ */
+void* btree_map_get(btree_map_t *map, void *key);
+
+/**
+ * Store the key value pair in the map. If there is already a value with the same key,
+ * destroy it and replace it with the new key and value.
+ *
+ * @param map the map
+ * @param key the key
+ * @param val the val
+ */
+void btree_map_set(btree_map_t *map, void *key, void *val);
+
+/**
+ * Remove the value with the given key from the map if it exists.
+ *
+ * @param map the map
+ * @param key the key to remove
+ */
+void btree_map_remove(btree_map_t *map, void *key);
+
+/**
+ * Return the number of entries in the map.
+ *
+ * @param map the map
+ */
+size_t btree_map_size(btree_map_t *map);
+
+/**
+ * Fill an empty map with `count` entries from arrays of keys and values in ascending key
+ * order. The nodes are built bottom up and filled as far as the shape of the tree allows, which
+ * is much faster than inserting the entries one by one and leaves a smaller tree.
+ *
+ * @param map the map
+ * @param keys the keys in strictly ascending order
+ * @param vals the values of the keys
+ * @param count the number of entries
+ * @return 0 if successful and -1 if the map is not empty or the keys are not in order
+ */
+int btree_map_load(btree_map_t *map, void *keys, void *vals, size_t count);
+
+#endif /* BTREE_MAP_H */
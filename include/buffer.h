@@ -33,6 +33,15 @@ buffer_t buffer_create(size_t length);
  */
 buffer_t buffer_create_from_string(const char *str);
 
+/**
+ * Return a view of the characters of `str` without the null terminator. No copy is made, so
+ * the view is only valid while the string is.
+ * 
+ * @param str the string to view
+ * @return the view
+ */
+buffer_view_t buffer_view_from_string(const char *str);
+
 /**
  * Destroy the buffer by freeing its data.
  * 
@@ -48,6 +57,15 @@ void buffer_destroy(buffer_t buffer);
  */
 int buffer_compare(buffer_t b1, buffer_t b2);
 
+/**
+ * Compare the two buffers like buffer_compare, but treat ASCII letters as equal regardless of
+ * their case.
+ * 
+ * @param b1 the first buffer
+ * @param b2 the second buffer
+ */
+int buffer_case_compare(buffer_t b1, buffer_t b2);
+
 /**
  * Create a new buffer which is an identical copy of b. 
  * 
@@ -0,0 +1,135 @@
+#ifndef HASH_MAP_H
+#define HASH_MAP_H
+
+/**
+ * @file hash_map.h
+ * @brief A generic hash map implementation
+ * @author Thomas Barrett
+ */
+
+#include <tree_map.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * The hash_map_t struct is an unordered map with constant time lookups. Keys and values are
+ * stored inline in an open addressed table. A separate array holds one control byte per slot
+ * with seven bits of the hash of its key, so a probe compares the bytes of a whole group of
+ * slots at once and only looks at the keys whose bytes match.
+ *
+ * Entries move when the table grows, so a value returned by hash_map_get is only valid until
+ * the next call to hash_map_set or hash_map_reserve.
+ */
+typedef struct hash_map hash_map_t;
+
+/* a function which returns the hash of a key, where keys which compare equal hash equally */
+typedef uint64_t (*hash_t)(void*);
+
+/**
+ * Create a new map with a key type and value type of the given size. The keys are equal if
+ * `cmp_key` returns 0 for them. If both `hash_key` and `cmp_key` are null, keys are hashed and
+ * compared by the bytes of the key type.
+ *
+ * @param key_size the size of the key type in bytes
+ * @param val_size the size of the val type in bytes.
+ * @param hash_key the key type hash function
+ * @param cmp_key the key type comparison function
+ * @param key_free the key type destructor
+ * @param val_free the val type destructor
+ * @return a new map
+ */
+hash_map_t* hash_map_create(
+    size_t key_size,
+    size_t val_size,
+    hash_t hash_key,
+    compare_t cmp_key,
+    destroy_t key_free,
+    destroy_t val_free
+);
+
+/**
+ * Destroy the map and free all memory owned by the map.
+ *
+ * @param map the map
+ */
+void hash_map_destroy(hash_map_t *map);
+
+/**
+ * Return the value associated with the given key or null if no such value exists.
+ *
+ * @param map the map
+ * @param key the key
+ */
+void* hash_map_get(hash_map_t *map, void *key);
+
+/**
+ * Store the key value pair in the map. If there is already a value with the same key,
+ * destroy it and replace it with the new key and value.
+ *
+ * @param map the map
+ * @param key the key
+ * @param val the val
+ */
+void hash_map_set(hash_map_t *map, void *key, void *val);
+
+/**
+ * Remove the value with the given key from the map if it exists.
+ *
+ * @param map the map
+ * @param key the key to remove
+ */
+void hash_map_remove(hash_map_t *map, void *key);
+
+/**
+ * Return the number of entries in the map.
+ *
+ * @param map the map
+ */
+size_t hash_map_size(hash_map_t *map);
+
+/**
+ * Grow the table so that it holds at least `count` entries without growing again.
+ *
+ * @param map the map
+ * @param count the number of entries
+ */
+void hash_map_reserve(hash_map_t *map, size_t count);
+
+/**
+ * Advance `pos` to the next entry of the map in no particular order and return true, or return
+ * false once there are no more. Iteration starts with `pos` at 0. The entry which was returned
+ * may be removed before the next call, but no entries may be added during the iteration.
+ *
+ * @param map the map
+ * @param pos the position of the iteration
+ * @param key set to the key of the entry
+ * @param val set to the value of the entry
+ */
+bool hash_map_next(hash_map_t *map, size_t *pos, void **key, void **val);
+
+/**
+ * Return the hash of `length` bytes of data.
+ *
+ * @param data the data
+ * @param length the number of bytes
+ */
+uint64_t hash_map_hash_bytes(const void *data, size_t length);
+
+/**
+ * The hash function for maps whose keys are buffer_t, which hashes the data of the buffer.
+ *
+ * @param key the buffer_t key
+ */
+uint64_t hash_map_hash_buffer(void *key);
+
+/**
+ * The comparison function for maps whose keys are buffer_t, which compares the data of the
+ * buffers with buffer_compare.
+ *
+ * @param a the first buffer_t key
+ * @param b the second buffer_t key
+ */
+int hash_map_compare_buffer(void *a, void *b);
+
+#endif /* HASH_MAP_H */
@@ -2,77 +2,160 @@
 #define HTTP_H
 
 #include <buffer.h>
-#include <array.h>
+#include <arena.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
 
 #define HTTP_PARSE_INCOMPLETE -1
 #define HTTP_PARSE_ERROR -2
+#define HTTP_PARSE_TOO_LARGE -3
+
+#define HTTP_DEFAULT_MAX_BODY (1024 * 1024)
+#define HTTP_DEFAULT_MAX_HEAD (16 * 1024)
 
 /**
  * The http_request_t struct represents a single http request message. It can be parsed from a buffer
  * and its fields can be queried with the functions defined below.
+ *
+ * Requests, responses and their headers are allocated from an arena_t and have no destroy
+ * functions; they are released together when the arena is reset or destroyed.
  */
 typedef struct http_request http_request_t;
 typedef struct http_response http_response_t;
-typedef array_t http_headers_t;
+typedef struct http_headers http_headers_t;
+
+/**
+ * The header fields which are recognised by the parser. Each of them is stored in a fixed slot
+ * so it can be found without comparing names. Every other header has the id HTTP_HEADER_OTHER.
+ */
+typedef enum http_header_id {
+    HTTP_HEADER_ACCEPT,
+    HTTP_HEADER_ACCEPT_ENCODING,
+    HTTP_HEADER_ACCEPT_LANGUAGE,
+    HTTP_HEADER_ACCEPT_RANGES,
+    HTTP_HEADER_AUTHORIZATION,
+    HTTP_HEADER_CACHE_CONTROL,
+    HTTP_HEADER_CONNECTION,
+    HTTP_HEADER_CONTENT_ENCODING,
+    HTTP_HEADER_CONTENT_LENGTH,
+    HTTP_HEADER_CONTENT_RANGE,
+    HTTP_HEADER_CONTENT_TYPE,
+    HTTP_HEADER_COOKIE,
+    HTTP_HEADER_DATE,
+    HTTP_HEADER_ETAG,
+    HTTP_HEADER_EXPECT,
+    HTTP_HEADER_HOST,
+    HTTP_HEADER_IF_MATCH,
+    HTTP_HEADER_IF_MODIFIED_SINCE,
+    HTTP_HEADER_IF_NONE_MATCH,
+    HTTP_HEADER_IF_RANGE,
+    HTTP_HEADER_IF_UNMODIFIED_SINCE,
+    HTTP_HEADER_KEEP_ALIVE,
+    HTTP_HEADER_LAST_MODIFIED,
+    HTTP_HEADER_LOCATION,
+    HTTP_HEADER_RANGE,
+    HTTP_HEADER_SERVER,
+    HTTP_HEADER_TE,
+    HTTP_HEADER_TRAILER,
+    HTTP_HEADER_TRANSFER_ENCODING,
+    HTTP_HEADER_UPGRADE,
+    HTTP_HEADER_USER_AGENT,
+    HTTP_HEADER_OTHER,
+} http_header_id_t;
+
+/**
+ * A single header field. The key and value are views into memory owned by someone else: the
+ * buffer a request was parsed from, or the strings passed to http_headers_set.
+ */
+typedef struct http_header {
+    buffer_view_t key;
+    buffer_view_t value;
+    http_header_id_t id;
+} http_header_t;
+
+/**
+ * Return the id of the header with the given name, compared case-insensitively, or
+ * HTTP_HEADER_OTHER if it is not a well-known header.
+ *
+ * @param name: the header name
+ * @return the header id
+ */
+http_header_id_t http_header_lookup(buffer_view_t name);
 
 /**
- * Create an empty http_request. The resulting request can be passed as a parameter to utility
- * functions such as parse_http_request.
+ * Return the canonical name of a well-known header, such as "Content-Length".
  *
+ * @param id: the header id, which must not be HTTP_HEADER_OTHER
+ * @return the header name
+ */
+buffer_view_t http_header_name(http_header_id_t id);
+
+/**
+ * Create an empty http_request in the arena. The resulting request can be passed as a parameter
+ * to utility functions such as parse_http_request, which allocate its headers from the same arena.
+ *
+ * @param arena: the arena to allocate from
  * @return an empty request
  */
-http_request_t* http_request_create();
+http_request_t* http_request_create(arena_t *arena);
 
 /**
- * Return the http request method or NULL. This function will never return NULL if the request was
- * parsed successfully.
+ * Return a view of the http request method. The view is empty until the request is parsed and
+ * points into the buffer the request was parsed from, so it is only valid while that buffer is.
  *
  * @param req: the request
  * @return the request method
  */
-char* http_request_method(http_request_t *req);
-void http_request_set_method(http_request_t *req, char *method);
+buffer_view_t http_request_method(http_request_t *req);
+void http_request_set_method(http_request_t *req, buffer_view_t method);
 
 /**
- * Return the http request uri or NULL. This function will never return NULL if the request was
- * parsed successfully.
+ * Return a view of the http request uri. The view is empty until the request is parsed and
+ * points into the buffer the request was parsed from, so it is only valid while that buffer is.
  *
  * @param req: the request
  * @return the request uri
  */
-char* http_request_uri(http_request_t *req);
-void http_request_set_uri(http_request_t *req, char *uri);
+buffer_view_t http_request_uri(http_request_t *req);
+void http_request_set_uri(http_request_t *req, buffer_view_t uri);
 
 /**
- * Return the http request version or NULL. This function will never return NULL if the request was
- * parsed successfully.
+ * Return a view of the http request version. The view is empty until the request is parsed and
+ * points into the buffer the request was parsed from, so it is only valid while that buffer is.
  *
  * @param req: the request
  * @return the request version ("HTTP/1.0", "HTTP/1.1", "HTTP/"2.0", etc)
  */
-char* http_request_version(http_request_t *req);
-void http_request_set_version(http_request_t *req, char *version);
+buffer_view_t http_request_version(http_request_t *req);
+void http_request_set_version(http_request_t *req, buffer_view_t version);
+
+http_headers_t* http_request_get_headers(http_request_t *req);
 
 /**
- * Return the http header with the given key or NULL if no such header was parsed.
+ * Return the value of the http header with the given key or NULL if no such header was parsed.
+ * Keys are compared case-insensitively.
  * 
  * @param req: the request
  * @param key: the header key
  * @return the header value or NULL
  */
-http_headers_t* http_request_get_headers(http_request_t *req);
+buffer_view_t* http_request_header(http_request_t *req, char *key);
 
 /**
- * Destroy the request and free all associated memory.
+ * Return the value of the well-known header with the given id or NULL if no such header was
+ * parsed. This is a single array access.
  * 
  * @param req: the request
+ * @param id: the header id, which must not be HTTP_HEADER_OTHER
+ * @return the header value or NULL
  */
-void http_request_destroy(http_request_t *req);
+buffer_view_t* http_request_header_id(http_request_t *req, http_header_id_t id);
 
 /**
  * Parse an http request from the buffer. Return the number of characters parsed from the buffer
- * or -1 if the request was unable to be parsed.
+ * or -1 if the request was unable to be parsed. The request refers to the buffer rather than
+ * copying from it, so the buffer must outlive any use of the request.
  *
  * @param buffer: the buffer
  * @param req: the http_request_t to fill
@@ -82,23 +165,416 @@ long parse_http_request(buffer_t buffer, http_request_t *req);
 
 
 
-http_response_t* http_response_create();
-void http_response_destroy(http_response_t *res);
+/**
+ * The http_parser_t struct incrementally parses an http request message which arrives in
+ * several pieces. The parser remembers the position and state at which it stopped, so each byte
+ * of the request is examined exactly once regardless of how many pieces it arrives in.
+ */
+typedef struct http_parser http_parser_t;
+
+/**
+ * Create a parser that is ready to parse the start of a request.
+ *
+ * @return the parser
+ */
+http_parser_t* http_parser_create();
+
+/**
+ * Destroy the parser and free all associated memory.
+ *
+ * @param parser: the parser
+ */
+void http_parser_destroy(http_parser_t *parser);
+
+/**
+ * Discard the parser state so that the next call to http_parser_feed starts a new request.
+ *
+ * @param parser: the parser
+ */
+void http_parser_reset(http_parser_t *parser);
+
+/**
+ * Continue parsing an http request. The buffer must contain every byte of the request received
+ * so far, starting at the first byte of the request line; only the bytes after the position at
+ * which the previous call stopped are examined.
+ *
+ * Return HTTP_PARSE_INCOMPLETE if more data is required, HTTP_PARSE_ERROR if the request is
+ * invalid, and HTTP_PARSE_TOO_LARGE if the head is longer than the maximum size. Once the request
+ * head is complete, fill `req` exactly as parse_http_request would, reset the parser, and return
+ * the number of bytes in the request head.
+ *
+ * @param parser: the parser
+ * @param buffer: the bytes of the request received so far
+ * @param req: the http_request_t to fill
+ * @return the length of the request head, HTTP_PARSE_INCOMPLETE, HTTP_PARSE_ERROR or
+ * HTTP_PARSE_TOO_LARGE.
+ */
+long http_parser_feed(http_parser_t *parser, buffer_t buffer, http_request_t *req);
+
+/**
+ * Set the largest request head, from the request line to the empty line which ends the header
+ * fields, which the parser accepts. It is HTTP_DEFAULT_MAX_HEAD by default.
+ *
+ * @param parser: the parser
+ * @param max_head: the maximum head size in bytes
+ */
+void http_parser_set_max_head(http_parser_t *parser, size_t max_head);
+
+/**
+ * The callback which receives the body of a request one piece at a time. The chunk points into
+ * the buffer passed to http_parser_feed_body and is only valid during the call.
+ */
+typedef void (*http_body_cb)(void *data, buffer_view_t chunk);
+
+/**
+ * Set the largest request body the parser accepts, which is HTTP_DEFAULT_MAX_BODY by default.
+ * For chunked bodies the limit is enforced as each chunk size arrives.
+ *
+ * @param parser: the parser
+ * @param max_body: the maximum body size in bytes
+ */
+void http_parser_set_max_body(http_parser_t *parser, size_t max_body);
+
+/**
+ * Determine how the body of a request is framed, from its Content-Length and Transfer-Encoding
+ * headers. This must be called after http_parser_feed returns a request head and before the
+ * next request is fed.
+ *
+ * Return 0 if the request has no body, 1 if a body follows which must be consumed with
+ * http_parser_feed_body, HTTP_PARSE_ERROR if the framing is invalid or ambiguous (such as both
+ * headers being present), and HTTP_PARSE_TOO_LARGE if the body exceeds the maximum size.
+ *
+ * @param parser: the parser
+ * @param req: the request returned by http_parser_feed
+ * @return 0, 1, HTTP_PARSE_ERROR or HTTP_PARSE_TOO_LARGE
+ */
+int http_parser_start_body(http_parser_t *parser, http_request_t *req);
+
+/**
+ * Continue parsing a request body, passing its data to `on_body` as it arrives. Unlike
+ * http_parser_feed, the buffer starts at the first byte which has not been consumed yet, so
+ * consumed bytes can be discarded and a body of any size is parsed in constant memory. Chunked
+ * framing, chunk extensions and trailer fields are removed from the data.
+ *
+ * Return 0 once the body is complete, HTTP_PARSE_INCOMPLETE if more data is required, and
+ * HTTP_PARSE_ERROR or HTTP_PARSE_TOO_LARGE if the body is invalid. In every case `consumed` is
+ * set to the number of bytes of the buffer which were parsed.
+ *
+ * @param parser: the parser
+ * @param buffer: the bytes following those consumed by the previous call
+ * @param consumed: set to the number of bytes consumed
+ * @param on_body: the callback which receives the body data, or NULL to discard it
+ * @param data: passed to the callback
+ * @return 0, HTTP_PARSE_INCOMPLETE, HTTP_PARSE_ERROR or HTTP_PARSE_TOO_LARGE
+ */
+long http_parser_feed_body(http_parser_t *parser, buffer_t buffer, size_t *consumed, http_body_cb on_body, void *data);
+
+/**
+ * Create a "200 OK" response in the arena with no headers.
+ *
+ * @param arena: the arena to allocate from
+ * @return the response
+ */
+http_response_t* http_response_create(arena_t *arena);
 
 int http_response_get_status(http_response_t *res);
 void http_response_set_status(http_response_t *res, int status);
 
 http_headers_t* http_response_get_headers(http_response_t *res);
+buffer_view_t http_response_version(http_response_t *res);
 
-buffer_t* http_response_get_body(http_response_t *res);
-void http_response_set_body(http_response_t *res, buffer_t body);
+buffer_view_t http_response_get_body(http_response_t *res);
+void http_response_set_body(http_response_t *res, buffer_view_t body);
 
+/**
+ * Serialize the status line and headers of the response. The result is allocated from the
+ * response's arena and must not be destroyed.
+ *
+ * @param res: the response
+ * @return the response head
+ */
 buffer_t http_response_write_head(http_response_t *res);
 
+/**
+ * Serialize the status line and headers of the response into `dest` in a single pass, copying
+ * the pre-rendered status line and the headers as they are. Like snprintf, the length of the
+ * whole head is returned even if it does not fit, in which case the contents of `dest` are
+ * unspecified and the caller should retry with a larger buffer.
+ *
+ * @param res: the response
+ * @param dest: the destination, which may be NULL if `size` is 0
+ * @param size: the size of the destination
+ * @return the length of the response head
+ */
+size_t http_response_write_head_to(http_response_t *res, uint8_t *dest, size_t size);
+
+/**
+ * A status line and headers rendered once, such as the head shared by every response of an
+ * endpoint, which is copied into responses as bytes.
+ */
+typedef struct http_preset {
+    int status;
+    buffer_view_t head;
+} http_preset_t;
+
+/**
+ * Render the status line and headers of `res` into a preset allocated from the response's
+ * arena, which must outlive every response the preset is used for.
+ *
+ * @param res: the response to render
+ * @return the preset
+ */
+http_preset_t http_response_render_preset(http_response_t *res);
+
+/**
+ * Start the head of the response with the preset and set its status to the preset's status.
+ * The headers of the response are written after those of the preset, so they must not repeat
+ * any of them. Setting a different status afterwards discards the preset.
+ *
+ * @param res: the response
+ * @param preset: the preset
+ */
+void http_response_use_preset(http_response_t *res, http_preset_t preset);
+
+/* the length of an HTTP date such as "Sun, 06 Nov 1994 08:49:37 GMT" */
+#define HTTP_DATE_LENGTH 29
+
+/**
+ * The value of the Date header, which only changes once a second and is formatted only when
+ * it does.
+ */
+typedef struct http_date {
+    time_t time;
+    char value[HTTP_DATE_LENGTH + 1];
+} http_date_t;
+
+/**
+ * Format `time` as an RFC 7231 HTTP date into `dest`, followed by a null terminator.
+ *
+ * @param time: the time
+ * @param dest: at least HTTP_DATE_LENGTH + 1 bytes
+ */
+void http_date_format(time_t time, char *dest);
+
+/**
+ * Reformat the date if `now` is a different second than the one it holds.
+ *
+ * @param date: the date
+ * @param now: the current time
+ * @return true if the value changed
+ */
+bool http_date_update(http_date_t *date, time_t now);
+
+/**
+ * Parse an HTTP date in the preferred IMF-fixdate format, such as the value of an
+ * If-Modified-Since header. The obsolete formats are not accepted, which RFC 7232 allows for
+ * conditional requests since the header is then ignored.
+ *
+ * @param value: the date
+ * @param time: the result
+ * @return 0 if successful and -1 otherwise
+ */
+int http_date_parse(buffer_view_t value, time_t *time);
+
+/**
+ * Return true if the value of an If-None-Match header matches `etag`, either because it is "*"
+ * or because one of the listed entity tags is equal to `etag` by weak comparison.
+ *
+ * @param header: the value of the If-None-Match header
+ * @param etag: the quoted entity tag of the current representation
+ * @return true if the header matches
+ */
+bool http_etag_match(buffer_view_t header, buffer_view_t etag);
+
+/**
+ * Evaluate the If-None-Match and If-Modified-Since headers of a GET or HEAD request against the
+ * current representation and return true if it should be answered with 304 Not Modified. As
+ * required by RFC 7232, If-Modified-Since is ignored when If-None-Match is present.
+ *
+ * @param req: the request
+ * @param etag: the quoted entity tag of the representation
+ * @param last_modified: the modification time of the representation
+ * @return true if the client's copy is still current
+ */
+bool http_request_not_modified(http_request_t *req, buffer_view_t etag, time_t last_modified);
+
+/* the largest number of ranges accepted in a Range header */
+#define HTTP_MAX_RANGES 16
+
+/**
+ * A range of bytes of a representation.
+ */
+typedef struct http_range {
+    size_t offset;
+    size_t length;
+} http_range_t;
+
+/**
+ * Parse the value of a Range header for a representation of `size` bytes. Ranges which start
+ * beyond the end are skipped, and ranges which extend past it are shortened. The result is
+ * sorted by offset, with ranges which overlap or are adjacent coalesced into one.
+ *
+ * Return the number of satisfiable ranges stored in `ranges`, or 0 if there is none, in which case
+ * the request should be answered with 416. Return -1 if the header is invalid, uses a unit other
+ * than bytes, lists more than `max` ranges or asks for more bytes in total than `size`, in which
+ * case it should be ignored.
+ *
+ * @param value: the value of the Range header
+ * @param size: the size of the representation
+ * @param ranges: the result
+ * @param max: the capacity of `ranges`
+ * @return the number of ranges or -1
+ */
+int http_range_parse(buffer_view_t value, size_t size, http_range_t *ranges, size_t max);
+
+/**
+ * Return true if the Range header of the request should be honoured because there is no
+ * If-Range header or it matches the current representation. An entity tag must match exactly,
+ * and a date must equal the modification time.
+ *
+ * @param req: the request
+ * @param etag: the quoted strong entity tag of the representation
+ * @param last_modified: the modification time of the representation
+ * @return true if the range applies
+ */
+bool http_request_range_applies(http_request_t *req, buffer_view_t etag, time_t last_modified);
+
 long parse_http_response(buffer_t buffer, http_response_t *res);
 
-char* http_headers_get(http_headers_t *headers, char *key);
+/**
+ * The http_stream_t struct writes a response whose body is produced a piece at a time, so the
+ * first bytes can be sent before the rest of the body exists. Each write is passed to an
+ * http_write_cb, which normally sends the buffers to the client.
+ */
+typedef struct http_stream http_stream_t;
+
+/**
+ * The callback which sends the buffers of a stream in order. The buffers are only valid during
+ * the call. Return false if the caller should stop writing until the connection has drained,
+ * as tcp_server_writev does.
+ */
+typedef bool (*http_write_cb)(void *data, const buffer_view_t *buffers, size_t count);
+
+/**
+ * Create a stream for the response to `req` in the response's arena. If the response has no
+ * Content-Length, its body is sent with chunked encoding on HTTP/1.1, and on HTTP/1.0 it is
+ * delimited by closing the connection, in which case "Connection: close" is added.
+ *
+ * @param req: the request being answered
+ * @param res: the response, whose headers may still be changed until the head is written
+ * @param write: the callback which sends the response
+ * @param data: passed to the callback
+ * @return the stream
+ */
+http_stream_t* http_stream_create(http_request_t *req, http_response_t *res, http_write_cb write, void *data);
+
+/**
+ * Write the status line and headers of the response.
+ *
+ * @param stream: the stream
+ * @return the result of the write callback
+ */
+bool http_stream_write_head(http_stream_t *stream);
+
+/**
+ * Write the next piece of the body, framed as a chunk if the stream uses chunked encoding.
+ * The chunk is passed to the write callback without being copied.
+ *
+ * @param stream: the stream
+ * @param chunk: the body data
+ * @return the result of the write callback
+ */
+bool http_stream_write_chunk(http_stream_t *stream, buffer_view_t chunk);
+
+/**
+ * Finish the body by writing the last chunk if the stream uses chunked encoding.
+ *
+ * @param stream: the stream
+ * @return the result of the write callback
+ */
+bool http_stream_end(http_stream_t *stream);
+
+/**
+ * Return true if the connection must be closed after the response, either because the
+ * response says so or because the end of the body is marked by closing the connection.
+ *
+ * @param stream: the stream
+ * @return true if the connection must be closed
+ */
+bool http_stream_closes_connection(http_stream_t *stream);
+
+/**
+ * Create an empty list of headers in the arena.
+ *
+ * @param arena: the arena to allocate from
+ * @return the headers
+ */
+http_headers_t* http_headers_create(arena_t *arena);
+
+/**
+ * Return the number of header fields, counting repeated keys separately.
+ *
+ * @param headers: the headers
+ * @return the number of headers
+ */
+size_t http_headers_size(http_headers_t *headers);
+
+/**
+ * Return the ith header field in the order it was added.
+ *
+ * @param headers: the headers
+ * @param i: the index of the header
+ * @return the header
+ */
+http_header_t* http_headers_at(http_headers_t *headers, size_t i);
+
+/**
+ * Append a header field without checking for an existing field with the same key.
+ *
+ * @param headers: the headers
+ * @param key: the header key
+ * @param value: the header value
+ */
+void http_headers_add(http_headers_t *headers, buffer_view_t key, buffer_view_t value);
+
+/**
+ * Return the value of the first header with the given key, compared case-insensitively, or NULL.
+ * Well-known headers are found through their slot and other headers through a hash index.
+ *
+ * @param headers: the headers
+ * @param key: the header key
+ * @return the header value or NULL
+ */
+buffer_view_t* http_headers_get(http_headers_t *headers, char *key);
+
+/**
+ * Set the header with the given key, replacing its value if it is already present. No copies are
+ * made, so the key and value must remain valid for as long as the headers are used.
+ *
+ * @param headers: the headers
+ * @param key: the header key
+ * @param val: the header value
+ */
 void http_headers_set(http_headers_t *headers, char *key, char *val);
 
+/**
+ * Return the value of the well-known header with the given id or NULL.
+ *
+ * @param headers: the headers
+ * @param id: the header id, which must not be HTTP_HEADER_OTHER
+ * @return the header value or NULL
+ */
+buffer_view_t* http_headers_get_id(http_headers_t *headers, http_header_id_t id);
+
+/**
+ * Set the well-known header with the given id, adding it under its canonical name if it is not
+ * already present. The value is not copied.
+ *
+ * @param headers: the headers
+ * @param id: the header id, which must not be HTTP_HEADER_OTHER
+ * @param val: the header value
+ */
+void http_headers_set_id(http_headers_t *headers, http_header_id_t id, char *val);
+
 #endif /* HTTP_H */
 
@@ -0,0 +1,176 @@
+#ifndef HTTP_FILE_H
+#define HTTP_FILE_H
+
+/**
+ * @file http_file.h
+ * @brief Serving the files below a document root.
+ * @author Thomas Barrett
+ */
+
+#include <buffer.h>
+#include <http.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+/**
+ * An open regular file together with the metadata needed to answer a request for it.
+ */
+typedef struct http_file {
+    int fd;
+    size_t size;
+    time_t mtime;
+    ino_t ino;
+    const char *content_type;
+} http_file_t;
+
+/**
+ * Map the absolute path of a request to a file below the directory `root` and store the null
+ * terminated result in `dest`. A query after the path is ignored. Each segment is percent-decoded.
+ * Dot segments and segments which decode to a '/' or a null byte are rejected rather than
+ * resolved, so the result can never refer to a file outside of `root`. Segments without a '%'
+ * are copied as they are.
+ *
+ * @param root: the document root
+ * @param uri: the absolute path of the request, optionally followed by a query
+ * @param dest: the destination
+ * @param size: the size of the destination
+ * @return the length of the result or -1 if the path is invalid or does not fit in `dest`
+ */
+long http_file_path(const char *root, buffer_view_t uri, char *dest, size_t size);
+
+/**
+ * Open the regular file at `path` for reading and fill in `file`.
+ *
+ * @param file: the file
+ * @param path: the path of the file
+ * @return 0 if successful and -1 with errno set otherwise, where EISDIR is used for anything
+ * other than a regular file.
+ */
+int http_file_open(http_file_t *file, const char *path);
+
+/**
+ * Close the file if it is open.
+ *
+ * @param file: the file
+ */
+void http_file_close(http_file_t *file);
+
+/**
+ * Return the media type of a file from the extension of its path, or
+ * "application/octet-stream" if the extension is unknown.
+ *
+ * @param path: the path of the file
+ * @return the media type
+ */
+const char* http_file_content_type(const char *path);
+
+/* the size of a buffer which holds any entity tag from http_file_etag */
+#define HTTP_FILE_ETAG_SIZE 64
+
+/**
+ * Write a strong entity tag for the file to `dest`, which changes whenever the file is replaced
+ * or its size or modification time changes. It is derived from the file's metadata, so the
+ * contents are never read.
+ *
+ * @param file: the file
+ * @param dest: at least HTTP_FILE_ETAG_SIZE bytes
+ * @return the length of the quoted entity tag
+ */
+size_t http_file_etag(http_file_t *file, char *dest);
+
+/**
+ * The http_file_cache_t struct keeps small files in memory together with the head of the
+ * response which serves them, so a hit needs no system calls at all. Entries are keyed by the
+ * path from http_file_path and evicted in least recently used order once the cache exceeds its
+ * size. A cache is not thread safe, so each worker should own one.
+ *
+ * An entry is revalidated with stat at most once per second, so a file that changes is served
+ * from memory for up to a second before the new version is loaded.
+ */
+typedef struct http_file_cache http_file_cache_t;
+
+/**
+ * A cached file. It stays valid until the next call to http_file_cache_collect.
+ */
+typedef struct http_file_entry http_file_entry_t;
+
+/**
+ * Create an empty cache.
+ *
+ * @param max_size: the total number of bytes of file data the cache may hold
+ * @param max_file_size: the size of the largest file which is cached
+ * @return the cache
+ */
+http_file_cache_t* http_file_cache_create(size_t max_size, size_t max_file_size);
+
+/**
+ * Destroy the cache and every entry in it.
+ *
+ * @param cache: the cache
+ */
+void http_file_cache_destroy(http_file_cache_t *cache);
+
+/**
+ * Return the entry for the file at `path`, loading it if it is not cached or has changed. If the
+ * file can not be cached because it is too large, it is left open in `file` instead, so the
+ * caller can send it without opening it again. Otherwise file->fd is -1.
+ *
+ * @param cache: the cache
+ * @param path: the path of the file
+ * @param now: the current time, which decides whether the entry is revalidated
+ * @param file: the file if it is not cached
+ * @return the entry, or NULL if the file is not cached, with errno set if it could not be read
+ */
+http_file_entry_t* http_file_cache_get(http_file_cache_t *cache, const char *path, time_t now, http_file_t *file);
+
+/**
+ * Free the entries which were evicted or replaced since the last call. Responses may refer to
+ * an entry until they have been written, so this should be called once they have.
+ *
+ * @param cache: the cache
+ */
+void http_file_cache_collect(http_file_cache_t *cache);
+
+/**
+ * Return the number of bytes of file data held by the cache.
+ *
+ * @param cache: the cache
+ * @return the size of the cache
+ */
+size_t http_file_cache_size(http_file_cache_t *cache);
+
+/**
+ * Return the status line and headers which start every response for the entry, including
+ * Content-Length, Content-Type, Last-Modified, ETag and Accept-Ranges.
+ *
+ * @param entry: the entry
+ * @return the response head
+ */
+http_preset_t http_file_entry_head(http_file_entry_t *entry);
+
+/**
+ * Return the contents of the cached file.
+ *
+ * @param entry: the entry
+ * @return the file data
+ */
+buffer_view_t http_file_entry_data(http_file_entry_t *entry);
+
+/**
+ * Return the entity tag of the cached file as a null terminated string.
+ *
+ * @param entry: the entry
+ * @return the entity tag
+ */
+const char* http_file_entry_etag(http_file_entry_t *entry);
+
+/**
+ * Return the modification time of the cached file.
+ *
+ * @param entry: the entry
+ * @return the modification time
+ */
+time_t http_file_entry_mtime(http_file_entry_t *entry);
+
+#endif /* HTTP_FILE_H */
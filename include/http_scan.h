@@ -0,0 +1,95 @@
+#ifndef HTTP_SCAN_H
+#define HTTP_SCAN_H
+
+/**
+ * @file http_scan.h
+ * @brief Character classes and delimiter scanning for the http tokenizer.
+ * @author Thomas Barrett
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define HTTP_CHAR_TCHAR 0x01     /* token characters (rfc7230 tchar) */
+#define HTTP_CHAR_VCHAR 0x02     /* visible characters 0x21-0x7E */
+#define HTTP_CHAR_SPACE 0x04     /* SP and HTAB */
+#define HTTP_CHAR_OBS_TEXT 0x08  /* 0x80-0xFF */
+#define HTTP_CHAR_DIGIT 0x10     /* 0-9 */
+#define HTTP_CHAR_HEX 0x20       /* 0-9, a-f and A-F */
+#define HTTP_CHAR_PATH 0x40      /* pchar without pct-encoded, plus '/' (rfc3986) */
+#define HTTP_CHAR_FIELD (HTTP_CHAR_VCHAR | HTTP_CHAR_SPACE | HTTP_CHAR_OBS_TEXT)
+
+/**
+ * The character class of each byte value as a combination of the HTTP_CHAR_* flags.
+ */
+extern const uint8_t http_char_class[256];
+
+/**
+ * The implementations of the scanning functions. Faster implementations are only available
+ * when the CPU supports the instructions they use.
+ */
+typedef enum http_scan_impl {
+    HTTP_SCAN_PORTABLE,
+    HTTP_SCAN_SSE42,
+    HTTP_SCAN_AVX2,
+} http_scan_impl_t;
+
+/**
+ * Return the index of the first byte which is not a token character, or `length` if every
+ * byte is a token character.
+ *
+ * @param data the bytes to scan
+ * @param length the number of bytes
+ * @return the index of the first non-token byte
+ */
+size_t http_scan_token(const uint8_t *data, size_t length);
+
+/**
+ * Return the index of the first byte which cannot appear in a header field value (a control
+ * character other than HTAB, such as CR), or `length` if there is no such byte.
+ *
+ * @param data the bytes to scan
+ * @param length the number of bytes
+ * @return the index of the first byte which ends the field value
+ */
+size_t http_scan_field(const uint8_t *data, size_t length);
+
+/**
+ * Return the index of the first byte which is not a path character (rfc3986 pchar) other than
+ * a percent-encoded triplet, so the scan stops at every '%' and '/', or `length` if there is no
+ * such byte.
+ *
+ * @param data the bytes to scan
+ * @param length the number of bytes
+ * @return the index of the first byte which is not a plain path character
+ */
+size_t http_scan_pchar(const uint8_t *data, size_t length);
+
+/**
+ * Return the index of the first reserved character (rfc3986 gen-delims and sub-delims), or
+ * `length` if there is no such byte.
+ *
+ * @param data the bytes to scan
+ * @param length the number of bytes
+ * @return the index of the first reserved byte
+ */
+size_t http_scan_reserved(const uint8_t *data, size_t length);
+
+/**
+ * Return the implementation currently used by the scanning functions. The fastest one
+ * supported by the CPU is selected when the program starts.
+ *
+ * @return the implementation
+ */
+http_scan_impl_t http_scan_get_impl();
+
+/**
+ * Switch the scanning functions to the given implementation. This is intended for tests and
+ * benchmarks and must not be called while other threads are scanning.
+ *
+ * @param impl the implementation
+ * @return -1 if the CPU does not support the implementation and 0 otherwise
+ */
+int http_scan_set_impl(http_scan_impl_t impl);
+
+#endif /* HTTP_SCAN_H */
@@ -4,6 +4,16 @@
 #include <buffer.h>
 #include <array.h>
 
+/**
+ * Return 1 if the character `c` is unreserved, as defined in rfc3986 section 2.3.
+ */
+int is_unreserved(char c);
+
+/**
+ * Return 1 if the character `c` is a sub-delimiter, as defined in rfc3986 section 2.2.
+ */
+int is_sub_delim(char c);
+
 /**
  * Parse an absolute path from the input buffer. If the path is parsed successfully,
  * return the number of characters successfully parsed and store a view to the parsed range
@@ -14,6 +24,16 @@
  */
 long parse_absolute_path(buffer_view_t buffer, array_t *segments);
 
+/**
+ * Parse the query which may follow an absolute path, as defined in rfc3986 section 3.4, from the
+ * input buffer. Return the number of characters parsed including the leading '?', or 0 if the
+ * buffer does not start with a '?'.
+ *
+ * @param buffer: the input buffer.
+ * @return the number of characters parsed, -1 if the query is incomplete or -2 in case of error.
+ */
+long parse_query(buffer_view_t buffer);
+
 /**
  * Parse a path segment from the input buffer. If the path segment is parsed successfully,
  * return the number of characters successfully parsed and store a view to the parsed range
@@ -24,6 +44,16 @@ long parse_absolute_path(buffer_view_t buffer, array_t *segments);
  */
 long parse_path_segment(buffer_view_t buffer);
 
+/**
+ * Percent-decode the segment into `dest`, which may be the segment itself, and return the length
+ * of the result. Runs of characters which need no decoding are found and copied in bulk.
+ *
+ * @param seg: the percent encoded segment.
+ * @param dest: the destination, with room for at least seg.length bytes.
+ * @return the length of the decoded segment, or -1 if it is not a valid segment.
+ */
+long path_segment_decode_to(buffer_view_t seg, uint8_t *dest);
+
 /**
  *
  * Decode the given percent-encoded uri. If successful, return 0 and store the result in
@@ -37,6 +67,16 @@ long parse_path_segment(buffer_view_t buffer);
  */
 int path_segment_decode(buffer_t seg, buffer_t *res);
 
+/**
+ * Percent-encode the reserved characters of the segment into `dest` and return the length of the
+ * result. Runs of characters which need no encoding are found and copied in bulk.
+ *
+ * @param seg: the segment.
+ * @param dest: the destination, with room for at least 3 * seg.length bytes.
+ * @return the length of the encoded segment.
+ */
+size_t path_segment_encode_to(buffer_view_t seg, uint8_t *dest);
+
 /**
  * Percent-encode the input segment. If successful, return 0 and store the result in
  * the `res` paramter. If unsuccessful, return -1. If res is not NULL, this function
@@ -49,18 +89,22 @@ int path_segment_decode(buffer_t seg, buffer_t *res);
 int path_segment_encode(buffer_t seg, buffer_t *res);
 
 /**
- * Normalize the input path. If successful, return 0 and store the result in `res` paramter.
- * If unsuccessful, return -1. If the input path is a valid relative or absolute path, then
- * is function will always succeed. The input path is normalized by the following steps:
+ * Normalize the input path in a single pass. If successful, return 0 and store a view of the
+ * result in the `res` parameter. If the path is already normal, the result is the input path
+ * itself and nothing is written to `dest`. Otherwise it is written to `dest`, which needs room
+ * for at least as many bytes as the input path. Return -1 if the path is not a valid relative or
+ * absolute path, or if it is not normal and `dest` is too small. The input path is normalized
+ * by the following steps:
  *
  * 1. Percent-encoded triplets are converted to uppercase.
  * 2. Percent-encoded unreserved characters are decoded.
  * 3. All dot segments are applied using algorithm in rfc3986 section 5.2.4
  *
  * @param path: the input path.
+ * @param dest: the buffer which holds the result if it differs from the input path.
  * @param res: the resulting normalized path.
  * @return 0 if successful and -1 otherwise.
  */
-int path_normalize(buffer_t path, buffer_t *res);
+int path_normalize(buffer_view_t path, buffer_t dest, buffer_view_t *res);
 
 #endif /* URI_H */
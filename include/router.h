@@ -0,0 +1,95 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+/**
+ * @file router.h
+ * @brief Matching request paths against a set of route patterns.
+ * @author Thomas Barrett
+ */
+
+#include <buffer.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* the largest number of parameters in a route */
+#define ROUTER_MAX_PARAMS 16
+
+/**
+ * The router_t struct maps route patterns to user data. A pattern is an absolute path whose
+ * segments are either matched literally, captured with ":name", or, in the last segment only,
+ * captured together with the rest of the path with "*name". For example "/users/:id/posts"
+ * matches "/users/42/posts", and a last segment "*file" after "/static" captures "css/site.css"
+ * from "/static/css/site.css".
+ *
+ * Routes are compiled into a trie whose nodes are stored in one array, with the literal
+ * children of a node next to each other and sorted, so the literal child for a segment is found
+ * by binary search however many routes there are. Literal segments take precedence over
+ * parameters, and parameters over wildcards. When the preferred branch does not lead to a route,
+ * matching backtracks to the next one. A path usually visits one node per segment, but when
+ * literal and parameter routes overlap it may visit every node of the trie once at worst.
+ * Segments are compared before they are percent-decoded.
+ */
+typedef struct router router_t;
+
+/**
+ * The result of a match. Parameter values are views into the matched path.
+ */
+typedef struct router_match {
+    void *data;
+    size_t param_count;
+    const buffer_view_t *names;
+    buffer_view_t params[ROUTER_MAX_PARAMS];
+} router_match_t;
+
+/**
+ * Create a router without any routes.
+ *
+ * @return the router
+ */
+router_t* router_create(void);
+
+/**
+ * Destroy the router. The user data of its routes is not freed.
+ *
+ * @param router: the router
+ */
+void router_destroy(router_t *router);
+
+/**
+ * Add a route. router_compile must be called before the next router_match.
+ *
+ * @param router: the router
+ * @param pattern: the pattern of the route
+ * @param data: the user data returned by matches of the route
+ * @return 0 if successful, -1 if the pattern is invalid and -2 if a route with the same
+ * pattern, ignoring the names of its parameters, already exists.
+ */
+int router_add(router_t *router, const char *pattern, void *data);
+
+/**
+ * Compile the routes which were added into the trie used by router_match.
+ *
+ * @param router: the router
+ */
+void router_compile(router_t *router);
+
+/**
+ * Match the absolute path against the routes of the router. The path must not include a query.
+ *
+ * @param router: the router
+ * @param path: the path
+ * @param match: the matched route and its parameters
+ * @return true if a route matched and false otherwise
+ */
+bool router_match(router_t *router, buffer_view_t path, router_match_t *match);
+
+/**
+ * Return the value of the parameter called `name` in the match, or NULL if there is none.
+ *
+ * @param match: the match
+ * @param name: the name of the parameter without the leading ':' or '*'
+ * @return the value of the parameter
+ */
+buffer_view_t* router_match_param(router_match_t *match, const char *name);
+
+#endif /* ROUTER_H */
@@ -7,6 +7,9 @@
 
 #include <netinet/in.h>
 #include <buffer.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
 
 /**
  * tcp_client_t manages a tcp connection to a single client. Each client has an address and
@@ -18,10 +21,20 @@ typedef struct tcp_client tcp_client_t;
  */
 typedef struct tcp_server tcp_server_t;
 
+/**
+ * tcp_cluster_t manages a group of tcp_server_t workers which each run an event loop on their
+ * own thread. Every worker owns a listening socket bound to the same port with SO_REUSEPORT and
+ * its own client table, so the kernel spreads incoming connections across the workers and the
+ * workers never share connection state.
+ */
+typedef struct tcp_cluster tcp_cluster_t;
+
 typedef void (*tcp_connect_cb)(tcp_server_t *server, tcp_client_t *client);
 typedef void (*tcp_close_cb)(tcp_server_t *server, tcp_client_t *client);
 typedef void (*tcp_read_cb)(tcp_server_t *server, tcp_client_t *client, buffer_t chunk);
 typedef void (*tcp_error_cb)(tcp_server_t *server, tcp_client_t *client, int errnum);
+typedef void (*tcp_drain_cb)(tcp_server_t *server, tcp_client_t *client);
+typedef void (*tcp_timer_cb)(tcp_server_t *server, void *data);
 
 /**
  * tcp_server_create creates and returns a new tcp server with the given callback functions.
@@ -40,11 +53,72 @@ void tcp_server_destroy(tcp_server_t *server);
  * disconnect, the on_close callback is called. If any of the client file descriptors have data
  * available to read, the on_read callback is called.
  *
+ * File descriptors are registered with an edge-triggered epoll instance when they are accepted,
+ * so the cost of a call depends only on the number of ready file descriptors and not on the
+ * number of idle connections.
+ *
  * @param self: the server
  * @return -1 if an error occurs and 0 otherwise.
  */
 int tcp_server_poll(tcp_server_t *self);
 
+/**
+ * Identical to tcp_server_poll, but sleep in the kernel for up to `timeout` milliseconds until a
+ * file descriptor becomes ready, a timer expires, or tcp_server_wakeup is called. A negative
+ * timeout waits indefinitely. Expired timers are run before returning.
+ *
+ * @param self: the server
+ * @param timeout: the maximum number of milliseconds to wait or -1 to wait indefinitely
+ * @return -1 if an error occurs and 0 otherwise.
+ */
+int tcp_server_poll_timeout(tcp_server_t *self, int timeout);
+
+/**
+ * Run the event loop until tcp_server_stop is called. The calling thread sleeps whenever there
+ * is no I/O or timer to process, so an idle server does not consume any cpu time.
+ *
+ * @param self: the server
+ * @return -1 if an error occurs and 0 if the server was stopped.
+ */
+int tcp_server_run(tcp_server_t *self);
+
+/**
+ * Request that tcp_server_run returns after the current iteration of the event loop. This
+ * function is safe to call from any thread and from a signal handler.
+ *
+ * @param self: the server
+ */
+void tcp_server_stop(tcp_server_t *self);
+
+/**
+ * Interrupt a blocking call to tcp_server_poll_timeout or tcp_server_run. This function is safe
+ * to call from any thread and from a signal handler.
+ *
+ * @param self: the server
+ */
+void tcp_server_wakeup(tcp_server_t *self);
+
+/**
+ * Call `cb` once from the event loop after `timeout` milliseconds have elapsed. Return an id
+ * which can be passed to tcp_server_clear_timeout to cancel the timer.
+ *
+ * @param self: the server
+ * @param timeout: the delay in milliseconds
+ * @param cb: the timer callback
+ * @param data: the argument passed to the callback
+ * @return the timer id
+ */
+uint64_t tcp_server_set_timeout(tcp_server_t *self, int timeout, tcp_timer_cb cb, void *data);
+
+/**
+ * Cancel the timer with the given id if it has not already expired. The timer is found through
+ * an index by id, so cancelling takes logarithmic time in the number of pending timers.
+ *
+ * @param self: the server
+ * @param id: the timer id
+ */
+void tcp_server_clear_timeout(tcp_server_t *self, uint64_t id);
+
 /**
  * Start listening for incoming connections on the specified port. If an error occurs, return -1 
  * and set errno to the appropriate error code.
@@ -56,18 +130,195 @@ int tcp_server_poll(tcp_server_t *self);
  */
 int tcp_server_listen(tcp_server_t *self, int port, int backlog);
 
+/**
+ * Return the index of the worker that runs the server's event loop. The callbacks of a server
+ * are always called from its own worker thread, so this identifies the calling worker. A server
+ * that was not created by tcp_cluster_create is worker 0.
+ *
+ * @param self: the server
+ * @return the worker index
+ */
+size_t tcp_server_worker(tcp_server_t *self);
+
+/**
+ * Set the server's extra data field. The extra data field should be used for adding application
+ * specific per-worker state to a tcp_server.
+ *
+ * @param self: the server
+ * @param data: the extra data
+ */
+void tcp_server_set_data(tcp_server_t *self, void *data);
+
+/**
+ * Return the server's extra data field or NULL if no such field was ever set.
+ *
+ * @param self: the server
+ * @return the extra data
+ */
+void* tcp_server_data(tcp_server_t *self);
+
+/**
+ * tcp_cluster_create creates a cluster of `size` workers with the given callback functions.
+ */
+tcp_cluster_t* tcp_cluster_create(size_t size, tcp_connect_cb on_connect, tcp_close_cb on_close, tcp_read_cb on_read, tcp_error_cb on_error);
+
+/**
+ * tcp_cluster_destroy destroys every worker of the cluster. The cluster must not be running.
+ */
+void tcp_cluster_destroy(tcp_cluster_t *cluster);
+
+/**
+ * Start listening for incoming connections on the specified port with every worker. If an
+ * error occurs, return -1 and set errno to the appropriate error code.
+ *
+ * @param cluster: the cluster
+ * @param port: the port on which to listen for incoming connections
+ * @param backlog: the maximum number of queued connections per worker
+ * @return -1 if an error occurs and 0 otherwise.
+ */
+int tcp_cluster_listen(tcp_cluster_t *cluster, int port, int backlog);
+
+/**
+ * Start one thread per worker which runs tcp_server_run and wait until every worker has
+ * stopped.
+ *
+ * @param cluster: the cluster
+ * @return -1 if a worker thread could not be started and 0 otherwise.
+ */
+int tcp_cluster_run(tcp_cluster_t *cluster);
+
+/**
+ * Request that every worker stops. This function is safe to call from any thread and from a
+ * signal handler.
+ *
+ * @param cluster: the cluster
+ */
+void tcp_cluster_stop(tcp_cluster_t *cluster);
+
+/**
+ * Return the number of workers in the cluster.
+ */
+size_t tcp_cluster_size(tcp_cluster_t *cluster);
+
+/**
+ * Return the ith worker of the cluster.
+ */
+tcp_server_t* tcp_cluster_worker(tcp_cluster_t *cluster, size_t i);
+
 /**
  * tcp_client_addr returns the sockaddr_in corresponding to the client
  */
 struct sockaddr_in tcp_client_addr(tcp_client_t *client);
 
 /**
- * Close the client connection at the start of the next call to tcp_server_poll.
+ * Close the client connection and call the on_close callback. The client is freed at the end of
+ * the current (or next) call to tcp_server_poll and must not be referenced after that.
  *
  * @param self: the client
  */
 void tcp_server_close_client(tcp_server_t *self, tcp_client_t *client);
 
+/**
+ * Write the buffer to the client. If possible, write the entire buffer to the socket. If the
+ * operation would block, copy the remaining bytes into the client's write queue, which is
+ * flushed by the event loop once the socket becomes writable.
+ *
+ * Return false if the client's write queue exceeds the high watermark after the write or if the
+ * client is closed. In that case the caller should stop producing data for the client until the
+ * on_drain callback is called.
+ *
+ * @param self: the server
+ * @param client: the client
+ * @param buffer: the bytes to write
+ * @return false if the caller should stop writing and true otherwise.
+ */
+bool tcp_server_write(tcp_server_t *self, tcp_client_t *client, buffer_view_t buffer);
+
+/**
+ * Identical to tcp_server_write, but write several buffers in order with as few system calls as
+ * possible. Only the bytes which could not be sent immediately are copied into the write queue.
+ *
+ * @param self: the server
+ * @param client: the client
+ * @param buffers: the buffers to write
+ * @param count: the number of buffers
+ * @return false if the caller should stop writing and true otherwise.
+ */
+bool tcp_server_writev(tcp_server_t *self, tcp_client_t *client, const buffer_view_t *buffers, size_t count);
+
+/**
+ * Identical to tcp_server_write, but take ownership of `buffer`. If the operation would block,
+ * the remaining bytes are queued without being copied and the buffer is freed once it has been
+ * written.
+ *
+ * @param self: the server
+ * @param client: the client
+ * @param buffer: the heap allocated buffer to write
+ * @return false if the caller should stop writing and true otherwise.
+ */
+bool tcp_server_write_buffer(tcp_server_t *self, tcp_client_t *client, buffer_t buffer);
+
+/**
+ * Identical to tcp_server_write, but write `length` bytes of the file `fd` starting at `offset`
+ * with sendfile, so the bytes never pass through user space. If the operation would block, the
+ * rest of the range is queued with a duplicate of `fd` and sent as the socket becomes writable,
+ * so the caller may close `fd` as soon as this function returns.
+ *
+ * @param self: the server
+ * @param client: the client
+ * @param fd: the file descriptor of a regular file
+ * @param offset: the offset of the first byte in the file
+ * @param length: the number of bytes to write
+ * @return false if the caller should stop writing and true otherwise.
+ */
+bool tcp_server_sendfile(tcp_server_t *self, tcp_client_t *client, int fd, off_t offset, size_t length);
+
+/**
+ * Close the client connection once its write queue has been flushed. Data read from the
+ * client after this call is discarded.
+ *
+ * @param self: the server
+ * @param client: the client
+ */
+void tcp_server_end_client(tcp_server_t *self, tcp_client_t *client);
+
+/**
+ * Set the callback which is called when the write queue of a client falls to the low watermark
+ * after a call to tcp_server_write returned false.
+ *
+ * @param self: the server
+ * @param on_drain: the drain callback
+ */
+void tcp_server_on_drain(tcp_server_t *self, tcp_drain_cb on_drain);
+
+/**
+ * Set the write queue watermarks of the server. A write returns false once more than `high`
+ * bytes are queued for a client, and on_drain is called once no more than `low` bytes are
+ * queued. The defaults are 16 KiB and 64 KiB.
+ *
+ * @param self: the server
+ * @param low: the low watermark in bytes
+ * @param high: the high watermark in bytes
+ */
+void tcp_server_set_watermarks(tcp_server_t *self, size_t low, size_t high);
+
+/**
+ * Return the number of bytes in the client's write queue.
+ *
+ * @param self: the client
+ * @return the number of queued bytes
+ */
+size_t tcp_client_queue_size(tcp_client_t *self);
+
+/**
+ * Return true if the client has been closed, either explicitly or after a read or write error.
+ * The client's on_close callback has already run, so its extra data must not be used.
+ *
+ * @param self: the client
+ * @return true if the client is closed
+ */
+bool tcp_client_closed(tcp_client_t *self);
+
 /**
  * Set the client's extra data field. The extra data field should be used for 
  * adding application specific data to a tcp_client. The extra data field
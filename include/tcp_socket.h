@@ -68,6 +68,13 @@ int tcp_socket_connect(tcp_socket_t *sock, char *host, int port);
  * method will write and remove as much data as possible from the write queue if the file
  * descriptor becomes available for writing. Once the write queue is empty, the on_drain event will
  * be called. 
+ *
+ * The queue is stored as an array of iovecs and flushed with a single writev-style call. While
+ * the queue is not empty, the socket is not yet connected, or the socket is corked, the buffer
+ * is appended to the queue without a system call, so consecutive writes are sent together.
+ *
+ * If a write fails, for example because the peer has reset the connection, the on_error event
+ * is called and the socket is closed, which drops any data left in the queue.
  * 
  * @param sock the socket to write to
  * @param buffer the buffer to write to the socket
@@ -76,7 +83,24 @@ int tcp_socket_connect(tcp_socket_t *sock, char *host, int port);
 bool tcp_socket_write(tcp_socket_t *sock, buffer_view_t buffer);
 
 /**
- * tcp_socket_destroy closes the given socket connection. 
+ * tcp_socket_cork queues all subsequent writes without writing them to the socket until
+ * tcp_socket_uncork is called. This can be used to batch many small writes into one system call.
+ * 
+ * @param sock the socket
+ */
+void tcp_socket_cork(tcp_socket_t *sock);
+
+/**
+ * tcp_socket_uncork stops queueing writes and flushes the write queue with a single writev-style
+ * call.
+ * 
+ * @param sock the socket
+ */
+void tcp_socket_uncork(tcp_socket_t *sock);
+
+/**
+ * tcp_socket_destroy closes the given socket connection and frees all memory associated with
+ * the socket, including any data left in the write queue. No events are triggered.
  * @param sock the socket to be destroyed
  */
 void tcp_socket_destroy(tcp_socket_t *sock);
@@ -88,6 +112,15 @@ void tcp_socket_destroy(tcp_socket_t *sock);
  */
 int tcp_socket_poll(tcp_socket_t *sock);
 
+/**
+ * tcp_socket_poll_timeout is identical to tcp_socket_poll, but sleeps for up to `timeout`
+ * milliseconds until the socket connects or becomes readable. A negative timeout waits
+ * indefinitely.
+ * @param sock the socket to poll
+ * @param timeout the maximum number of milliseconds to wait or -1 to wait indefinitely
+ */
+int tcp_socket_poll_timeout(tcp_socket_t *sock, int timeout);
+
 /**
  * Return true if `sock` is not yet connected and false otherwise.
  * 
@@ -109,7 +142,8 @@ bool tcp_socket_is_connecting(tcp_socket_t *sock);
  * Close the socket for writing by sending a FIN message to the peer. If the socket is open for
  * both reading and writing, then the socket will remain open for reading until the 'on_end'
  * event is triggered. If the socket is half-open for writing (a FIN packet has already been recieved),
- * then the socket will close completely.
+ * then the socket will close completely. If the write queue is not empty, the FIN message is
+ * sent once the queue has been flushed.
  * 
  * @param sock the socket
  */
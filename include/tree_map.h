@@ -12,9 +12,18 @@
 
 typedef struct tree_map tree_map_t;
 
+/**
+ * An entry of the map in the order of its keys. It stays valid until it is removed, so other
+ * entries may be removed while iterating as long as the next one is found first.
+ */
+typedef struct tree_map_entry tree_map_entry_t;
+
 typedef int (*compare_t)(void*, void*);
 typedef void (*destroy_t)(void*);
 
+/* the function called for each entry by tree_map_range, which stops once it returns false */
+typedef bool (*tree_map_visit_t)(void *key, void *val, void *data);
+
 /**
  * Create a new map with with key type and value type of the given size.
  * 
@@ -66,5 +75,84 @@ void tree_map_set(tree_map_t *map, void *key, void *val);
  */
 void tree_map_remove(tree_map_t *map, void *key);
 
+/**
+ * Return the number of entries in the map.
+ * 
+ * @param map the map
+ */
+size_t tree_map_size(tree_map_t *map);
+
+/**
+ * Return the entry with the smallest key or null if the map is empty.
+ * 
+ * @param map the map
+ */
+tree_map_entry_t* tree_map_first(tree_map_t *map);
+
+/**
+ * Return the entry with the largest key or null if the map is empty.
+ * 
+ * @param map the map
+ */
+tree_map_entry_t* tree_map_last(tree_map_t *map);
+
+/**
+ * Return the entry after the given one in key order or null if it is the last.
+ * 
+ * @param entry the entry
+ */
+tree_map_entry_t* tree_map_next(tree_map_entry_t *entry);
+
+/**
+ * Return the entry before the given one in key order or null if it is the first.
+ * 
+ * @param entry the entry
+ */
+tree_map_entry_t* tree_map_prev(tree_map_entry_t *entry);
+
+/**
+ * Return the first entry whose key is not less than the given key or null if there is none.
+ * 
+ * @param map the map
+ * @param key the key
+ */
+tree_map_entry_t* tree_map_lower_bound(tree_map_t *map, void *key);
+
+/**
+ * Return the first entry whose key is greater than the given key or null if there is none.
+ * 
+ * @param map the map
+ * @param key the key
+ */
+tree_map_entry_t* tree_map_upper_bound(tree_map_t *map, void *key);
+
+/**
+ * Return the key of the entry.
+ * 
+ * @param entry the entry
+ */
+void* tree_map_entry_key(tree_map_entry_t *entry);
+
+/**
+ * Return the value of the entry.
+ * 
+ * @param map the map
+ * @param entry the entry
+ */
+void* tree_map_entry_val(tree_map_t *map, tree_map_entry_t *entry);
+
+/**
+ * Call `visit` for the entries whose keys are in [from, to) in key order, until it returns
+ * false. A null bound leaves that end of the range open. The map must not be changed by `visit`.
+ * 
+ * @param map the map
+ * @param from the smallest key of the range or null
+ * @param to the key after the range or null
+ * @param visit the function called with the key and value of each entry
+ * @param data the last argument of `visit`
+ * @return the number of entries visited
+ */
+size_t tree_map_range(tree_map_t *map, void *from, void *to, tree_map_visit_t visit, void *data);
+
 #endif /* TREE_MAP_H */
 
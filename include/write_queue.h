@@ -0,0 +1,85 @@
+#ifndef WRITE_QUEUE_H
+#define WRITE_QUEUE_H
+
+/**
+ * @file write_queue.h
+ * @brief A queue of pending socket writes stored as an iovec array.
+ * @author Thomas Barrett
+ */
+
+#include <buffer.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * The write_queue_t container holds the bytes that could not be written to a non-blocking file
+ * descriptor. Each queued buffer is stored as a struct iovec so that the entire queue can be
+ * flushed with a single writev-style system call.
+ */
+typedef struct write_queue write_queue_t;
+
+/**
+ * Create an empty write queue.
+ *
+ * @return the write queue
+ */
+write_queue_t* write_queue_create();
+
+/**
+ * Destroy the write queue and free every buffer that is still queued.
+ *
+ * @param queue the write queue
+ */
+void write_queue_destroy(write_queue_t *queue);
+
+/**
+ * Return the number of bytes in the queue.
+ *
+ * @param queue the write queue
+ * @return the number of queued bytes
+ */
+size_t write_queue_size(write_queue_t *queue);
+
+/**
+ * Add the bytes of `buffer` starting at `offset` to the back of the queue without copying
+ * them. The queue takes ownership of `buffer` and frees it once it has been written.
+ *
+ * @param queue the write queue
+ * @param buffer the buffer to queue
+ * @param offset the number of bytes at the front of `buffer` which were already written
+ */
+void write_queue_push(write_queue_t *queue, buffer_t buffer, size_t offset);
+
+/**
+ * Add a copy of `view` to the back of the queue.
+ *
+ * @param queue the write queue
+ * @param view the bytes to queue
+ */
+void write_queue_push_copy(write_queue_t *queue, buffer_view_t view);
+
+/**
+ * Add `length` bytes of the file `fd` starting at `offset` to the back of the queue. The bytes
+ * are sent with sendfile, so they are never copied into user space. The queue takes ownership
+ * of `fd` and closes it once the range has been written.
+ *
+ * @param queue the write queue
+ * @param fd the file descriptor of a regular file
+ * @param offset the offset of the first byte in the file
+ * @param length the number of bytes to send
+ */
+void write_queue_push_file(write_queue_t *queue, int fd, off_t offset, size_t length);
+
+/**
+ * Write as much of the queue as possible to the socket `fd` with a single call to sendmsg, or
+ * to sendfile if a file range is at the front, and remove the written bytes from the queue.
+ * Return the number of bytes written, 0 if the operation would block, or -1 and set errno if an
+ * error occurs.
+ *
+ * @param queue the write queue
+ * @param fd the socket file descriptor
+ * @return the number of bytes written or -1
+ */
+ssize_t write_queue_flush(write_queue_t *queue, int fd);
+
+#endif /* WRITE_QUEUE_H */
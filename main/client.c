@@ -1,10 +1,14 @@
 #include <log.h>
 #include <tcp_socket.h>
 
+#include <string.h>
+#include <stdbool.h>
+
+static bool done = false;
+
 void on_connect(tcp_socket_t *sock) {
     log("connect");
-    int fd = tcp_socket_fd(sock);
-    write(fd, "ping", 4);
+    tcp_socket_write(sock, (buffer_view_t){(uint8_t*) "ping", 4});
 }
 
 void on_read(tcp_socket_t *sock, buffer_t chunk) {
@@ -18,15 +22,17 @@ void on_end(tcp_socket_t *sock) {
 
 void on_close(tcp_socket_t *sock) {
     log("close");
+    done = true;
 }
 
 void on_error(tcp_socket_t *sock, int errnum) {
     log("error %s", strerror(errnum));
+    done = true;
 }
 
 int main() {
  
-    tcp_socket_handler_t handler;
+    tcp_socket_handler_t handler = {0};
     handler.on_connect = on_connect;
     handler.on_read = on_read;
     handler.on_end = on_end;
@@ -36,8 +42,8 @@ int main() {
     tcp_socket_t *sock = tcp_socket_create(handler);
     tcp_socket_connect(sock, "127.0.0.1", 8000);
    
-    while (1) {
-       tcp_socket_poll(sock);
+    while (!done) {
+       tcp_socket_poll_timeout(sock, -1);
     } 
 
     tcp_socket_destroy(sock);
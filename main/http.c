@@ -2,23 +2,91 @@
 #include <log.h>
 #include <tcp.h>
 #include <buffer.h>
-#include <array.h>
+#include <arena.h>
+#include <http_file.h>
+#include <router.h>
+#include <path.h>
 #include <arpa/inet.h>
 #include <string.h>
+#include <strings.h>
 #include <errno.h>
+#include <signal.h>
 #include <time.h>
 #include <assert.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <limits.h>
+#include <stdio.h>
 
 #define TCP_PORT 8000
 #define TCP_QUEUE 16
+#define ARENA_BLOCK_SIZE 4096
+#define WRITE_BUF_SIZE 4096
+#define HTTP_MAX_PIPELINE 64
+#define HTTP_MAX_BUFFERED (1024 * 1024)
+#define FILE_CACHE_SIZE (16 * 1024 * 1024)
+#define FILE_CACHE_MAX_FILE (256 * 1024)
+#define GENERATE_CHUNK (16 * 1024)
+#define GENERATE_SIZE (16 * 1024 * 1024)
+
+/* the repeating pattern sent by GET /generate */
+static uint8_t generated[GENERATE_CHUNK];
+
+/* the directory whose files are served */
+static const char *document_root = ".";
+
+/* the boundary between the parts of multipart/byteranges responses */
+static char boundary[32];
+
+/* the response to GET /health, which shares a head rendered at startup */
+static http_preset_t health_preset;
+static const char *health_body = "OK\n";
+
+/* the handlers of requests */
+typedef enum route {
+    ROUTE_NONE,         /* not a GET request */
+    ROUTE_NOT_FOUND,
+    ROUTE_HEALTH,
+    ROUTE_GENERATE,
+    ROUTE_FILE,
+} route_t;
+
+/* the routes of GET requests, whose data points into route_ids */
+static router_t *get_routes;
+static route_t route_ids[] = {ROUTE_NONE, ROUTE_NOT_FOUND, ROUTE_HEALTH, ROUTE_GENERATE, ROUTE_FILE};
+
+/* the state shared by the clients of one worker */
+typedef struct http_worker {
+    http_date_t date;
+    http_file_cache_t *files;
+} http_worker_t;
+
+static bool view_equal(buffer_view_t view, const char *str) {
+    return view.length == strlen(str) && strncasecmp((char*) view.data, str, view.length) == 0;
+}
 
 typedef struct http_client {
     time_t connect_time;
     buffer_t read_buf;
+    buffer_t write_buf;     /* the response heads of a batch, reused for every batch */
+    http_parser_t *parser;
+    arena_t *arena;
+    bool paused;
+    http_response_t *res;   /* the response to the request whose body is being read or NULL */
+    http_stream_t *body_stream; /* the stream which answers that request once its body is read */
+    bool close;
+    size_t body_length;
+    tcp_server_t *server;
+    tcp_client_t *client;
+    http_worker_t *worker;
+    http_file_t file;       /* the file sent after the last response of the batch */
+    http_range_t ranges[HTTP_MAX_RANGES];   /* the ranges of the file which are sent */
+    size_t range_count;
+    http_stream_t *stream;  /* the response being streamed or NULL */
+    bool stream_started;
+    size_t stream_remaining;
 } http_client_t;
 
 void on_connect(tcp_server_t *server, tcp_client_t *client) {
@@ -28,6 +96,17 @@ void on_connect(tcp_server_t *server, tcp_client_t *client) {
     assert(http_client != NULL && "out of memory");
     http_client->connect_time = time(NULL);
     http_client->read_buf = buffer_create(0);
+    http_client->write_buf = buffer_create(WRITE_BUF_SIZE);
+    http_client->parser = http_parser_create();
+    http_client->arena = arena_create(ARENA_BLOCK_SIZE);
+    http_client->paused = false;
+    http_client->res = NULL;
+    http_client->body_stream = NULL;
+    http_client->server = server;
+    http_client->client = client;
+    http_client->worker = tcp_server_data(server);
+    http_client->stream = NULL;
+    http_client->file.fd = -1;
     tcp_client_set_data(client, http_client);
 }
 
@@ -36,71 +115,544 @@ void on_close(tcp_server_t *server, tcp_client_t *client) {
     log("[%s:%d] client disconnected", inet_ntoa(addr.sin_addr), addr.sin_port);
     http_client_t *http_client = tcp_client_data(client);
     buffer_destroy(http_client->read_buf);
+    buffer_destroy(http_client->write_buf);
+    http_parser_destroy(http_client->parser);
+    arena_destroy(http_client->arena);
+    http_file_close(&http_client->file);
     free(http_client);
 }
 
-void on_read(tcp_server_t *server, tcp_client_t *client, buffer_t chunk) {
+/* Return the part of the uri of the request before its query. */
+static buffer_view_t request_path(http_request_t *req) {
+    buffer_view_t uri = http_request_uri(req);
+    uint8_t *query = memchr(uri.data, '?', uri.length);
+    return (buffer_view_t) {uri.data, query != NULL ? (size_t) (query - uri.data) : uri.length};
+}
+
+/**
+ * Return the handler of the request from the path of its uri. The path is normalized first, and
+ * the uri of the request replaced by the normalized one if it differs.
+ */
+static route_t route_request(http_client_t *http_client, http_request_t *req) {
+    if (buffer_compare(http_request_method(req), buffer_view_from_string("GET")) != 0) return ROUTE_NONE;
+    buffer_view_t uri = http_request_uri(req);
+    buffer_view_t path = request_path(req);
+    uint8_t *query = uri.data + path.length;
+    size_t query_length = uri.length - path.length;
+    if (path.length == 0 || path.data[0] != '/') return ROUTE_NOT_FOUND;
+
+    uint8_t *normal = arena_alloc(http_client->arena, uri.length);
+    if (path_normalize(path, (buffer_t) {normal, uri.length}, &path) != 0) return ROUTE_NOT_FOUND;
+    if (path.data == normal) {
+        memcpy(normal + path.length, query, query_length);
+        http_request_set_uri(req, (buffer_view_t) {normal, path.length + query_length});
+    }
+    router_match_t match;
+    if (!router_match(get_routes, path, &match)) return ROUTE_NOT_FOUND;
+    return *(route_t*) match.data;
+}
+
+static char* format_size(arena_t *arena, size_t size) {
+    char *str = arena_alloc(arena, 24);
+    snprintf(str, 24, "%zu", size);
+    return str;
+}
+
+/* Format the delimiter and headers which precede a part of a multipart/byteranges body. */
+static size_t format_part(char *dest, size_t size, http_file_t *file, http_range_t range) {
+    return snprintf(dest, size, "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %zu-%zu/%zu\r\n\r\n", 
+        boundary, file->content_type, range.offset, range.offset + range.length - 1, file->size);
+}
+
+static size_t format_end(char *dest, size_t size) {
+    return snprintf(dest, size, "\r\n--%s--\r\n", boundary);
+}
+
+/**
+ * Store the ranges requested for a file of `size` bytes in http_client->ranges and return their
+ * number, 0 if none is satisfiable, or -1 if the whole file should be sent.
+ */
+static int request_ranges(http_client_t *http_client, http_request_t *req, buffer_view_t etag, time_t mtime, size_t size) {
+    buffer_view_t *range = http_request_header_id(req, HTTP_HEADER_RANGE);
+    if (range == NULL || !http_request_range_applies(req, etag, mtime)) return -1;
+    return http_range_parse(*range, size, http_client->ranges, HTTP_MAX_RANGES);
+}
+
+static void range_not_satisfiable(http_client_t *http_client, http_response_t *res, size_t size) {
+    http_headers_t *res_headers = http_response_get_headers(res);
+    char *content_range = arena_alloc(http_client->arena, 40);
+    snprintf(content_range, 40, "bytes */%zu", size);
+    http_response_set_status(res, 416);
+    http_headers_set_id(res_headers, HTTP_HEADER_CONTENT_RANGE, content_range);
+    http_headers_set_id(res_headers, HTTP_HEADER_CONTENT_LENGTH, "0");
+}
+
+/* Set the validators of the file, which every 200 and 206 response carries. */
+static void set_validators(http_client_t *http_client, http_response_t *res, char *etag, time_t mtime) {
+    http_headers_t *res_headers = http_response_get_headers(res);
+    char *modified = arena_alloc(http_client->arena, HTTP_DATE_LENGTH + 1);
+    http_date_format(mtime, modified);
+    http_headers_set_id(res_headers, HTTP_HEADER_ETAG, etag);
+    http_headers_set_id(res_headers, HTTP_HEADER_LAST_MODIFIED, modified);
+}
+
+/* Fill in the headers of a 206 response with a single range. */
+static void partial_content(http_client_t *http_client, http_response_t *res, http_range_t range, size_t size) {
+    http_headers_t *res_headers = http_response_get_headers(res);
+    char *content_range = arena_alloc(http_client->arena, 72);
+    snprintf(content_range, 72, "bytes %zu-%zu/%zu", range.offset, range.offset + range.length - 1, size);
+    http_response_set_status(res, 206);
+    http_headers_set_id(res_headers, HTTP_HEADER_CONTENT_RANGE, content_range);
+    http_headers_set_id(res_headers, HTTP_HEADER_CONTENT_LENGTH, format_size(http_client->arena, range.length));
+}
+
+/**
+ * Answer a GET request with the file below the document root, or with 404 if there is no such
+ * file and 304 if the client's copy is current. Small files are served from the worker's cache,
+ * and larger ones are opened here and sent after the response head by send_file. A Range header
+ * selects one part of the file, or several which are sent as multipart/byteranges.
+ */
+static void serve_file(http_client_t *http_client, http_request_t *req, http_response_t *res) {
+    http_headers_t *res_headers = http_response_get_headers(res);
+    http_worker_t *worker = http_client->worker;
+    http_file_t *file = &http_client->file;
+    char path[PATH_MAX];
+    if (http_file_path(document_root, request_path(req), path, sizeof(path)) < 0) {
+        http_response_set_status(res, 404);
+        http_headers_set_id(res_headers, HTTP_HEADER_CONTENT_LENGTH, "0");
+        return;
+    }
+
+    /* a response which waits for the request body must not refer to entries that other clients may evict */
+    bool has_body = http_request_header_id(req, HTTP_HEADER_CONTENT_LENGTH) != NULL || 
+        http_request_header_id(req, HTTP_HEADER_TRANSFER_ENCODING) != NULL;
+    http_file_entry_t *entry = NULL;
+    if (!has_body) {
+        entry = http_file_cache_get(worker->files, path, worker->date.time, file);
+    } else {
+        http_file_open(file, path);
+    }
+
+    if (entry != NULL) {
+        char *etag = (char*) http_file_entry_etag(entry);
+        time_t mtime = http_file_entry_mtime(entry);
+        buffer_view_t data = http_file_entry_data(entry);
+        if (http_request_not_modified(req, buffer_view_from_string(etag), mtime)) {
+            http_response_set_status(res, 304);
+            http_headers_set_id(res_headers, HTTP_HEADER_ETAG, etag);
+            return;
+        }
+        int count = request_ranges(http_client, req, buffer_view_from_string(etag), mtime, data.length);
+        if (count < 0) {
+            http_response_use_preset(res, http_file_entry_head(entry));
+            http_response_set_body(res, data);
+            return;
+        }
+        if (count == 0) {
+            range_not_satisfiable(http_client, res, data.length);
+            return;
+        }
+        if (count == 1) {
+            http_range_t range = http_client->ranges[0];
+            partial_content(http_client, res, range, data.length);
+            http_headers_set_id(res_headers, HTTP_HEADER_CONTENT_TYPE, (char*) http_file_content_type(path));
+            set_validators(http_client, res, etag, mtime);
+            http_response_set_body(res, (buffer_view_t) {data.data + range.offset, range.length});
+            return;
+        }
+
+        /* the parts of a multipart response are sent from the file */
+        if (http_file_open(file, path) != 0) {
+            http_response_set_status(res, 404);
+            http_headers_set_id(res_headers, HTTP_HEADER_CONTENT_LENGTH, "0");
+            return;
+        }
+    }
+    if (file->fd < 0) {
+        http_response_set_status(res, 404);
+        http_headers_set_id(res_headers, HTTP_HEADER_CONTENT_LENGTH, "0");
+        return;
+    }
+
+    char *etag = arena_alloc(http_client->arena, HTTP_FILE_ETAG_SIZE);
+    buffer_view_t etag_view = {(uint8_t*) etag, http_file_etag(file, etag)};
+    if (http_request_not_modified(req, etag_view, file->mtime)) {
+        http_file_close(file);
+        http_response_set_status(res, 304);
+        http_headers_set_id(res_headers, HTTP_HEADER_ETAG, etag);
+        return;
+    }
+    int count = request_ranges(http_client, req, etag_view, file->mtime, file->size);
+    if (count == 0) {
+        http_file_close(file);
+        range_not_satisfiable(http_client, res, file->size);
+        return;
+    }
+
+    set_validators(http_client, res, etag, file->mtime);
+    if (count < 0) {
+        http_client->ranges[0] = (http_range_t) {0, file->size};
+        http_client->range_count = 1;
+        http_headers_set_id(res_headers, HTTP_HEADER_CONTENT_LENGTH, format_size(http_client->arena, file->size));
+        http_headers_set_id(res_headers, HTTP_HEADER_CONTENT_TYPE, (char*) file->content_type);
+        http_headers_set_id(res_headers, HTTP_HEADER_ACCEPT_RANGES, "bytes");
+    } else if (count == 1) {
+        http_client->range_count = 1;
+        partial_content(http_client, res, http_client->ranges[0], file->size);
+        http_headers_set_id(res_headers, HTTP_HEADER_CONTENT_TYPE, (char*) file->content_type);
+    } else {
+        /* the length of the multipart body is known up front, so it is not chunked */
+        char part[256];
+        size_t length = format_end(part, sizeof(part));
+        for (int i = 0; i < count; i++) {
+            length += format_part(part, sizeof(part), file, http_client->ranges[i]) + http_client->ranges[i].length;
+        }
+        char *content_type = arena_alloc(http_client->arena, 64);
+        snprintf(content_type, 64, "multipart/byteranges; boundary=%s", boundary);
+        http_client->range_count = count;
+        http_response_set_status(res, 206);
+        http_headers_set_id(res_headers, HTTP_HEADER_CONTENT_LENGTH, format_size(http_client->arena, length));
+        http_headers_set_id(res_headers, HTTP_HEADER_CONTENT_TYPE, content_type);
+    }
+}
+
+/**
+ * Send the ranges of the open file after its response head with sendfile, with the delimiter of
+ * each part in front of it if there are several. The file is closed afterwards, and false is
+ * returned if the caller should wait for on_drain. The client may be closed by a write, in which
+ * case http_client is freed.
+ */
+static bool send_file(tcp_server_t *server, tcp_client_t *client, http_client_t *http_client) {
+    http_file_t *file = &http_client->file;
+    bool multipart = http_client->range_count > 1;
+    bool writable = true;
+    char part[256];
+    for (size_t i = 0; i < http_client->range_count; i++) {
+        http_range_t range = http_client->ranges[i];
+        if (multipart) {
+            size_t length = format_part(part, sizeof(part), file, range);
+            tcp_server_write(server, client, (buffer_view_t) {(uint8_t*) part, length});
+            if (tcp_client_closed(client)) return false;
+        }
+        writable = tcp_server_sendfile(server, client, file->fd, range.offset, range.length);
+        if (tcp_client_closed(client)) return false;
+    }
+    if (multipart) {
+        size_t length = format_end(part, sizeof(part));
+        writable = tcp_server_write(server, client, (buffer_view_t) {(uint8_t*) part, length});
+        if (tcp_client_closed(client)) return false;
+    }
+    http_file_close(file);
+    return writable;
+}
+
+/**
+ * Fill in the response to the request and return true if the connection should be closed
+ * once the response has been sent. GET requests are answered according to their route, which
+ * is /health, the streamed /generate, or a file from the document root, and other requests
+ * with an empty body.
+ */
+static bool respond(http_client_t *http_client, http_request_t *req, http_response_t *res, route_t route) {
+    buffer_view_t version = http_request_version(req);
+    bool is_http_1_0 = view_equal(version, "HTTP/1.0");
+    bool is_http_1_1 = view_equal(version, "HTTP/1.1");
+    http_headers_t *res_headers = http_response_get_headers(res);
+    buffer_view_t *connection = http_request_header_id(req, HTTP_HEADER_CONNECTION);
+
+    if (!is_http_1_0 && !is_http_1_1) {
+        http_response_set_status(res, 505);
+        http_headers_set_id(res_headers, HTTP_HEADER_CONTENT_LENGTH, "0");
+        return false;
+    }
+
+    bool close;
+    if (is_http_1_0) {
+        close = connection == NULL || !view_equal(*connection, "keep-alive");
+    } else {
+        close = connection != NULL && view_equal(*connection, "close");
+    }
+    if (route == ROUTE_HEALTH) {
+        http_response_use_preset(res, health_preset);
+        http_response_set_body(res, buffer_view_from_string(health_body));
+        http_headers_set_id(res_headers, HTTP_HEADER_CONTENT_LENGTH, "3");
+    } else if (route == ROUTE_FILE) {
+        serve_file(http_client, req, res);
+    } else if (route == ROUTE_NOT_FOUND) {
+        http_response_set_status(res, 404);
+        http_headers_set_id(res_headers, HTTP_HEADER_CONTENT_LENGTH, "0");
+    } else if (route == ROUTE_NONE) {
+        http_headers_set_id(res_headers, HTTP_HEADER_CONTENT_LENGTH, "0");
+    }
+    http_headers_set_id(res_headers, HTTP_HEADER_DATE, http_client->worker->date.value);
+    http_headers_set_id(res_headers, HTTP_HEADER_CONNECTION, close ? "close" : "keep-alive");
+    return close;
+}
+
+/**
+ * Replace the response with an error and close the connection once it has been sent.
+ */
+static void reject(http_client_t *http_client, http_response_t *res, int status) {
+    http_headers_t *res_headers = http_response_get_headers(res);
+    http_file_close(&http_client->file);
+    http_response_set_status(res, status);
+    http_response_set_body(res, (buffer_view_t) {NULL, 0});
+    http_headers_set_id(res_headers, HTTP_HEADER_CONNECTION, "close");
+    http_headers_set_id(res_headers, HTTP_HEADER_CONTENT_LENGTH, "0");
+}
+
+static void on_body(void *data, buffer_view_t chunk) {
+    http_client_t *http_client = data;
+    http_client->body_length += chunk.length;
+}
+
+/**
+ * Write a batch of responses with a single tcp_server_writev. The heads are serialized back to
+ * back into the write buffer, so consecutive responses without a body are sent as one buffer,
+ * and each body is sent from where it is without being copied.
+ */
+static bool write_responses(tcp_server_t *server, tcp_client_t *client, http_response_t **responses, size_t count) {
+    http_client_t *http_client = tcp_client_data(client);
+    buffer_t *write_buf = &http_client->write_buf;
+    size_t ends[HTTP_MAX_PIPELINE];
+    size_t used = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t len = http_response_write_head_to(responses[i], write_buf->data + used, write_buf->length - used);
+        if (len > write_buf->length - used) {
+            buffer_resize(write_buf, 2 * (used + len));
+            http_response_write_head_to(responses[i], write_buf->data + used, len);
+        }
+        used += len;
+        ends[i] = used;
+    }
+
+    buffer_view_t buffers[2 * HTTP_MAX_PIPELINE];
+    size_t n = 0, start = 0;
+    for (size_t i = 0; i < count; i++) {
+        buffer_view_t body = http_response_get_body(responses[i]);
+        if (body.length == 0 && i < count - 1) continue;
+        buffers[n++] = (buffer_view_t) {write_buf->data + start, ends[i] - start};
+        start = ends[i];
+        if (body.length > 0) buffers[n++] = body;
+    }
+    return tcp_server_writev(server, client, buffers, n);
+}
+
+/**
+ * The write callback of the streams. The client may be closed by the write, in which case
+ * http_client is freed and the caller has to check tcp_client_closed before touching it.
+ */
+static bool write_client(void *data, const buffer_view_t *buffers, size_t count) {
+    http_client_t *http_client = data;
+    tcp_client_t *client = http_client->client;
+    bool writable = tcp_server_writev(http_client->server, client, buffers, count);
+    if (tcp_client_closed(client)) return false;
+    http_client->paused = !writable;
+    return writable;
+}
+
+/* Stream the generated body once the responses before it have been written. */
+static void start_stream(http_client_t *http_client, http_stream_t *stream, bool close) {
+    http_client->stream = stream;
+    http_client->stream_started = false;
+    http_client->stream_remaining = GENERATE_SIZE;
+    http_client->close = close || http_stream_closes_connection(stream);
+}
+
+/**
+ * Write the streamed response until the client stops keeping up or the body is complete, in
+ * which case the stream is ended and http_client->stream is cleared.
+ */
+static void continue_stream(http_client_t *http_client) {
+    if (!http_client->stream_started) {
+        http_client->stream_started = true;
+        if (!http_stream_write_head(http_client->stream)) return;
+    }
+    while (http_client->stream_remaining > 0) {
+        size_t length = http_client->stream_remaining < GENERATE_CHUNK ? http_client->stream_remaining : GENERATE_CHUNK;
+        http_client->stream_remaining -= length;
+        if (!http_stream_write_chunk(http_client->stream, (buffer_view_t){generated, length})) return;
+    }
+    http_stream_t *stream = http_client->stream;
+    http_client->stream = NULL;
+    http_stream_end(stream);
+}
+
+/**
+ * Answer every complete request in the read buffer. Up to HTTP_MAX_PIPELINE responses are
+ * written together by write_responses, in the order the requests arrived. If the
+ * client stops reading and its write queue fills up, the remaining requests are left in the
+ * read buffer until on_drain resumes processing.
+ *
+ * Request bodies are consumed as they arrive and answered once complete. The response waits in
+ * the arena meanwhile, so the arena is not reset while a body is being read. Streamed responses
+ * are written as fast as the client reads them, and the requests after them wait until the
+ * stream has ended.
+ */
+static void process_requests(tcp_server_t *server, tcp_client_t *client) {
     struct sockaddr_in addr = tcp_client_addr(client);
     http_client_t *http_client = tcp_client_data(client);
-    buffer_append(&http_client->read_buf, chunk);
-    http_request_t *req = http_request_create();
-    long len = parse_http_request(http_client->read_buf, req);
-    if (len == HTTP_PARSE_ERROR) {
-        log("error: invalid http request");
-
-    } else if (len != HTTP_PARSE_INCOMPLETE) {
-    
-        http_headers_t *req_headers = http_request_get_headers(req);
-
-        log("[%s:%d] %s %s", inet_ntoa(addr.sin_addr), addr.sin_port, http_request_method(req), http_request_uri(req)); 
-
-        /* remove request from read buffer */
-        buffer_splice(&http_client->read_buf, len);
-
-        char *version = http_request_version(req);
-
-        bool is_http_1_0 = strcmp(version, "HTTP/1.0") == 0;
-        bool is_http_1_1 = strcmp(version, "HTTP/1.1") == 0;
-        http_response_t *res = http_response_create();
-        http_headers_t *res_headers = http_response_get_headers(res);
-        
-        if (!is_http_1_0 && !is_http_1_1) {
-            http_response_set_status(res, 505);
-            http_headers_set(res_headers, "Content-Length", "0");
-            buffer_t head = http_response_write_head(res);
-            write(tcp_client_fd(client), head.data, head.length);
-            buffer_destroy(head);
-        } else if (is_http_1_0) {
-            char *connection = http_headers_get(req_headers, "Connection");
-            bool close = connection == NULL || strcmp(connection, "keep-alive") != 0;
-            if (close) {
-                http_headers_set(res_headers, "Connection", "close");
-            } else {
-                http_headers_set(res_headers, "Connection", "keep-alive");
-                http_headers_set(res_headers, "Content-Length", "0");
+
+    if (http_client->stream != NULL) {
+        continue_stream(http_client);
+        if (tcp_client_closed(client)) return;
+        if (http_client->stream != NULL) return;
+        arena_reset(http_client->arena);
+        if (http_client->close) {
+            buffer_splice(&http_client->read_buf, http_client->read_buf.length);
+            tcp_server_end_client(server, client);
+            return;
+        }
+    }
+
+    buffer_t read_buf = http_client->read_buf;
+    size_t offset = 0;
+    bool close = false;
+
+    while (!close && !http_client->paused) {
+        http_response_t *responses[HTTP_MAX_PIPELINE];
+        size_t count = 0;
+        while (!close && count < HTTP_MAX_PIPELINE) {
+            buffer_t pending = {read_buf.data + offset, read_buf.length - offset};
+
+            if (http_client->res == NULL) {
+                http_request_t *req = http_request_create(http_client->arena);
+                long len = http_parser_feed(http_client->parser, pending, req);
+                if (len == HTTP_PARSE_INCOMPLETE) break;
+                if (len == HTTP_PARSE_ERROR) {
+                    log("error: invalid http request");
+                    close = true;
+                    break;
+                }
+                if (len == HTTP_PARSE_TOO_LARGE) {
+                    log("error: http request head too large");
+                    http_response_t *res = http_response_create(http_client->arena);
+                    reject(http_client, res, 431);
+                    responses[count++] = res;
+                    close = true;
+                    break;
+                }
+                offset += len;
+
+                buffer_view_t method = http_request_method(req);
+                buffer_view_t uri = http_request_uri(req);
+                log("[%s:%d] %.*s %.*s", inet_ntoa(addr.sin_addr), addr.sin_port, 
+                    (int) method.length, method.data, (int) uri.length, uri.data); 
+
+                http_response_t *res = http_response_create(http_client->arena);
+                route_t route = route_request(http_client, req);
+                close = respond(http_client, req, res, route);
+                int body = http_parser_start_body(http_client->parser, req);
+
+                /* the stream is created while the request is still in the read buffer */
+                http_stream_t *stream = NULL;
+                if (body >= 0 && route == ROUTE_GENERATE) {
+                    stream = http_stream_create(req, res, write_client, http_client);
+                }
+                if (body == 1) {
+                    http_client->res = res;
+                    http_client->body_stream = stream;
+                    http_client->close = close;
+                    http_client->body_length = 0;
+
+                    /* the connection is only closed once the body has been read and answered */
+                    close = false;
+                    continue;
+                }
+                if (body < 0) {
+                    log("error: invalid http request body");
+                    reject(http_client, res, body == HTTP_PARSE_TOO_LARGE ? 413 : 400);
+                    close = true;
+                } else if (stream != NULL) {
+                    start_stream(http_client, stream, close);
+                    close = false;
+                    break;
+                }
+                responses[count++] = res;
+                if (http_client->file.fd >= 0) break;
+                continue;
             }
-            buffer_t head = http_response_write_head(res);
-            write(tcp_client_fd(client), head.data, head.length);
-            buffer_destroy(head);
-            if (close) tcp_server_close_client(server, client);
-        } else if (is_http_1_1) {
-            char *connection = http_headers_get(req_headers, "Connection");
-            bool close = connection != NULL && strcmp(connection, "close") == 0;
-            if (close) {
-                http_headers_set(res_headers, "Connection", "close");
+
+            size_t consumed;
+            long res = http_parser_feed_body(http_client->parser, pending, &consumed, on_body, http_client);
+            offset += consumed;
+            if (res == HTTP_PARSE_INCOMPLETE) break;
+            http_stream_t *stream = http_client->body_stream;
+            http_client->body_stream = NULL;
+            if (res < 0) {
+                log("error: invalid http request body");
+
+                /* the head of a stream already announces a chunked body, so the error gets its own */
+                if (stream != NULL) http_client->res = http_response_create(http_client->arena);
+                reject(http_client, http_client->res, res == HTTP_PARSE_TOO_LARGE ? 413 : 400);
+                close = true;
             } else {
-                http_headers_set(res_headers, "Connection", "keep-alive");
-                http_headers_set(res_headers, "Content-Length", "0");
+                log("[%s:%d] received %zu byte body", inet_ntoa(addr.sin_addr), addr.sin_port, 
+                    http_client->body_length);
+                close = http_client->close;
             }
-            buffer_t head = http_response_write_head(res);
-            write(tcp_client_fd(client), head.data, head.length);
-            buffer_destroy(head);
-            if (close) tcp_server_close_client(server, client);
+            if (res == 0 && stream != NULL) {
+                http_client->res = NULL;
+                start_stream(http_client, stream, close);
+                close = false;
+                break;
+            }
+            responses[count++] = http_client->res;
+            http_client->res = NULL;
+            if (http_client->file.fd >= 0) break;
+        }
+        if (count > 0) {
+            bool writable = write_responses(server, client, responses, count);
+            http_file_cache_collect(http_client->worker->files);
+            if (tcp_client_closed(client)) return;
+            http_client->paused = !writable;
+        }
+        if (http_client->stream != NULL) break;
+        if (count == 0) {
+            /* nothing refers to the request which was created for an incomplete head */
+            if (http_client->res == NULL) arena_reset(http_client->arena);
+            break;
+        }
+
+        /* the file follows its response head, which ended the batch */
+        bool sent_file = http_client->file.fd >= 0;
+        if (sent_file) {
+            bool writable = send_file(server, client, http_client);
+            if (tcp_client_closed(client)) return;
+            http_client->paused = !writable;
         }
 
-        http_response_destroy(res);
+        /* the arena only holds the requests answered by this batch and the one being read */
+        if (http_client->res == NULL) arena_reset(http_client->arena);
+        if (count < HTTP_MAX_PIPELINE && !sent_file) break;
+    }
+
+    /* the requests refer to the read buffer, so they are only removed once they are answered */
+    buffer_splice(&http_client->read_buf, offset);
+
+    /* ending the client may close it immediately, which frees http_client */
+    if (close) {
+        tcp_server_end_client(server, client);
+    } else if (http_client->stream != NULL && !http_client->paused) {
+        process_requests(server, client);
     }
-    http_request_destroy(req);
+}
+
+void on_read(tcp_server_t *server, tcp_client_t *client, buffer_t chunk) {
+    http_client_t *http_client = tcp_client_data(client);
+    buffer_append(&http_client->read_buf, chunk);
+    if (!http_client->paused) {
+        process_requests(server, client);
+    } else if (http_client->read_buf.length > HTTP_MAX_BUFFERED) {
+        /* the client keeps pipelining requests without reading the responses */
+        log("error: too many pipelined requests");
+        tcp_server_close_client(server, client);
+    }
+}
+
+void on_drain(tcp_server_t *server, tcp_client_t *client) {
+    http_client_t *http_client = tcp_client_data(client);
+    http_client->paused = false;
+    process_requests(server, client);
 }
 
 void on_error(tcp_server_t *server, tcp_client_t *client, int errnum) {
@@ -108,26 +660,88 @@ void on_error(tcp_server_t *server, tcp_client_t *client, int errnum) {
     log("[%s:%d] failed with error %s", inet_ntoa(addr.sin_addr), addr.sin_port, strerror(errnum)); 
 }
 
-int main() {
+static tcp_cluster_t *cluster = NULL;
+
+static void destroy_workers(http_worker_t *http_workers, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        http_file_cache_destroy(http_workers[i].files);
+    }
+    free(http_workers);
+}
+
+/* refresh the Date of the worker at the start of every second */
+static void refresh_date(tcp_server_t *server, void *data) {
+    http_worker_t *worker = data;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    http_date_update(&worker->date, now.tv_sec);
+    tcp_server_set_timeout(server, 1000 - now.tv_nsec / 1000000, refresh_date, worker);
+}
+
+void on_signal(int signum) {
+    tcp_cluster_stop(cluster);
+}
+
+int main(int argc, char *argv[]) {
+
+    int workers = argc > 1 ? atoi(argv[1]) : 1;
+    if (argc > 2) document_root = argv[2];
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    snprintf(boundary, sizeof(boundary), "%016llx", (unsigned long long) now.tv_sec * 1000000007ULL ^ now.tv_nsec ^ getpid());
+    for (size_t i = 0; i < GENERATE_CHUNK; i++) {
+        generated[i] = i % 64 == 63 ? '\n' : 'a' + i % 26;
+    }
+    if (workers < 1) {
+        log("usage: %s [workers] [document root]", argv[0]);
+        return 1;
+    }
  
-    tcp_server_t *server = tcp_server_create(on_connect, on_close, on_read, on_error);
+    cluster = tcp_cluster_create(workers, on_connect, on_close, on_read, on_error);
+    http_worker_t *http_workers = calloc(workers, sizeof(http_worker_t));
+    assert(http_workers != NULL && "out of memory");
+    for (size_t i = 0; i < tcp_cluster_size(cluster); i++) {
+        tcp_server_t *worker = tcp_cluster_worker(cluster, i);
+        tcp_server_on_drain(worker, on_drain);
+        http_workers[i].files = http_file_cache_create(FILE_CACHE_SIZE, FILE_CACHE_MAX_FILE);
+        tcp_server_set_data(worker, &http_workers[i]);
+        refresh_date(worker, &http_workers[i]);
+    }
+
+    get_routes = router_create();
+    router_add(get_routes, "/health", &route_ids[ROUTE_HEALTH]);
+    router_add(get_routes, "/generate", &route_ids[ROUTE_GENERATE]);
+    router_add(get_routes, "/*path", &route_ids[ROUTE_FILE]);
+    router_compile(get_routes);
 
-    int res = tcp_server_listen(server, TCP_PORT, TCP_QUEUE);
+    arena_t *presets = arena_create(ARENA_BLOCK_SIZE);
+    http_response_t *health = http_response_create(presets);
+    http_headers_set_id(http_response_get_headers(health), HTTP_HEADER_CONTENT_TYPE, "text/plain");
+    http_headers_set_id(http_response_get_headers(health), HTTP_HEADER_SERVER, "http");
+    health_preset = http_response_render_preset(health);
+
+    int res = tcp_cluster_listen(cluster, TCP_PORT, TCP_QUEUE);
     if (res != 0) {
         log("error: %s", strerror(errno));
-        tcp_server_destroy(server);
+        tcp_cluster_destroy(cluster);
+        destroy_workers(http_workers, workers);
+        router_destroy(get_routes);
+        arena_destroy(presets);
         return 1;
     }
 
-    log("Listening on port %d", TCP_PORT);
+    log("Listening on port %d with %d workers", TCP_PORT, workers);
 
-    while (1) {
-        int res = tcp_server_poll(server);
-        if (res != 0) {
-            log("error: %s", strerror(errno));
-        }
-    } 
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    res = tcp_cluster_run(cluster);
+    if (res != 0) {
+        log("error: %s", strerror(errno));
+    }
 
-    http_request_create();
-    tcp_server_destroy(server);
+    tcp_cluster_destroy(cluster);
+    destroy_workers(http_workers, workers);
+    router_destroy(get_routes);
+    arena_destroy(presets);
 }
@@ -4,6 +4,7 @@
 #include <arpa/inet.h>
 #include <string.h>
 #include <errno.h>
+#include <signal.h>
 
 #define TCP_PORT 8000
 #define TCP_QUEUE 16
@@ -22,8 +23,8 @@ void on_close(tcp_server_t *server, tcp_client_t *client) {
 void on_read(tcp_server_t *server, tcp_client_t *client, buffer_t chunk) {
     struct sockaddr_in addr = tcp_client_addr(client);
     log("[%s:%d] sent %d characters", inet_ntoa(addr.sin_addr), addr.sin_port, chunk.length); 
-    write(tcp_client_fd(client), chunk.data, chunk.length);
-    shutdown(tcp_client_fd(client), SHUT_WR);
+    tcp_server_write(server, client, chunk);
+    tcp_server_end_client(server, client);
 }
 
 void on_error(tcp_server_t *server, tcp_client_t *client, int errnum) {
@@ -31,9 +32,15 @@ void on_error(tcp_server_t *server, tcp_client_t *client, int errnum) {
     log("[%s:%d] failed with error %s", inet_ntoa(addr.sin_addr), addr.sin_port, strerror(errnum)); 
 }
 
+static tcp_server_t *server = NULL;
+
+void on_signal(int signum) {
+    tcp_server_stop(server);
+}
+
 int main() {
  
-    tcp_server_t *server = tcp_server_create(on_connect, on_close, on_read, on_error);
+    server = tcp_server_create(on_connect, on_close, on_read, on_error);
 
     int res = tcp_server_listen(server, TCP_PORT, TCP_QUEUE);
     if (res != 0) {
@@ -44,12 +51,13 @@ int main() {
 
     log("\x1b[31mListening\x1b[0m on port %d", TCP_PORT);
 
-    while (1) {
-        int res = tcp_server_poll(server);
-        if (res != 0) {
-            log("error: %s", strerror(errno));
-        }
-    } 
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    res = tcp_server_run(server);
+    if (res != 0) {
+        log("error: %s", strerror(errno));
+    }
 
     tcp_server_destroy(server);
 }
@@ -0,0 +1,90 @@
+#include <arena.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+
+#define ARENA_ALIGN _Alignof(max_align_t)
+
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    _Alignas(max_align_t) uint8_t data[];
+} arena_block_t;
+
+struct arena {
+    arena_block_t *first;
+    arena_block_t *current;
+    size_t block_size;
+    size_t used;
+};
+
+static arena_block_t* arena_block_create(size_t size) {
+    arena_block_t *block = malloc(sizeof(arena_block_t) + size);
+    assert(block != NULL && "out of memory");
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+arena_t* arena_create(size_t block_size) {
+    arena_t *arena = malloc(sizeof(arena_t));
+    assert(arena != NULL && "out of memory");
+    arena->block_size = block_size < ARENA_ALIGN ? ARENA_ALIGN : block_size;
+    arena->first = arena_block_create(arena->block_size);
+    arena->current = arena->first;
+    arena->used = 0;
+    return arena;
+}
+
+void arena_destroy(arena_t *arena) {
+    if (arena == NULL) return;
+    arena_block_t *block = arena->first;
+    while (block != NULL) {
+        arena_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    free(arena);
+}
+
+void* arena_alloc(arena_t *arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    arena_block_t *block = arena->current;
+    while (block->size - block->used < size) {
+        /* blocks after the current one are empty, either reused after a reset or never touched */
+        if (block->next == NULL || block->next->size < size) {
+            size_t block_size = size > arena->block_size ? size : arena->block_size;
+            arena_block_t *next = arena_block_create(block_size);
+            next->next = block->next;
+            block->next = next;
+        }
+        block = block->next;
+        block->used = 0;
+    }
+    arena->current = block;
+    void *res = block->data + block->used;
+    block->used += size;
+    arena->used += size;
+    return res;
+}
+
+void* arena_calloc(arena_t *arena, size_t size) {
+    void *res = arena_alloc(arena, size);
+    memset(res, 0, size);
+    return res;
+}
+
+void arena_reset(arena_t *arena) {
+    arena->current = arena->first;
+    arena->first->used = 0;
+    arena->used = 0;
+}
+
+size_t arena_used(arena_t *arena) {
+    return arena->used;
+}
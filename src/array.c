@@ -1,5 +1,6 @@
 #include <array.h>
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
@@ -0,0 +1,449 @@
+#include <btree_map.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define CACHE_LINE 64
+
+/* the number of bytes of keys a node holds, unless that leaves room for fewer than 3 keys */
+#define NODE_KEYS_SIZE (4 * CACHE_LINE)
+
+/*
+ * A node holds `count` keys followed by their values and, in internal nodes, count + 1 child
+ * pointers. The offsets of the values and children are the same for every node of a map. A
+ * node other than the root holds between min_degree - 1 and 2 * min_degree - 1 keys.
+ */
+typedef struct node {
+    uint32_t count;
+    uint32_t leaf;
+    _Alignas(16) uint8_t data[];
+} node_t;
+
+struct btree_map {
+    node_t *root;
+    size_t size;
+    btree_key_t key_type;
+    size_t key_size;
+    size_t val_size;
+    size_t entry_size;
+    size_t min_degree;
+    size_t max_keys;
+    size_t vals_offset;
+    size_t children_offset;
+    size_t node_size;
+    uint8_t *swap;          /* room for one entry while two are swapped */
+    compare_t cmp_key;
+    destroy_t key_free;
+    destroy_t val_free;
+};
+
+static btree_map_t* map_create(btree_key_t key_type, size_t key_size, size_t val_size, compare_t cmp_key,
+    destroy_t key_free, destroy_t val_free) {
+
+    btree_map_t *map = calloc(1, sizeof(btree_map_t));
+    assert(map != NULL && "out of memory");
+    map->key_type = key_type;
+    map->key_size = key_size;
+    map->val_size = val_size;
+    map->entry_size = key_size + val_size;
+    map->cmp_key = cmp_key;
+    map->key_free = key_free;
+    map->val_free = val_free;
+
+    size_t keys = NODE_KEYS_SIZE / (key_size > 0 ? key_size : 1);
+    map->min_degree = keys < 3 ? 2 : (keys + 1) / 2;
+    map->max_keys = 2 * map->min_degree - 1;
+    map->vals_offset = (map->max_keys * key_size + 15) / 16 * 16;
+    size_t children = map->vals_offset + map->max_keys * val_size;
+    map->children_offset = (children + sizeof(node_t*) - 1) / sizeof(node_t*) * sizeof(node_t*);
+    size_t size = sizeof(node_t) + map->children_offset + (map->max_keys + 1) * sizeof(node_t*);
+    map->node_size = (size + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+    map->swap = malloc(map->entry_size + 1);
+    assert(map->swap != NULL && "out of memory");
+    return map;
+}
+
+btree_map_t* btree_map_create(
+    size_t key_size,
+    size_t val_size,
+    compare_t cmp_key,
+    destroy_t key_free,
+    destroy_t val_free
+) {
+    return map_create(BTREE_KEY_COMPARE, key_size, val_size, cmp_key, key_free, val_free);
+}
+
+btree_map_t* btree_map_create_keyed(
+    btree_key_t key_type,
+    size_t key_size,
+    size_t val_size,
+    destroy_t key_free,
+    destroy_t val_free
+) {
+    assert(key_type != BTREE_KEY_COMPARE && "use btree_map_create");
+    assert((key_type == BTREE_KEY_BYTES || key_size == 4 || key_size == 8) && "integer keys have 4 or 8 bytes");
+    return map_create(key_type, key_size, val_size, NULL, key_free, val_free);
+}
+
+static node_t* node_create(btree_map_t *map, bool leaf) {
+    node_t *node = aligned_alloc(CACHE_LINE, map->node_size);
+    assert(node != NULL && "out of memory");
+    node->count = 0;
+    node->leaf = leaf;
+    return node;
+}
+
+static uint8_t* node_key(btree_map_t *map, node_t *node, size_t i) {
+    return node->data + i * map->key_size;
+}
+
+static uint8_t* node_val(btree_map_t *map, node_t *node, size_t i) {
+    return node->data + map->vals_offset + i * map->val_size;
+}
+
+static node_t** node_children(btree_map_t *map, node_t *node) {
+    return (node_t**) (node->data + map->children_offset);
+}
+
+static void entry_destroy(btree_map_t *map, node_t *node, size_t i) {
+    if (map->key_free) map->key_free(node_key(map, node, i));
+    if (map->val_free) map->val_free(node_val(map, node, i));
+}
+
+static void node_destroy(btree_map_t *map, node_t *node) {
+    for (size_t i = 0; i < node->count; i++) {
+        entry_destroy(map, node, i);
+    }
+    if (!node->leaf) {
+        for (size_t i = 0; i <= node->count; i++) {
+            node_destroy(map, node_children(map, node)[i]);
+        }
+    }
+    free(node);
+}
+
+void btree_map_destroy(btree_map_t *map) {
+    if (map->root != NULL) node_destroy(map, map->root);
+    free(map->swap);
+    free(map);
+}
+
+size_t btree_map_size(btree_map_t *map) {
+    return map->size;
+}
+
+static int key_compare(btree_map_t *map, const uint8_t *a, const void *b) {
+    switch (map->key_type) {
+    case BTREE_KEY_INT:
+        if (map->key_size == 8) return (*(int64_t*) a > *(int64_t*) b) - (*(int64_t*) a < *(int64_t*) b);
+        return (*(int32_t*) a > *(int32_t*) b) - (*(int32_t*) a < *(int32_t*) b);
+    case BTREE_KEY_UINT:
+        if (map->key_size == 8) return (*(uint64_t*) a > *(uint64_t*) b) - (*(uint64_t*) a < *(uint64_t*) b);
+        return (*(uint32_t*) a > *(uint32_t*) b) - (*(uint32_t*) a < *(uint32_t*) b);
+    case BTREE_KEY_BYTES:
+        return memcmp(a, b, map->key_size);
+    default:
+        return map->cmp_key((void*) a, (void*) b);
+    }
+}
+
+/*
+ * Binary search the keys of a node with an inlined comparison of type `type`. The range halves
+ * without a branch on the comparison, which compiles to a conditional move, so the search never
+ * mispredicts on random keys.
+ */
+#define LOWER_BOUND(type, keys, count, key, res) do { \
+    type k_ = *(type*) (key); \
+    const type *base_ = (const type*) (keys); \
+    size_t n_ = (count); \
+    if (n_ == 0) { (res) = 0; break; } \
+    while (n_ > 1) { \
+        size_t half_ = n_ / 2; \
+        base_ = base_[half_ - 1] < k_ ? base_ + half_ : base_; \
+        n_ -= half_; \
+    } \
+    (res) = (size_t) (base_ - (const type*) (keys)) + (*base_ < k_); \
+} while (0)
+
+/* Return the index of the first key of the node which is not less than `key`. */
+static size_t node_find(btree_map_t *map, node_t *node, void *key, bool *found) {
+    size_t i;
+    switch (map->key_type) {
+    case BTREE_KEY_INT:
+        if (map->key_size == 8) LOWER_BOUND(int64_t, node->data, node->count, key, i);
+        else LOWER_BOUND(int32_t, node->data, node->count, key, i);
+        break;
+    case BTREE_KEY_UINT:
+        if (map->key_size == 8) LOWER_BOUND(uint64_t, node->data, node->count, key, i);
+        else LOWER_BOUND(uint32_t, node->data, node->count, key, i);
+        break;
+    default: {
+        size_t lo = 0, hi = node->count;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (key_compare(map, node_key(map, node, mid), key) < 0) lo = mid + 1;
+            else hi = mid;
+        }
+        i = lo;
+    }
+    }
+    *found = i < node->count && key_compare(map, node_key(map, node, i), key) == 0;
+    return i;
+}
+
+void* btree_map_get(btree_map_t *map, void *key) {
+    node_t *node = map->root;
+    while (node != NULL) {
+        bool found;
+        size_t i = node_find(map, node, key, &found);
+        if (found) return node_val(map, node, i);
+        node = node->leaf ? NULL : node_children(map, node)[i];
+    }
+    return NULL;
+}
+
+/* Move `count` entries from index `from` of node `src` to index `to` of node `dest`. */
+static void move_entries(btree_map_t *map, node_t *dest, size_t to, node_t *src, size_t from, size_t count) {
+    memmove(node_key(map, dest, to), node_key(map, src, from), count * map->key_size);
+    memmove(node_val(map, dest, to), node_val(map, src, from), count * map->val_size);
+}
+
+static void move_children(btree_map_t *map, node_t *dest, size_t to, node_t *src, size_t from, size_t count) {
+    memmove(node_children(map, dest) + to, node_children(map, src) + from, count * sizeof(node_t*));
+}
+
+static void set_entry(btree_map_t *map, node_t *node, size_t i, void *key, void *val) {
+    memcpy(node_key(map, node, i), key, map->key_size);
+    memcpy(node_val(map, node, i), val, map->val_size);
+}
+
+static void swap_entries(btree_map_t *map, node_t *a, size_t i, node_t *b, size_t j) {
+    memcpy(map->swap, node_key(map, a, i), map->key_size);
+    memcpy(map->swap + map->key_size, node_val(map, a, i), map->val_size);
+    move_entries(map, a, i, b, j, 1);
+    set_entry(map, b, j, map->swap, map->swap + map->key_size);
+}
+
+/* Split the full child `i` of the node into two around its middle key, which moves up. */
+static void split_child(btree_map_t *map, node_t *node, size_t i) {
+    size_t t = map->min_degree;
+    node_t *child = node_children(map, node)[i];
+    node_t *right = node_create(map, child->leaf);
+    move_entries(map, right, 0, child, t, t - 1);
+    if (!child->leaf) move_children(map, right, 0, child, t, t);
+    right->count = t - 1;
+    child->count = t - 1;
+
+    move_entries(map, node, i + 1, node, i, node->count - i);
+    move_children(map, node, i + 2, node, i + 1, node->count - i);
+    move_entries(map, node, i, child, t - 1, 1);
+    node_children(map, node)[i + 1] = right;
+    node->count++;
+}
+
+void btree_map_set(btree_map_t *map, void *key, void *val) {
+    if (map->root == NULL) map->root = node_create(map, true);
+    if (map->root->count == map->max_keys) {
+        node_t *root = node_create(map, false);
+        node_children(map, root)[0] = map->root;
+        map->root = root;
+        split_child(map, root, 0);
+    }
+
+    /* full nodes are split on the way down, so there is always room for the key in the leaf */
+    node_t *node = map->root;
+    while (true) {
+        bool found;
+        size_t i = node_find(map, node, key, &found);
+        if (found) {
+            entry_destroy(map, node, i);
+            set_entry(map, node, i, key, val);
+            return;
+        }
+        if (node->leaf) {
+            move_entries(map, node, i + 1, node, i, node->count - i);
+            set_entry(map, node, i, key, val);
+            node->count++;
+            map->size++;
+            return;
+        }
+        if (node_children(map, node)[i]->count == map->max_keys) {
+            split_child(map, node, i);
+            int cmp = key_compare(map, node_key(map, node, i), key);
+            if (cmp == 0) continue;
+            if (cmp < 0) i++;
+        }
+        node = node_children(map, node)[i];
+    }
+}
+
+/* Move the last entry of child i - 1 up to the node and the separator down to child i. */
+static void borrow_left(btree_map_t *map, node_t *node, size_t i) {
+    node_t *child = node_children(map, node)[i];
+    node_t *left = node_children(map, node)[i - 1];
+    move_entries(map, child, 1, child, 0, child->count);
+    move_entries(map, child, 0, node, i - 1, 1);
+    move_entries(map, node, i - 1, left, left->count - 1, 1);
+    if (!child->leaf) {
+        move_children(map, child, 1, child, 0, child->count + 1);
+        node_children(map, child)[0] = node_children(map, left)[left->count];
+    }
+    left->count--;
+    child->count++;
+}
+
+/* Move the first entry of child i + 1 up to the node and the separator down to child i. */
+static void borrow_right(btree_map_t *map, node_t *node, size_t i) {
+    node_t *child = node_children(map, node)[i];
+    node_t *right = node_children(map, node)[i + 1];
+    move_entries(map, child, child->count, node, i, 1);
+    move_entries(map, node, i, right, 0, 1);
+    move_entries(map, right, 0, right, 1, right->count - 1);
+    if (!child->leaf) {
+        node_children(map, child)[child->count + 1] = node_children(map, right)[0];
+        move_children(map, right, 0, right, 1, right->count);
+    }
+    right->count--;
+    child->count++;
+}
+
+/* Merge child i + 1 and the separator between them into child i. */
+static void merge_children(btree_map_t *map, node_t *node, size_t i) {
+    node_t *child = node_children(map, node)[i];
+    node_t *right = node_children(map, node)[i + 1];
+    move_entries(map, child, child->count, node, i, 1);
+    move_entries(map, child, child->count + 1, right, 0, right->count);
+    if (!child->leaf) move_children(map, child, child->count + 1, right, 0, right->count + 1);
+    child->count += 1 + right->count;
+    free(right);
+
+    move_entries(map, node, i, node, i + 1, node->count - i - 1);
+    move_children(map, node, i + 1, node, i + 2, node->count - i - 1);
+    node->count--;
+}
+
+void btree_map_remove(btree_map_t *map, void *key) {
+    size_t t = map->min_degree;
+    node_t *node = map->root;
+
+    /*
+     * Every node below the root is given at least t keys before the search descends into it, so
+     * the entry can be removed from a leaf without leaving any node with too few keys. A key in
+     * an internal node is first swapped with its predecessor or successor, which lies in a leaf.
+     */
+    while (node != NULL) {
+        bool found;
+        size_t i = node_find(map, node, key, &found);
+        if (node->leaf) {
+            if (!found) break;
+            entry_destroy(map, node, i);
+            move_entries(map, node, i, node, i + 1, node->count - i - 1);
+            node->count--;
+            map->size--;
+            break;
+        }
+
+        node_t **children = node_children(map, node);
+        if (found && children[i]->count >= t) {
+            node_t *prev = children[i];
+            while (!prev->leaf) prev = node_children(map, prev)[prev->count];
+            swap_entries(map, node, i, prev, prev->count - 1);
+        } else if (found && children[i + 1]->count >= t) {
+            node_t *next = children[i + 1];
+            while (!next->leaf) next = node_children(map, next)[0];
+            swap_entries(map, node, i, next, 0);
+            i++;
+        } else if (found) {
+            merge_children(map, node, i);
+        } else if (children[i]->count < t) {
+            if (i > 0 && children[i - 1]->count >= t) {
+                borrow_left(map, node, i);
+            } else if (i < node->count && children[i + 1]->count >= t) {
+                borrow_right(map, node, i);
+            } else if (i < node->count) {
+                merge_children(map, node, i);
+            } else {
+                merge_children(map, node, i - 1);
+                i--;
+            }
+        }
+
+        /* a root whose last key was merged into its only child is replaced by it */
+        node_t *child = children[i];
+        if (node == map->root && node->count == 0) {
+            map->root = child;
+            free(node);
+        }
+        node = child;
+    }
+
+    if (map->root != NULL && map->root->count == 0) {
+        free(map->root);
+        map->root = NULL;
+    }
+}
+
+/* Return the number of children or keys of node `j` of a level whose `total` are split evenly among `count` nodes. */
+static size_t share(size_t total, size_t count, size_t j) {
+    return total / count + (j < total % count ? 1 : 0);
+}
+
+int btree_map_load(btree_map_t *map, void *keys, void *vals, size_t count) {
+    if (map->size != 0) return -1;
+    uint8_t *key_data = keys;
+    uint8_t *val_data = vals;
+    for (size_t i = 1; i < count; i++) {
+        if (key_compare(map, key_data + (i - 1) * map->key_size, key_data + i * map->key_size) >= 0) return -1;
+    }
+    if (count == 0) return 0;
+
+    /*
+     * Each level has as few nodes as possible, with the children or keys spread evenly among them,
+     * which keeps every node at least half full. The entries are then streamed in order: each
+     * leaf is filled and attached to its parent, full parents are attached to theirs, and the
+     * entry after a leaf becomes the next key of the lowest node which still expects children.
+     */
+    size_t levels[64];
+    size_t height = 0;
+    size_t width = (count + map->max_keys + 1) / (map->max_keys + 1);
+    levels[height++] = width;
+    while (width > 1) {
+        width = (width + map->max_keys) / (map->max_keys + 1);
+        levels[height++] = width;
+    }
+    size_t leaf_keys = count - (levels[0] - 1);
+
+    node_t *current[64] = {NULL};
+    size_t index[64] = {0};
+    size_t pos = 0;
+    for (size_t j = 0; j < levels[0]; j++) {
+        node_t *child = node_create(map, true);
+        child->count = share(leaf_keys, levels[0], j);
+        memcpy(child->data, key_data + pos * map->key_size, child->count * map->key_size);
+        memcpy(node_val(map, child, 0), val_data + pos * map->val_size, child->count * map->val_size);
+        pos += child->count;
+
+        size_t level = 1;
+        while (level < height) {
+            if (current[level] == NULL) current[level] = node_create(map, false);
+            node_t *parent = current[level];
+            node_children(map, parent)[parent->count] = child;
+            if (parent->count + 1 < share(levels[level - 1], levels[level], index[level])) break;
+            child = parent;
+            current[level] = NULL;
+            index[level]++;
+            level++;
+        }
+        if (level == height) {
+            map->root = child;
+            break;
+        }
+        set_entry(map, current[level], current[level]->count++, key_data + pos * map->key_size,
+            val_data + pos * map->val_size);
+        pos++;
+    }
+    map->size = count;
+    return 0;
+}
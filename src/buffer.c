@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <ctype.h>
 
 buffer_t buffer_create(size_t length) {
     uint8_t *data = (uint8_t*) calloc(1, length + 1);
@@ -20,6 +21,10 @@ buffer_t buffer_create_from_string(const char *str) {
     return (buffer_t) {data, len};
 }
 
+buffer_view_t buffer_view_from_string(const char *str) {
+    return (buffer_view_t) {(uint8_t*) str, strlen(str)};
+}
+
 void buffer_destroy(buffer_t buffer) {
     free(buffer.data);
 }
@@ -38,6 +43,16 @@ int buffer_compare(buffer_t b1, buffer_t b2) {
     else return b1.length - b2.length;
 }
 
+int buffer_case_compare(buffer_t b1, buffer_t b2) {
+    size_t len = b1.length < b2.length ? b1.length: b2.length;
+    for (size_t i = 0; i < len; i++) {
+        int cmp = tolower(b1.data[i]) - tolower(b2.data[i]);
+        if (cmp != 0) return cmp;
+    }
+    if (b1.length == b2.length) return 0;
+    return b1.length < b2.length ? -1 : 1;
+}
+
 buffer_t buffer_concat(buffer_t a, buffer_t b) {
     uint8_t *data = (uint8_t*) calloc(1, a.length + b.length + 1);
     assert(data != NULL && "out of memory");
@@ -0,0 +1,294 @@
+#include <hash_map.h>
+#include <buffer.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HASH_MAP_SSE2
+#endif
+
+/*
+ * The table has a power of two number of slots, with a control byte for each. The control byte
+ * of a full slot holds the low seven bits of the hash of its key, while empty and deleted slots
+ * have the high bit set. A key is probed for in groups of GROUP_SIZE slots, starting at the slot
+ * picked by the rest of its hash and moving on by a growing number of groups, until a group
+ * with an empty slot is reached. The control bytes of the first group are repeated after the
+ * last slot, so every group can be loaded whole wherever it starts.
+ */
+#define GROUP_SIZE 16
+#define CTRL_EMPTY ((int8_t) -128)
+#define CTRL_DELETED ((int8_t) -2)
+#define NOT_FOUND SIZE_MAX
+
+/* at most 7/8 of the slots are used before the table grows */
+#define MAX_LOAD(capacity) ((capacity) - (capacity) / 8)
+
+typedef uint32_t group_mask_t;
+
+struct hash_map {
+    int8_t *ctrl;
+    uint8_t *slots;
+    size_t capacity;
+    size_t size;
+    size_t growth_left;     /* the number of empty slots which can be filled before growing */
+    size_t key_size;
+    size_t val_size;
+    size_t entry_size;
+    hash_t hash_key;
+    compare_t cmp_key;
+    destroy_t key_free;
+    destroy_t val_free;
+};
+
+hash_map_t* hash_map_create(
+    size_t key_size,
+    size_t val_size,
+    hash_t hash_key,
+    compare_t cmp_key,
+    destroy_t key_free,
+    destroy_t val_free
+) {
+    assert((hash_key == NULL) == (cmp_key == NULL) && "keys need both a hash and a comparison");
+    hash_map_t *map = calloc(1, sizeof(hash_map_t));
+    assert(map != NULL && "out of memory");
+    map->key_size = key_size;
+    map->val_size = val_size;
+    map->entry_size = key_size + val_size;
+    map->hash_key = hash_key;
+    map->cmp_key = cmp_key;
+    map->key_free = key_free;
+    map->val_free = val_free;
+    return map;
+}
+
+#ifdef HASH_MAP_SSE2
+/* Return a mask with bit i set if control byte i of the group is `ctrl`. */
+static group_mask_t group_match(const int8_t *group, int8_t ctrl) {
+    __m128i bytes = _mm_loadu_si128((const __m128i*) group);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(ctrl)));
+}
+
+/* Return a mask with bit i set if slot i of the group is empty or deleted. */
+static group_mask_t group_match_free(const int8_t *group) {
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*) group));
+}
+#else
+static group_mask_t group_match(const int8_t *group, int8_t ctrl) {
+    group_mask_t mask = 0;
+    for (int i = 0; i < GROUP_SIZE; i++) {
+        mask |= (group_mask_t) (group[i] == ctrl) << i;
+    }
+    return mask;
+}
+
+static group_mask_t group_match_free(const int8_t *group) {
+    group_mask_t mask = 0;
+    for (int i = 0; i < GROUP_SIZE; i++) {
+        mask |= (group_mask_t) (group[i] < 0) << i;
+    }
+    return mask;
+}
+#endif
+
+static uint8_t* slot_key(hash_map_t *map, size_t i) {
+    return map->slots + i * map->entry_size;
+}
+
+static uint8_t* slot_val(hash_map_t *map, size_t i) {
+    return map->slots + i * map->entry_size + map->key_size;
+}
+
+static void set_ctrl(hash_map_t *map, size_t i, int8_t ctrl) {
+    map->ctrl[i] = ctrl;
+    if (i < GROUP_SIZE) map->ctrl[map->capacity + i] = ctrl;
+}
+
+static void entry_destroy(hash_map_t *map, size_t i) {
+    if (map->key_free) map->key_free(slot_key(map, i));
+    if (map->val_free) map->val_free(slot_val(map, i));
+}
+
+static void set_entry(hash_map_t *map, size_t i, void *key, void *val) {
+    memcpy(slot_key(map, i), key, map->key_size);
+    memcpy(slot_val(map, i), val, map->val_size);
+}
+
+void hash_map_destroy(hash_map_t *map) {
+    for (size_t i = 0; i < map->capacity; i++) {
+        if (map->ctrl[i] >= 0) entry_destroy(map, i);
+    }
+    free(map->ctrl);
+    free(map->slots);
+    free(map);
+}
+
+size_t hash_map_size(hash_map_t *map) {
+    return map->size;
+}
+
+static uint64_t hash_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+uint64_t hash_map_hash_bytes(const void *data, size_t length) {
+    const uint8_t *bytes = data;
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ (length * 0xc2b2ae3d27d4eb4fULL);
+    while (length > 0) {
+        uint64_t word = 0;
+        size_t n = length < 8 ? length : 8;
+        memcpy(&word, bytes, n);
+        h ^= word * 0x87c37b91114253d5ULL;
+        h = ((h << 31) | (h >> 33)) * 0x4cf5ad432745937fULL;
+        bytes += n;
+        length -= n;
+    }
+    return hash_mix(h);
+}
+
+uint64_t hash_map_hash_buffer(void *key) {
+    buffer_t *buffer = key;
+    return hash_map_hash_bytes(buffer->data, buffer->length);
+}
+
+int hash_map_compare_buffer(void *a, void *b) {
+    return buffer_compare(*(buffer_t*) a, *(buffer_t*) b);
+}
+
+static uint64_t key_hash(hash_map_t *map, void *key) {
+    return map->hash_key ? map->hash_key(key) : hash_map_hash_bytes(key, map->key_size);
+}
+
+static bool key_equal(hash_map_t *map, void *a, void *b) {
+    return map->cmp_key ? map->cmp_key(a, b) == 0 : memcmp(a, b, map->key_size) == 0;
+}
+
+/* Return the slot of the key or NOT_FOUND. The low seven bits of the hash go in the control bytes. */
+static size_t find(hash_map_t *map, void *key, uint64_t hash) {
+    if (map->capacity == 0) return NOT_FOUND;
+    size_t mask = map->capacity - 1;
+    size_t pos = (hash >> 7) & mask;
+    for (size_t step = GROUP_SIZE; ; step += GROUP_SIZE) {
+        group_mask_t match = group_match(map->ctrl + pos, hash & 0x7f);
+        while (match != 0) {
+            size_t i = (pos + __builtin_ctz(match)) & mask;
+            if (key_equal(map, slot_key(map, i), key)) return i;
+            match &= match - 1;
+        }
+        if (group_match(map->ctrl + pos, CTRL_EMPTY) != 0) return NOT_FOUND;
+        pos = (pos + step) & mask;
+    }
+}
+
+/* Return the first empty or deleted slot in the probe sequence of the hash. */
+static size_t find_free(hash_map_t *map, uint64_t hash) {
+    size_t mask = map->capacity - 1;
+    size_t pos = (hash >> 7) & mask;
+    for (size_t step = GROUP_SIZE; ; step += GROUP_SIZE) {
+        group_mask_t match = group_match_free(map->ctrl + pos);
+        if (match != 0) return (pos + __builtin_ctz(match)) & mask;
+        pos = (pos + step) & mask;
+    }
+}
+
+/* Move every entry into a new table of `capacity` slots, which also drops the deleted slots. */
+static void resize(hash_map_t *map, size_t capacity) {
+    int8_t *ctrl = map->ctrl;
+    uint8_t *slots = map->slots;
+    size_t old_capacity = map->capacity;
+
+    map->ctrl = malloc(capacity + GROUP_SIZE);
+    map->slots = malloc(capacity * map->entry_size);
+    assert(map->ctrl != NULL && map->slots != NULL && "out of memory");
+    memset(map->ctrl, CTRL_EMPTY, capacity + GROUP_SIZE);
+    map->capacity = capacity;
+    map->growth_left = MAX_LOAD(capacity) - map->size;
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (ctrl[i] < 0) continue;
+        uint8_t *entry = slots + i * map->entry_size;
+        uint64_t hash = key_hash(map, entry);
+        size_t j = find_free(map, hash);
+        set_ctrl(map, j, hash & 0x7f);
+        memcpy(slot_key(map, j), entry, map->entry_size);
+    }
+    free(ctrl);
+    free(slots);
+}
+
+void hash_map_reserve(hash_map_t *map, size_t count) {
+    size_t capacity = GROUP_SIZE;
+    while (MAX_LOAD(capacity) < count) capacity *= 2;
+    if (capacity > map->capacity) resize(map, capacity);
+}
+
+void* hash_map_get(hash_map_t *map, void *key) {
+    size_t i = find(map, key, key_hash(map, key));
+    return i == NOT_FOUND ? NULL : slot_val(map, i);
+}
+
+void hash_map_set(hash_map_t *map, void *key, void *val) {
+    uint64_t hash = key_hash(map, key);
+    size_t i = find(map, key, hash);
+    if (i != NOT_FOUND) {
+        entry_destroy(map, i);
+        set_entry(map, i, key, val);
+        return;
+    }
+
+    if (map->capacity == 0) resize(map, GROUP_SIZE);
+    i = find_free(map, hash);
+    if (map->ctrl[i] == CTRL_EMPTY && map->growth_left == 0) {
+        /* a table with many deleted slots is cleaned up rather than grown */
+        bool clean = map->capacity > GROUP_SIZE && map->size * 32 <= map->capacity * 25;
+        size_t capacity = clean ? map->capacity : 2 * map->capacity;
+        resize(map, capacity);
+        i = find_free(map, hash);
+    }
+    if (map->ctrl[i] == CTRL_EMPTY) map->growth_left--;
+    set_ctrl(map, i, hash & 0x7f);
+    set_entry(map, i, key, val);
+    map->size++;
+}
+
+void hash_map_remove(hash_map_t *map, void *key) {
+    size_t i = find(map, key, key_hash(map, key));
+    if (i == NOT_FOUND) return;
+    entry_destroy(map, i);
+    map->size--;
+
+    /*
+     * A probe only moves past a group with no empty slot. If every group which contains the
+     * slot also contains an empty slot, no probe has ever moved past it, so it can be empty
+     * again. Otherwise it is marked deleted, so that probes still move past it.
+     */
+    size_t before = (i - GROUP_SIZE) & (map->capacity - 1);
+    group_mask_t empty_after = group_match(map->ctrl + i, CTRL_EMPTY);
+    group_mask_t empty_before = group_match(map->ctrl + before, CTRL_EMPTY);
+    if (empty_after != 0 && empty_before != 0 &&
+        __builtin_ctz(empty_after) + (__builtin_clz(empty_before) - 16) < GROUP_SIZE) {
+        set_ctrl(map, i, CTRL_EMPTY);
+        map->growth_left++;
+    } else {
+        set_ctrl(map, i, CTRL_DELETED);
+    }
+}
+
+bool hash_map_next(hash_map_t *map, size_t *pos, void **key, void **val) {
+    while (*pos < map->capacity) {
+        size_t i = (*pos)++;
+        if (map->ctrl[i] >= 0) {
+            *key = slot_key(map, i);
+            *val = slot_val(map, i);
+            return true;
+        }
+    }
+    return false;
+}
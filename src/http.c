@@ -1,157 +1,288 @@
 #include <http.h>
 #include <buffer.h>
 #include <array.h>
+#include <arena.h>
 
 #include <stdbool.h>
-#include <ctype.h>
 #include <string.h>
 #include <stdint.h>
 #include <assert.h>
 #include <stdlib.h>
 #include <path.h>
+#include <http_scan.h>
+#include <stdio.h>
+
+#define HTTP_HEADERS_CAPACITY 16
+#define HTTP_HEADERS_BUCKETS 16
+#define HTTP_HEADER_IDS 64
+#define HTTP_STATUS_LINE_MAX 32
+
+struct http_headers {
+    arena_t *arena;
+    http_header_t *items;
+    int32_t *next;                          /* the next header in the same bucket or -1 */
+    size_t size;
+    size_t capacity;
+    int32_t slots[HTTP_HEADER_OTHER];       /* the first header with each well-known id or -1 */
+    int32_t buckets[HTTP_HEADERS_BUCKETS];  /* the first header of each other name hash or -1 */
+};
 
 typedef struct http_request {
-    char* method;
-    char* uri;
-    char* version;
-    array_t *headers;
+    buffer_view_t method;
+    buffer_view_t uri;
+    buffer_view_t version;
+    http_headers_t headers;
 } http_request_t;
 
 typedef struct http_response {
-    char *version;
+    arena_t *arena;
+    buffer_view_t version;
     int status;
-    array_t *headers;
-    buffer_t body;
+    http_headers_t headers;
+    buffer_view_t body;
+    buffer_view_t preset;   /* the pre-rendered status line and headers or empty */
 } http_response_t;
 
-typedef struct http_header {
-    char* key;
-    char* value;
-} http_header_t;
+static const char *http_header_names[HTTP_HEADER_OTHER] = {
+    [HTTP_HEADER_ACCEPT] = "Accept",
+    [HTTP_HEADER_ACCEPT_ENCODING] = "Accept-Encoding",
+    [HTTP_HEADER_ACCEPT_LANGUAGE] = "Accept-Language",
+    [HTTP_HEADER_ACCEPT_RANGES] = "Accept-Ranges",
+    [HTTP_HEADER_AUTHORIZATION] = "Authorization",
+    [HTTP_HEADER_CACHE_CONTROL] = "Cache-Control",
+    [HTTP_HEADER_CONNECTION] = "Connection",
+    [HTTP_HEADER_CONTENT_ENCODING] = "Content-Encoding",
+    [HTTP_HEADER_CONTENT_LENGTH] = "Content-Length",
+    [HTTP_HEADER_CONTENT_RANGE] = "Content-Range",
+    [HTTP_HEADER_CONTENT_TYPE] = "Content-Type",
+    [HTTP_HEADER_COOKIE] = "Cookie",
+    [HTTP_HEADER_DATE] = "Date",
+    [HTTP_HEADER_ETAG] = "ETag",
+    [HTTP_HEADER_EXPECT] = "Expect",
+    [HTTP_HEADER_HOST] = "Host",
+    [HTTP_HEADER_IF_MATCH] = "If-Match",
+    [HTTP_HEADER_IF_MODIFIED_SINCE] = "If-Modified-Since",
+    [HTTP_HEADER_IF_NONE_MATCH] = "If-None-Match",
+    [HTTP_HEADER_IF_RANGE] = "If-Range",
+    [HTTP_HEADER_IF_UNMODIFIED_SINCE] = "If-Unmodified-Since",
+    [HTTP_HEADER_KEEP_ALIVE] = "Keep-Alive",
+    [HTTP_HEADER_LAST_MODIFIED] = "Last-Modified",
+    [HTTP_HEADER_LOCATION] = "Location",
+    [HTTP_HEADER_RANGE] = "Range",
+    [HTTP_HEADER_SERVER] = "Server",
+    [HTTP_HEADER_TE] = "TE",
+    [HTTP_HEADER_TRAILER] = "Trailer",
+    [HTTP_HEADER_TRANSFER_ENCODING] = "Transfer-Encoding",
+    [HTTP_HEADER_UPGRADE] = "Upgrade",
+    [HTTP_HEADER_USER_AGENT] = "User-Agent",
+};
+
+/* open addressed table from the name hash to the well-known id, filled in at startup */
+static int8_t http_header_ids[HTTP_HEADER_IDS];
+
+static inline uint8_t to_lower(uint8_t c) {
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
 
-static void http_header_destroy(http_header_t *header) {
-    if (header == NULL) return;
-    free(header->key);
-    free(header->value);
+/* FNV-1a of the lowercased name, so that names which differ only in case hash equally */
+static uint32_t header_name_hash(buffer_view_t name) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < name.length; i++) {
+        hash = (hash ^ to_lower(name.data[i])) * 16777619u;
+    }
+    return hash;
 }
 
+__attribute__((constructor))
+static void http_header_ids_init() {
+    memset(http_header_ids, -1, sizeof(http_header_ids));
+    for (int id = 0; id < HTTP_HEADER_OTHER; id++) {
+        size_t i = header_name_hash(buffer_view_from_string(http_header_names[id])) % HTTP_HEADER_IDS;
+        while (http_header_ids[i] != -1) i = (i + 1) % HTTP_HEADER_IDS;
+        http_header_ids[i] = id;
+    }
+}
 
-static char* string_copy(char *a) {
-    size_t n = strlen(a);
-    char *b = calloc(1, n + 1);
-    assert(b != NULL && "out of memory");
-    memcpy(b, a, n);
-    return b;
+static http_header_id_t header_lookup(buffer_view_t name, uint32_t hash) {
+    for (size_t i = hash % HTTP_HEADER_IDS; http_header_ids[i] != -1; i = (i + 1) % HTTP_HEADER_IDS) {
+        buffer_view_t known = buffer_view_from_string(http_header_names[http_header_ids[i]]);
+        if (buffer_case_compare(name, known) == 0) return http_header_ids[i];
+    }
+    return HTTP_HEADER_OTHER;
 }
 
+http_header_id_t http_header_lookup(buffer_view_t name) {
+    return header_lookup(name, header_name_hash(name));
+}
 
-http_request_t* http_request_create() {
-    http_request_t *res = calloc(1, sizeof(http_request_t));
-    assert(res != NULL && "out of memory");
-    res->headers = array_create(sizeof(http_header_t), 16);
-    return res;
+buffer_view_t http_header_name(http_header_id_t id) {
+    assert(id >= 0 && id < HTTP_HEADER_OTHER);
+    return buffer_view_from_string(http_header_names[id]);
 }
 
-char* http_request_method(http_request_t *req) {
-    return req->method;
+static void http_headers_init(http_headers_t *headers, arena_t *arena) {
+    headers->arena = arena;
+    headers->items = arena_alloc(arena, HTTP_HEADERS_CAPACITY * sizeof(http_header_t));
+    headers->next = arena_alloc(arena, HTTP_HEADERS_CAPACITY * sizeof(int32_t));
+    headers->size = 0;
+    headers->capacity = HTTP_HEADERS_CAPACITY;
+    memset(headers->slots, -1, sizeof(headers->slots));
+    memset(headers->buckets, -1, sizeof(headers->buckets));
 }
 
-void http_request_set_method(http_request_t *req, char *method) {
-    req->method = string_copy(method);
+http_headers_t* http_headers_create(arena_t *arena) {
+    http_headers_t *headers = arena_alloc(arena, sizeof(http_headers_t));
+    http_headers_init(headers, arena);
+    return headers;
 }
 
-char* http_request_uri(http_request_t *req) {
-    return req->uri;
+size_t http_headers_size(http_headers_t *headers) {
+    return headers->size;
 }
 
-void http_request_set_uri(http_request_t *req, char *uri) {
-    req->uri = string_copy(uri);
+http_header_t* http_headers_at(http_headers_t *headers, size_t i) {
+    assert(i < headers->size);
+    return &headers->items[i];
 }
 
-char* http_request_version(http_request_t *req) {
-    return req->version;
+/* Return the index of the first other header with the given name or -1. */
+static int32_t headers_find_other(http_headers_t *headers, buffer_view_t key, uint32_t hash) {
+    int32_t i = headers->buckets[hash % HTTP_HEADERS_BUCKETS];
+    while (i != -1 && buffer_case_compare(headers->items[i].key, key) != 0) {
+        i = headers->next[i];
+    }
+    return i;
 }
 
-void http_request_set_version(http_request_t *req, char *version) {
-    req->version = string_copy(version);
+static void headers_insert(http_headers_t *headers, http_header_id_t id, buffer_view_t key, 
+        buffer_view_t value, uint32_t hash) {
+    if (headers->size == headers->capacity) {
+        /* the old items stay in the arena until it is reset */
+        http_header_t *items = arena_alloc(headers->arena, 2 * headers->capacity * sizeof(http_header_t));
+        int32_t *next = arena_alloc(headers->arena, 2 * headers->capacity * sizeof(int32_t));
+        memcpy(items, headers->items, headers->size * sizeof(http_header_t));
+        memcpy(next, headers->next, headers->size * sizeof(int32_t));
+        headers->items = items;
+        headers->next = next;
+        headers->capacity *= 2;
+    }
+    int32_t i = headers->size++;
+    headers->items[i] = (http_header_t) {key, value, id};
+    headers->next[i] = -1;
+
+    /* only the first header with a name is indexed, since lookups return the first match */
+    if (id != HTTP_HEADER_OTHER) {
+        if (headers->slots[id] == -1) headers->slots[id] = i;
+    } else if (headers_find_other(headers, key, hash) == -1) {
+        int32_t *bucket = &headers->buckets[hash % HTTP_HEADERS_BUCKETS];
+        headers->next[i] = *bucket;
+        *bucket = i;
+    }
+}
+
+void http_headers_add(http_headers_t *headers, buffer_view_t key, buffer_view_t value) {
+    uint32_t hash = header_name_hash(key);
+    headers_insert(headers, header_lookup(key, hash), key, value, hash);
 }
 
-array_t* http_request_get_headers(http_request_t *req) {
-    return req->headers;
+buffer_view_t* http_headers_get_id(http_headers_t *headers, http_header_id_t id) {
+    assert(id >= 0 && id < HTTP_HEADER_OTHER);
+    int32_t i = headers->slots[id];
+    return i == -1 ? NULL : &headers->items[i].value;
 }
 
-char* http_request_header(http_request_t *req, char *key) {
-    size_t n = strlen(key);
-    char lowercase_key[n + 1];
-    for (size_t i = 0; i <= n; i++) {
-        lowercase_key[i] = tolower(key[i]);
+void http_headers_set_id(http_headers_t *headers, http_header_id_t id, char *val) {
+    buffer_view_t *value = http_headers_get_id(headers, id);
+    if (value != NULL) {
+        *value = buffer_view_from_string(val);
+    } else {
+        headers_insert(headers, id, http_header_name(id), buffer_view_from_string(val), 0);
     }
-    for (size_t i = 0; i < array_size(req->headers); i++) {
-        http_header_t *header = array_get(req->headers, i);
-        if (strcmp(header->key, lowercase_key) == 0) return header->value; 
+}
+
+buffer_view_t* http_headers_get(http_headers_t *headers, char *key) {
+    buffer_view_t key_view = buffer_view_from_string(key);
+    uint32_t hash = header_name_hash(key_view);
+    http_header_id_t id = header_lookup(key_view, hash);
+    if (id != HTTP_HEADER_OTHER) return http_headers_get_id(headers, id);
+    int32_t i = headers_find_other(headers, key_view, hash);
+    return i == -1 ? NULL : &headers->items[i].value;
+}
+
+void http_headers_set(http_headers_t *headers, char *key, char *val) {
+    buffer_view_t *value = http_headers_get(headers, key);
+    if (value != NULL) {
+        *value = buffer_view_from_string(val);
+    } else {
+        http_headers_add(headers, buffer_view_from_string(key), buffer_view_from_string(val));
     }
-    return NULL;
 }
 
-void http_request_destroy(http_request_t *req) {
-    if (req == NULL) return;
-    array_destroy(req->headers, (destroy_t) http_header_destroy);
-    free(req->method);
-    free(req->uri);
-    free(req->version);
+http_request_t* http_request_create(arena_t *arena) {
+    http_request_t *res = arena_calloc(arena, sizeof(http_request_t));
+    http_headers_init(&res->headers, arena);
+    return res;
 }
 
-static int is_ascii(uint8_t c) {
-    return c <= 127;
+buffer_view_t http_request_method(http_request_t *req) {
+    return req->method;
 }
 
-static int is_vchar(uint8_t c) {
-    return 0x21 <= c && c <= 0x7E;
+void http_request_set_method(http_request_t *req, buffer_view_t method) {
+    req->method = method;
 }
 
-static int is_space(uint8_t c) {
-    return c == ' ' || c == '\t';
+buffer_view_t http_request_uri(http_request_t *req) {
+    return req->uri;
 }
 
-static int is_obs_text(uint8_t c) {
-    return 0x80 <= c && c <= 0xFF;
+void http_request_set_uri(http_request_t *req, buffer_view_t uri) {
+    req->uri = uri;
 }
 
-static int is_tchar(uint8_t c) {
-    switch (c) {
-    case '!': case '#': case '$': case '%':
-    case '&': case '*': case '+': case '-':
-    case '.': case '^': case '_': case '`':
-    case '|': case '~': case '\'':
-        return 1;
-    }
-    return isdigit(c) || isalpha(c);
+buffer_view_t http_request_version(http_request_t *req) {
+    return req->version;
+}
+
+void http_request_set_version(http_request_t *req, buffer_view_t version) {
+    req->version = version;
+}
+
+http_headers_t* http_request_get_headers(http_request_t *req) {
+    return &req->headers;
+}
+
+buffer_view_t* http_request_header(http_request_t *req, char *key) {
+    return http_headers_get(&req->headers, key);
+}
+
+buffer_view_t* http_request_header_id(http_request_t *req, http_header_id_t id) {
+    return http_headers_get_id(&req->headers, id);
+}
+
+static inline int is_char_class(uint8_t c, uint8_t flags) {
+    return http_char_class[c] & flags;
+}
+
+static inline int is_space(uint8_t c) {
+    return is_char_class(c, HTTP_CHAR_SPACE);
+}
+
+static inline int is_digit(uint8_t c) {
+    return is_char_class(c, HTTP_CHAR_DIGIT);
+}
+
+static inline int is_tchar(uint8_t c) {
+    return is_char_class(c, HTTP_CHAR_TCHAR);
 }
 
 static long parse_http_token(buffer_t buffer, buffer_t *res) {
     if (buffer.length == 0) return -1;
     if (!is_tchar(buffer.data[0])) return -2;
-    for (size_t i = 0; i < buffer.length; i++) {
-        if (!is_tchar(buffer.data[i])) {
-            res->data = buffer.data;
-            res->length = i;
-            return i;
-        }
-    }
+    size_t length = http_scan_token(buffer.data, buffer.length);
     res->data = buffer.data;
-    res->length = buffer.length;
-    return buffer.length;
-}
-
-static long parse_http_space(buffer_t buffer) {
-    if (buffer.length == 0) return -1;
-    if (!is_space(buffer.data[0])) return -2;
-    for (size_t i = 0; i < buffer.length; i++) {
-        if (!is_space(buffer.data[i])) {
-            return i;
-        }
-    }
-    return buffer.length;
+    res->length = length;
+    return length;
 }
 
 static long parse_http_version(buffer_t buffer, buffer_t *res) {
@@ -161,11 +292,11 @@ static long parse_http_version(buffer_t buffer, buffer_t *res) {
     }
     if (memcmp(buffer.data, "HTTP/", 5) != 0) return -2;
     if (buffer.length < 6) return -1;
-    if (!isdigit(buffer.data[5])) return -2;
+    if (!is_digit(buffer.data[5])) return -2;
     if (buffer.length < 7) return -1;
     if (buffer.data[6] != '.') return -2;
     if (buffer.length < 8) return -1;
-    if (!isdigit(buffer.data[7])) return -2;
+    if (!is_digit(buffer.data[7])) return -2;
     res->data = buffer.data;
     res->length = 8;
     return 8;
@@ -194,6 +325,9 @@ static long parse_http_request_line(buffer_t buffer, buffer_t *method, buffer_t
 
     len = parse_absolute_path(buffer, NULL);
     if (len < 0) return len;
+    long query_len = parse_query((buffer_view_t) {buffer.data + len, buffer.length - len});
+    if (query_len < 0) return query_len;
+    len += query_len;
     acc_len += len;
     *uri = (buffer_view_t) {buffer.data, len};
     buffer_slice(buffer, len, &buffer);
@@ -218,9 +352,9 @@ static long parse_http_request_line(buffer_t buffer, buffer_t *method, buffer_t
 static long parse_http_status_code(buffer_t buffer, int *status) {
     *status = 0;
     if (buffer.length < 3) return -1;
-    if (!isdigit(buffer.data[0])) return -2;
-    if (!isdigit(buffer.data[1])) return -2;
-    if (!isdigit(buffer.data[2])) return -2;
+    if (!is_digit(buffer.data[0])) return -2;
+    if (!is_digit(buffer.data[1])) return -2;
+    if (!is_digit(buffer.data[2])) return -2;
     *status += (buffer.data[0] - '0') * 100;
     *status += (buffer.data[1] - '0') * 10;
     *status += (buffer.data[2] - '0') * 1;
@@ -228,13 +362,7 @@ static long parse_http_status_code(buffer_t buffer, int *status) {
 }
 
 static long parse_http_reason_phrase(buffer_t buffer) {
-    for (size_t i = 0; i < buffer.length; i++) {
-        char c = buffer.data[i];
-        if (c != ' ' && c != '\t' && !is_vchar(c) && !is_obs_text(c)) {
-            return i;
-        }
-    }
-    return buffer.length;
+    return http_scan_field(buffer.data, buffer.length);
 }
 
 static long parse_http_status_line(buffer_t buffer, buffer_t *version, int *status) {
@@ -279,14 +407,7 @@ static long parse_http_status_line(buffer_t buffer, buffer_t *version, int *stat
  *
  */
 static long parse_http_header_value(buffer_t buffer, buffer_t *value) {
-    size_t length = 0;
-    for (size_t i = 0; i < buffer.length; i++) {
-        char c = buffer.data[i];
-        if (!is_vchar(c) && !is_space(c) && !is_obs_text(c)) {
-            length = i;
-            break;
-        }
-    }
+    size_t length = http_scan_field(buffer.data, buffer.length);
     if (buffer.length - length < 2) return -1;
     if (buffer.data[length + 0] != '\r') return -2;
     if (buffer.data[length + 1] != '\n') return -2;
@@ -317,35 +438,18 @@ static long parse_http_header_line(buffer_t buffer, buffer_t *key, buffer_t *val
 }
 
 static buffer_t buffer_strip(buffer_t buffer) {
-    size_t start = buffer.length;
-    for (size_t i = 0; i < buffer.length; i++) {
-        if (!is_space(buffer.data[i])) {
-            start = i;
-            break;
-        }
-    }
-    size_t end = start;
-    for (size_t i = buffer.length - 1; i >= start; i--) {
-        if (!is_space(buffer.data[i])) {
-            end = i + 1;
-            break;
-        }
-    }
+    size_t start = 0;
+    while (start < buffer.length && is_space(buffer.data[start])) start++;
+    size_t end = buffer.length;
+    while (end > start && is_space(buffer.data[end - 1])) end--;
     return (buffer_t){buffer.data + start, end - start};
 }
 
-static void string_to_lower(char *str) {
-    for (size_t i = 0; str[i] != '\0'; i++) {
-        str[i] = tolower(str[i]);
-    }
-}
-
-long parse_http_headers(buffer_t buffer, array_t *headers) {
+static long parse_http_headers(buffer_t buffer, http_headers_t *headers) {
     long len, acc_len = 0;
 
     // attempt to parse headers until empty line or error 
     while (1) {
-        http_header_t header;
         buffer_t name, value;
         len = parse_http_header_line(buffer, &name, &value); 
         if (len == -1) return -1;
@@ -358,9 +462,7 @@ long parse_http_headers(buffer_t buffer, array_t *headers) {
         acc_len += len;
         buffer_slice(buffer, len, &buffer);
         
-        header.key = buffer_to_string(name);
-        string_to_lower(header.key);
-        header.value = buffer_to_string(buffer_strip(value));
+        http_headers_add(headers, name, buffer_strip(value));
     }
 }
 
@@ -374,176 +476,814 @@ long parse_http_request(buffer_t buffer, http_request_t *req) {
     acc_len += len;
     buffer_slice(buffer, len, &buffer);
 
-    req->method = buffer_to_string(method);
-    req->uri = buffer_to_string(uri);
-    req->version = buffer_to_string(version);
-    req->headers = array_create(sizeof(http_header_t), 16);
+    req->method = method;
+    req->uri = uri;
+    req->version = version;
 
-    len = parse_http_headers(buffer, req->headers);
+    len = parse_http_headers(buffer, &req->headers);
     if (len < 0) return len;
     acc_len += len;
     return acc_len;
 }
 
-http_response_t* http_response_create() {
-    http_response_t *res = calloc(1, sizeof(http_response_t));
-    assert(res != NULL && "out of memory");
-    char *version = "HTTP/1.1";
-    res->version = calloc(1, strlen(version) + 1); 
-    strcpy(res->version, version);
-    res->status = 200;
-    res->headers = array_create(sizeof(http_header_t), 16);
-    return res;
+typedef enum http_parser_state {
+    S_METHOD_START,
+    S_METHOD,
+    S_URI_START,
+    S_URI,
+    S_URI_PERCENT_1,
+    S_URI_PERCENT_2,
+    S_VERSION,
+    S_REQUEST_LINE_LF,
+    S_HEADER_START,
+    S_HEADER_NAME,
+    S_HEADER_VALUE,
+    S_HEADER_LF,
+    S_END_LF,
+    S_ERROR,
+} http_parser_state_t;
+
+/**
+ * The byte offsets of a parsed header line relative to the start of the request.
+ */
+typedef struct http_header_mark {
+    size_t name;
+    size_t name_end;
+    size_t value;
+    size_t value_end;
+    uint32_t hash;
+    http_header_id_t id;
+} http_header_mark_t;
+
+typedef enum http_body_state {
+    B_NONE,
+    B_LENGTH,
+    B_CHUNK_SIZE_START,
+    B_CHUNK_SIZE,
+    B_CHUNK_EXT,
+    B_CHUNK_SIZE_LF,
+    B_CHUNK_DATA,
+    B_CHUNK_DATA_CR,
+    B_CHUNK_DATA_LF,
+    B_TRAILER_START,
+    B_TRAILER_NAME,
+    B_TRAILER_VALUE,
+    B_TRAILER_LF,
+    B_END_LF,
+    B_DONE,
+    B_ERROR,
+    B_TOO_LARGE,
+} http_body_state_t;
+
+typedef struct http_parser {
+    http_parser_state_t state;
+    size_t offset;
+    size_t method_end;
+    size_t uri_end;
+    size_t version_end;
+    http_header_mark_t header;
+    array_t *headers;
+    http_body_state_t body_state;
+    size_t remaining;   /* the bytes left in the body or the current chunk */
+    size_t received;    /* the bytes of chunk data announced so far */
+    size_t max_body;
+    size_t max_head;
+} http_parser_t;
+
+http_parser_t* http_parser_create() {
+    http_parser_t *parser = calloc(1, sizeof(http_parser_t));
+    assert(parser != NULL && "out of memory");
+    parser->headers = array_create(sizeof(http_header_mark_t), 16);
+    parser->max_body = HTTP_DEFAULT_MAX_BODY;
+    parser->max_head = HTTP_DEFAULT_MAX_HEAD;
+    return parser;
+}
+
+void http_parser_set_max_body(http_parser_t *parser, size_t max_body) {
+    parser->max_body = max_body;
+}
+
+void http_parser_set_max_head(http_parser_t *parser, size_t max_head) {
+    parser->max_head = max_head;
+}
+
+void http_parser_destroy(http_parser_t *parser) {
+    if (parser == NULL) return;
+    array_destroy(parser->headers, NULL);
+    free(parser);
+}
+
+void http_parser_reset(http_parser_t *parser) {
+    parser->state = S_METHOD_START;
+    parser->offset = 0;
+    parser->body_state = B_NONE;
+    while (array_size(parser->headers) > 0) {
+        array_remove(parser->headers, array_size(parser->headers) - 1);
+    }
+}
+
+static inline int is_path_char(uint8_t c) {
+    return is_char_class(c, HTTP_CHAR_PATH);
 }
 
+static inline int is_hex(uint8_t c) {
+    return is_char_class(c, HTTP_CHAR_HEX);
+}
 
-void http_response_destroy(http_response_t *res) {
-    if (res == NULL) return;
-    free(res->version);
-    array_destroy(res->headers, (destroy_t) http_header_destroy);
-    buffer_destroy(res->body);
+static inline int is_field_char(uint8_t c) {
+    return is_char_class(c, HTTP_CHAR_FIELD);
 }
 
-static int key_equal(char *a, char *b) {
-    for (size_t i = 0; a[i] != '\0'; i++) {
-        if (a[i] != b[i]) return 0;
+static inline int hex_value(uint8_t c) {
+    return is_digit(c) ? c - '0' : to_lower(c) - 'a' + 10;
+}
+
+/**
+ * Fill the request with views of the request line and header fields recorded by the parser.
+ * The results are identical to those produced by parse_http_request.
+ */
+static void http_parser_emit(http_parser_t *parser, buffer_t buffer, http_request_t *req) {
+    size_t uri_start = parser->method_end + 1;
+    size_t version_start = parser->uri_end + 1;
+    req->method = (buffer_view_t){buffer.data, parser->method_end};
+    req->uri = (buffer_view_t){buffer.data + uri_start, parser->uri_end - uri_start};
+    req->version = (buffer_view_t){buffer.data + version_start, parser->version_end - version_start};
+    for (size_t i = 0; i < array_size(parser->headers); i++) {
+        http_header_mark_t *mark = array_get(parser->headers, i);
+        buffer_view_t name = {buffer.data + mark->name, mark->name_end - mark->name};
+        buffer_view_t value = {buffer.data + mark->value, mark->value_end - mark->value};
+        headers_insert(&req->headers, mark->id, name, buffer_strip(value), mark->hash);
+    }
+}
+
+long http_parser_feed(http_parser_t *parser, buffer_t buffer, http_request_t *req) {
+    static const char version[] = "HTTP/";
+    size_t i = parser->offset;
+    http_parser_state_t state = parser->state;
+
+    /* a head which is not complete within the limit is rejected without looking any further */
+    size_t end = buffer.length < parser->max_head ? buffer.length : parser->max_head;
+    for (; i < end && state != S_ERROR; i++) {
+        /* skip to the delimiter of long header names and values in blocks */
+        if (state == S_HEADER_NAME) {
+            i += http_scan_token(buffer.data + i, end - i);
+        } else if (state == S_HEADER_VALUE) {
+            i += http_scan_field(buffer.data + i, end - i);
+        }
+        if (i == end) break;
+        uint8_t c = buffer.data[i];
+        switch (state) {
+        case S_METHOD_START:
+            state = is_tchar(c) ? S_METHOD: S_ERROR;
+            break;
+        case S_METHOD:
+            if (c == ' ') {
+                parser->method_end = i;
+                state = S_URI_START;
+            } else if (!is_tchar(c)) {
+                state = S_ERROR;
+            }
+            break;
+        case S_URI_START:
+            state = c == '/' ? S_URI: S_ERROR;
+            break;
+        case S_URI:
+            if (c == ' ') {
+                parser->uri_end = i;
+                state = S_VERSION;
+            } else if (c == '%') {
+                state = S_URI_PERCENT_1;
+            } else if (!is_path_char(c) && c != '?') {
+                state = S_ERROR;
+            }
+            break;
+        case S_URI_PERCENT_1:
+            state = is_hex(c) ? S_URI_PERCENT_2: S_ERROR;
+            break;
+        case S_URI_PERCENT_2:
+            state = is_hex(c) ? S_URI: S_ERROR;
+            break;
+        case S_VERSION: {
+            size_t j = i - parser->uri_end - 1;
+            if (j < 5) {
+                if (c != version[j]) state = S_ERROR;
+            } else if (j == 5 || j == 7) {
+                if (!is_digit(c)) state = S_ERROR;
+            } else if (j == 6) {
+                if (c != '.') state = S_ERROR;
+            } else if (c == '\r') {
+                parser->version_end = i;
+                state = S_REQUEST_LINE_LF;
+            } else {
+                state = S_ERROR;
+            }
+            break;
+        }
+        case S_REQUEST_LINE_LF:
+        case S_HEADER_LF:
+            if (c != '\n') {
+                state = S_ERROR;
+            } else if (state == S_HEADER_LF) {
+                array_add(parser->headers, &parser->header);
+                state = S_HEADER_START;
+            } else {
+                state = S_HEADER_START;
+            }
+            break;
+        case S_HEADER_START:
+            if (is_tchar(c)) {
+                parser->header.name = i;
+                state = S_HEADER_NAME;
+            } else {
+                state = c == '\r' ? S_END_LF: S_ERROR;
+            }
+            break;
+        case S_HEADER_NAME:
+            if (c == ':') {
+                buffer_view_t name = {buffer.data + parser->header.name, i - parser->header.name};
+                parser->header.name_end = i;
+                parser->header.value = i + 1;
+                parser->header.hash = header_name_hash(name);
+                parser->header.id = header_lookup(name, parser->header.hash);
+                state = S_HEADER_VALUE;
+            } else if (!is_tchar(c)) {
+                state = S_ERROR;
+            }
+            break;
+        case S_HEADER_VALUE:
+            if (c == '\r') {
+                parser->header.value_end = i;
+                state = S_HEADER_LF;
+            } else {
+                state = S_ERROR;
+            }
+            break;
+        case S_END_LF:
+            if (c != '\n') {
+                state = S_ERROR;
+                break;
+            }
+            http_parser_emit(parser, buffer, req);
+            http_parser_reset(parser);
+            return i + 1;
+        case S_ERROR:
+            break;
+        }
     }
+    parser->state = state;
+    parser->offset = i;
+    if (state == S_ERROR) return HTTP_PARSE_ERROR;
+    return i == parser->max_head ? HTTP_PARSE_TOO_LARGE : HTTP_PARSE_INCOMPLETE;
+}
+
+/**
+ * Parse a Content-Length value, which must consist of decimal digits only. Return 0 on
+ * success, HTTP_PARSE_ERROR if the value is invalid, and HTTP_PARSE_TOO_LARGE if it does not
+ * fit in a size_t.
+ */
+static int parse_content_length(buffer_view_t value, size_t *length) {
+    if (value.length == 0) return HTTP_PARSE_ERROR;
+    size_t res = 0;
+    for (size_t i = 0; i < value.length; i++) {
+        if (!is_digit(value.data[i])) return HTTP_PARSE_ERROR;
+        if (res > (SIZE_MAX - 9) / 10) return HTTP_PARSE_TOO_LARGE;
+        res = res * 10 + (value.data[i] - '0');
+    }
+    *length = res;
+    return 0;
+}
+
+/**
+ * Return true if the last transfer coding in the Transfer-Encoding value is chunked.
+ */
+static bool is_chunked(buffer_view_t value) {
+    size_t start = value.length;
+    while (start > 0 && value.data[start - 1] != ',') start--;
+    buffer_view_t coding = buffer_strip((buffer_view_t){value.data + start, value.length - start});
+    return buffer_case_compare(coding, buffer_view_from_string("chunked")) == 0;
+}
+
+int http_parser_start_body(http_parser_t *parser, http_request_t *req) {
+    http_headers_t *headers = &req->headers;
+    buffer_view_t *transfer_encoding = NULL;
+    bool has_length = false;
+    size_t length = 0;
+    for (size_t i = 0; i < headers->size; i++) {
+        http_header_t *header = &headers->items[i];
+        if (header->id == HTTP_HEADER_TRANSFER_ENCODING) {
+            transfer_encoding = &header->value;
+        } else if (header->id == HTTP_HEADER_CONTENT_LENGTH) {
+            size_t value;
+            int res = parse_content_length(header->value, &value);
+            if (res != 0) return res;
+            if (has_length && value != length) return HTTP_PARSE_ERROR;
+            has_length = true;
+            length = value;
+        }
+    }
+
+    /* a message with both is a request smuggling attempt or a broken intermediary (rfc7230 3.3.3) */
+    if (transfer_encoding != NULL) {
+        if (has_length || !is_chunked(*transfer_encoding)) return HTTP_PARSE_ERROR;
+        parser->body_state = B_CHUNK_SIZE_START;
+        parser->received = 0;
+        return 1;
+    }
+    if (length == 0) return 0;
+    if (length > parser->max_body) return HTTP_PARSE_TOO_LARGE;
+    parser->body_state = B_LENGTH;
+    parser->remaining = length;
     return 1;
 }
 
+long http_parser_feed_body(http_parser_t *parser, buffer_t buffer, size_t *consumed, http_body_cb on_body, void *data) {
+    http_body_state_t state = parser->body_state;
+    assert(state != B_NONE && "no body in progress");
+    size_t i = 0;
+    while (i < buffer.length && state != B_DONE && state != B_ERROR && state != B_TOO_LARGE) {
+        uint8_t c = buffer.data[i];
+        switch (state) {
+        case B_LENGTH:
+        case B_CHUNK_DATA: {
+            /* hand over as much of the data as has arrived without copying it */
+            size_t n = buffer.length - i < parser->remaining ? buffer.length - i : parser->remaining;
+            if (on_body != NULL) on_body(data, (buffer_view_t){buffer.data + i, n});
+            parser->remaining -= n;
+            i += n;
+            if (parser->remaining == 0) state = state == B_LENGTH ? B_DONE : B_CHUNK_DATA_CR;
+            continue;
+        }
+        case B_CHUNK_SIZE_START:
+            if (is_hex(c)) {
+                parser->remaining = hex_value(c);
+                state = B_CHUNK_SIZE;
+            } else {
+                state = B_ERROR;
+            }
+            break;
+        case B_CHUNK_SIZE:
+            if (is_hex(c)) {
+                if (parser->remaining > (SIZE_MAX >> 4)) {
+                    state = B_TOO_LARGE;
+                    break;
+                }
+                parser->remaining = parser->remaining * 16 + hex_value(c);
+            } else if (c == ';' || is_space(c)) {
+                state = B_CHUNK_EXT;
+            } else {
+                state = c == '\r' ? B_CHUNK_SIZE_LF : B_ERROR;
+            }
+            break;
+        case B_CHUNK_EXT:
+            /* chunk extensions are ignored */
+            if (c == '\r') {
+                state = B_CHUNK_SIZE_LF;
+            } else if (!is_field_char(c)) {
+                state = B_ERROR;
+            }
+            break;
+        case B_CHUNK_SIZE_LF:
+            if (c != '\n') {
+                state = B_ERROR;
+            } else if (parser->remaining == 0) {
+                state = B_TRAILER_START;
+            } else if (parser->remaining > parser->max_body - parser->received) {
+                state = B_TOO_LARGE;
+            } else {
+                parser->received += parser->remaining;
+                state = B_CHUNK_DATA;
+            }
+            break;
+        case B_CHUNK_DATA_CR:
+            state = c == '\r' ? B_CHUNK_DATA_LF : B_ERROR;
+            break;
+        case B_CHUNK_DATA_LF:
+            state = c == '\n' ? B_CHUNK_SIZE_START : B_ERROR;
+            break;
+        case B_TRAILER_START:
+            /* trailer fields are validated like header fields and then discarded */
+            if (is_tchar(c)) {
+                state = B_TRAILER_NAME;
+            } else {
+                state = c == '\r' ? B_END_LF : B_ERROR;
+            }
+            break;
+        case B_TRAILER_NAME:
+            if (c == ':') {
+                state = B_TRAILER_VALUE;
+            } else if (!is_tchar(c)) {
+                state = B_ERROR;
+            }
+            break;
+        case B_TRAILER_VALUE:
+            if (c == '\r') {
+                state = B_TRAILER_LF;
+            } else if (!is_field_char(c)) {
+                state = B_ERROR;
+            }
+            break;
+        case B_TRAILER_LF:
+            state = c == '\n' ? B_TRAILER_START : B_ERROR;
+            break;
+        case B_END_LF:
+            state = c == '\n' ? B_DONE : B_ERROR;
+            break;
+        default:
+            break;
+        }
+        i++;
+    }
+    *consumed = i;
+    parser->body_state = state;
+    switch (state) {
+    case B_DONE:
+        parser->body_state = B_NONE;
+        return 0;
+    case B_ERROR:
+        return HTTP_PARSE_ERROR;
+    case B_TOO_LARGE:
+        return HTTP_PARSE_TOO_LARGE;
+    default:
+        return HTTP_PARSE_INCOMPLETE;
+    }
+}
+
+http_response_t* http_response_create(arena_t *arena) {
+    http_response_t *res = arena_calloc(arena, sizeof(http_response_t));
+    res->arena = arena;
+    res->version = buffer_view_from_string("HTTP/1.1");
+    res->status = 200;
+    http_headers_init(&res->headers, arena);
+    return res;
+}
+
 int http_response_get_status(http_response_t *res) {
     return res->status;
 }
 
 void http_response_set_status(http_response_t *res, int status) {
+    if (status != res->status) res->preset = (buffer_view_t) {NULL, 0};
     res->status = status;
 }
 
-array_t* http_response_get_headers(http_response_t *res) {
-    return res->headers;
+http_headers_t* http_response_get_headers(http_response_t *res) {
+    return &res->headers;
 }
 
-char* http_headers_get(array_t *headers, char *key) {
-    for (size_t i = 0; i < array_size(headers); i++) {
-        http_header_t *header = array_get(headers, i);
-        if (key_equal(header->key, key) == 1) return header->value;
+buffer_view_t http_response_version(http_response_t *res) {
+    return res->version;
+}
+
+buffer_view_t http_response_get_body(http_response_t *res) {
+    return res->body;
+}
+
+void http_response_set_body(http_response_t *res, buffer_view_t body) {
+    res->body = body;
+}
+
+/* the status line after the version, rendered at compile time so it is copied as is */
+#define STATUS_LINE(code, reason) \
+    case code: return (buffer_view_t) {(uint8_t*) " " #code " " reason "\r\n", sizeof(" " #code " " reason "\r\n") - 1}
+
+static buffer_view_t status_line(int status, char *unknown) {
+    switch (status) {
+    STATUS_LINE(100, "Continue");
+    STATUS_LINE(101, "Switching Protocols");
+    STATUS_LINE(200, "OK");
+    STATUS_LINE(201, "Created");
+    STATUS_LINE(202, "Accepted");
+    STATUS_LINE(203, "Non-Authoritative Information");
+    STATUS_LINE(204, "No Content");
+    STATUS_LINE(205, "Reset Content");
+    STATUS_LINE(206, "Partial Content");
+    STATUS_LINE(300, "Multiple Choices");
+    STATUS_LINE(301, "Moved Permanently");
+    STATUS_LINE(302, "Found");
+    STATUS_LINE(303, "See Other");
+    STATUS_LINE(304, "Not Modified");
+    STATUS_LINE(305, "Use Proxy");
+    STATUS_LINE(307, "Temporary Redirect");
+    STATUS_LINE(400, "Bad Request");
+    STATUS_LINE(401, "Unauthorized");
+    STATUS_LINE(402, "Payment Required");
+    STATUS_LINE(403, "Forbidden");
+    STATUS_LINE(404, "Not Found");
+    STATUS_LINE(405, "Method Not Allowed");
+    STATUS_LINE(406, "Not Acceptable");
+    STATUS_LINE(407, "Proxy Authentication Required");
+    STATUS_LINE(408, "Request Time-out");
+    STATUS_LINE(409, "Conflict");
+    STATUS_LINE(410, "Gone");
+    STATUS_LINE(411, "Length Required");
+    STATUS_LINE(412, "Precondition Failed");
+    STATUS_LINE(413, "Request Entity Too Large");
+    STATUS_LINE(414, "URI Too Long");
+    STATUS_LINE(415, "Unsupported Media Type");
+    STATUS_LINE(416, "Range Not Satisfiable");
+    STATUS_LINE(417, "Expectation Failed");
+    STATUS_LINE(426, "Upgrade Required");
+    STATUS_LINE(431, "Request Header Fields Too Large");
+    STATUS_LINE(500, "Internal Server Error");
+    STATUS_LINE(501, "Not Implemented");
+    STATUS_LINE(502, "Bad Gateway");
+    STATUS_LINE(503, "Service Unavailable");
+    STATUS_LINE(504, "Gateway Time-out");
+    STATUS_LINE(505, "HTTP Version not supported");
+    default:
+        snprintf(unknown, HTTP_STATUS_LINE_MAX, " %03d Unknown\r\n", status % 1000);
+        return buffer_view_from_string(unknown);
     }
-    return NULL;
-}
-
-static char* string_join(char *a, char *b) {
-    size_t m = strlen(a);
-    size_t n = strlen(b);
-    char *c = realloc(a, m + n + 2);
-    assert(c != NULL && "out of memory");
-    c[m] = ',';
-    memcpy(c + m + 1, b, n);
-    return c;
-}
-
-void http_headers_set(array_t *headers, char *key, char *val) {
-    
-    /* if key already exists: join values with comma */
-    for (size_t i = 0; i < array_size(headers); i++) {
-        http_header_t *header = array_get(headers, i);
-        if (key_equal(header->key, key) == 1) {
-            header->value = string_join(header->value, val);
-        }
+}
+
+static inline void write_bytes(uint8_t *dest, size_t size, size_t *len, buffer_view_t bytes) {
+    if (dest != NULL && *len + bytes.length <= size) memcpy(dest + *len, bytes.data, bytes.length);
+    *len += bytes.length;
+}
+
+size_t http_response_write_head_to(http_response_t *res, uint8_t *dest, size_t size) {
+    char unknown[HTTP_STATUS_LINE_MAX];
+    size_t len = 0;
+    if (res->preset.length > 0) {
+        write_bytes(dest, size, &len, res->preset);
+    } else {
+        write_bytes(dest, size, &len, res->version);
+        write_bytes(dest, size, &len, status_line(res->status, unknown));
+    }
+    for (size_t i = 0; i < res->headers.size; i++) {
+        http_header_t *header = &res->headers.items[i];
+        write_bytes(dest, size, &len, header->key);
+        write_bytes(dest, size, &len, (buffer_view_t) {(uint8_t*) ": ", 2});
+        write_bytes(dest, size, &len, header->value);
+        write_bytes(dest, size, &len, (buffer_view_t) {(uint8_t*) "\r\n", 2});
     }
+    write_bytes(dest, size, &len, (buffer_view_t) {(uint8_t*) "\r\n", 2});
+    return len;
+}
 
-    /* if key does not exist: create new header */
-    http_header_t header;
-    header.key = string_copy(key);
-    header.value = string_copy(val);
-    array_add(headers, &header);
+buffer_t http_response_write_head(http_response_t *res) {
+    size_t len = http_response_write_head_to(res, NULL, 0);
+    buffer_t buf = {arena_alloc(res->arena, len), len};
+    http_response_write_head_to(res, buf.data, len);
+    return buf; 
+}
 
+http_preset_t http_response_render_preset(http_response_t *res) {
+    /* the preset is the head without the blank line which ends it */
+    buffer_t head = http_response_write_head(res);
+    return (http_preset_t) {res->status, {head.data, head.length - 2}};
 }
 
-buffer_t* http_response_get_body(http_response_t *res) {
-    return &res->body;
+void http_response_use_preset(http_response_t *res, http_preset_t preset) {
+    res->status = preset.status;
+    res->preset = preset.head;
 }
 
-void http_response_set_body(http_response_t *res, buffer_t body) {
-    if (res->body.data != NULL) buffer_destroy(res->body);
-    res->body = body;
+static const char *http_days[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+static const char *http_months[] = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+void http_date_format(time_t time, char *dest) {
+    struct tm tm;
+    char buf[64];
+    gmtime_r(&time, &tm);
+    snprintf(buf, sizeof(buf), "%s, %02d %s %04d %02d:%02d:%02d GMT", http_days[tm.tm_wday], 
+        tm.tm_mday, http_months[tm.tm_mon], tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec);
+    memcpy(dest, buf, HTTP_DATE_LENGTH);
+    dest[HTTP_DATE_LENGTH] = '\0';
 }
 
-static char* status_to_string(int status) {
-    switch (status) {
-    case 100: return "Continue";
-    case 101: return "Switching Protocols";
-    case 200: return "OK";
-    case 201: return "Created";
-    case 202: return "Accepted";
-    case 203: return "Non-Authoritative Information";
-    case 204: return "No Content";
-    case 205: return "Reset Content";
-    case 206: return "Partial Content";
-    case 300: return "Multiple Choices";
-    case 301: return "Moved Permanently";
-    case 302: return "Found";
-    case 303: return "See Other";
-    case 304: return "Not Modified";
-    case 305: return "Use Proxy";
-    case 307: return "Temporary Redirect";
-    case 400: return "Bad Request";
-    case 401: return "Unauthorized";
-    case 402: return "Payment Required";
-    case 403: return "Forbidden";
-    case 404: return "Not Found";
-    case 405: return "Method Not Allowed";
-    case 406: return "Not Acceptable";
-    case 407: return "Proxy Authentication Required";
-    case 408: return "Request Time-out";
-    case 409: return "Conflict";
-    case 410: return "Gone";
-    case 411: return "Length Required";
-    case 412: return "Precondition Failed";
-    case 413: return "Request Entity Too Large";
-    case 414: return "URI Too Long";
-    case 415: return "Unsupported Media Type";
-    case 416: return "Range Not Satisfiable";
-    case 417: return "Expectation Failed";
-    case 426: return "Upgrade Required";
-    case 500: return "Internal Server Error";
-    case 501: return "Not Implemented";
-    case 502: return "Bad Gateway";
-    case 503: return "Service Unavailable";
-    case 504: return "Gateway Time-out";
-    case 505: return "HTTP Version not supported";
-    default: return "Unknown";
+bool http_date_update(http_date_t *date, time_t now) {
+    if (date->time == now && date->value[0] != '\0') return false;
+    date->time = now;
+    http_date_format(now, date->value);
+    return true;
+}
+
+/* Parse `len` decimal digits at the start of `value`, or return -1. */
+static int parse_date_number(const uint8_t *value, size_t len) {
+    int res = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (!is_digit(value[i])) return -1;
+        res = 10 * res + value[i] - '0';
     }
+    return res;
 }
 
-buffer_t http_response_write_head(http_response_t *res) {
-    char *reason_phrase = status_to_string(res->status); 
-    size_t len = 0, head_len = 0;
-
-    /* compute response head length */
-    head_len += strlen("HTTP/1.1 200 ");
-    head_len += strlen(reason_phrase);
-    head_len += strlen("\r\n");
-    for (size_t i = 0; i < array_size(res->headers); i++) {
-        http_header_t *header = array_get(res->headers, i);
-        head_len += strlen(header->key);
-        head_len += strlen(": ");
-        head_len += strlen(header->value);
-        head_len += strlen("\r\n");
+static int parse_date_name(const uint8_t *value, const char **names, int count) {
+    for (int i = 0; i < count; i++) {
+        if (memcmp(value, names[i], 3) == 0) return i;
+    }
+    return -1;
+}
+
+int http_date_parse(buffer_view_t value, time_t *time) {
+    /* "Sun, 06 Nov 1994 08:49:37 GMT" */
+    const uint8_t *v = value.data;
+    if (value.length != HTTP_DATE_LENGTH) return -1;
+    if (v[3] != ',' || v[4] != ' ' || v[7] != ' ' || v[11] != ' ' || v[16] != ' ') return -1;
+    if (v[19] != ':' || v[22] != ':' || memcmp(v + 25, " GMT", 4) != 0) return -1;
+    struct tm tm = {0};
+    tm.tm_mday = parse_date_number(v + 5, 2);
+    tm.tm_mon = parse_date_name(v + 8, http_months, 12);
+    tm.tm_year = parse_date_number(v + 12, 4) - 1900;
+    tm.tm_hour = parse_date_number(v + 17, 2);
+    tm.tm_min = parse_date_number(v + 20, 2);
+    tm.tm_sec = parse_date_number(v + 23, 2);
+    if (parse_date_name(v, http_days, 7) < 0 || tm.tm_mday < 1 || tm.tm_mday > 31 || tm.tm_mon < 0) return -1;
+    if (tm.tm_year < 0 || tm.tm_hour < 0 || tm.tm_hour > 23 || tm.tm_min < 0 || tm.tm_min > 59) return -1;
+    if (tm.tm_sec < 0 || tm.tm_sec > 60) return -1;
+    *time = timegm(&tm);
+    return 0;
+}
+
+/* Remove the weakness indicator of an entity tag, since If-None-Match compares weakly. */
+static buffer_view_t etag_opaque(buffer_view_t etag) {
+    if (etag.length >= 2 && etag.data[0] == 'W' && etag.data[1] == '/') {
+        return (buffer_view_t) {etag.data + 2, etag.length - 2};
     }
-    head_len += strlen("\r\n");
-    
-    /* write response head */
-    buffer_t buf = buffer_create(head_len);
-    len += sprintf((char*) buf.data, "%8s %03d %s\r\n", res->version, res->status, reason_phrase);
-    for (size_t i = 0; i < array_size(res->headers); i++) {
-        http_header_t *header = array_get(res->headers, i);
-        len += sprintf((char*) buf.data + len, "%s: %s\r\n", header->key, header->value); 
+    return etag;
+}
+
+bool http_etag_match(buffer_view_t header, buffer_view_t etag) {
+    etag = etag_opaque(etag);
+    size_t i = 0;
+    while (i < header.length) {
+        uint8_t c = header.data[i];
+        if (c == ' ' || c == '\t' || c == ',') {
+            i++;
+            continue;
+        }
+        if (c == '*') return true;
+
+        /* entity-tag = [ "W/" ] DQUOTE *etagc DQUOTE */
+        size_t start = i;
+        if (c == 'W' && i + 1 < header.length && header.data[i + 1] == '/') i += 2;
+        if (i == header.length || header.data[i] != '"') return false;
+        uint8_t *end = memchr(header.data + i + 1, '"', header.length - i - 1);
+        if (end == NULL) return false;
+        i = end - header.data + 1;
+        buffer_view_t tag = etag_opaque((buffer_view_t) {header.data + start, i - start});
+        if (buffer_compare(tag, etag) == 0) return true;
     }
-    buf.data[len++] = '\r';
-    buf.data[len++] = '\n';
-    return buf; 
+    return false;
+}
+
+bool http_request_not_modified(http_request_t *req, buffer_view_t etag, time_t last_modified) {
+    buffer_view_t *if_none_match = http_request_header_id(req, HTTP_HEADER_IF_NONE_MATCH);
+    if (if_none_match != NULL) return http_etag_match(*if_none_match, etag);
+    buffer_view_t *if_modified_since = http_request_header_id(req, HTTP_HEADER_IF_MODIFIED_SINCE);
+    time_t since;
+    if (if_modified_since == NULL || http_date_parse(*if_modified_since, &since) != 0) return false;
+    return last_modified <= since;
+}
+
+/* Parse a decimal number at `*i` without overflowing, or return -1. */
+static int parse_range_number(buffer_view_t value, size_t *i, size_t *res) {
+    size_t start = *i;
+    *res = 0;
+    while (*i < value.length && is_digit(value.data[*i])) {
+        size_t digit = value.data[*i] - '0';
+        if (*res > (SIZE_MAX - digit) / 10) return -1;
+        *res = 10 * *res + digit;
+        *i += 1;
+    }
+    return *i > start ? 0 : -1;
 }
 
+int http_range_parse(buffer_view_t value, size_t size, http_range_t *ranges, size_t max) {
+    const char *unit = "bytes=";
+    if (value.length < strlen(unit) || memcmp(value.data, unit, strlen(unit)) != 0) return -1;
+    size_t i = strlen(unit), count = 0, specs = 0, total = 0;
+    while (i < value.length) {
+        uint8_t c = value.data[i];
+        if (c == ' ' || c == '\t' || c == ',') {
+            i++;
+            continue;
+        }
+
+        /* first-pos "-" [ last-pos ] or "-" suffix-length */
+        size_t first, last = SIZE_MAX;
+        bool suffix = c == '-';
+        if (!suffix && parse_range_number(value, &i, &first) != 0) return -1;
+        if (i == value.length || value.data[i] != '-') return -1;
+        i++;
+        if (suffix || (i < value.length && is_digit(value.data[i]))) {
+            if (parse_range_number(value, &i, &last) != 0) return -1;
+        }
+        if (!suffix && last < first) return -1;
+        if (++specs > max) return -1;
+
+        if (suffix) {
+            if (last == 0 || size == 0) continue;
+            first = last < size ? size - last : 0;
+            last = size - 1;
+        }
+        if (first >= size) continue;
+        if (last >= size) last = size - 1;
+        ranges[count++] = (http_range_t) {first, last - first + 1};
+
+        /* ranges which ask for more bytes than the whole representation are not worth serving */
+        total += last - first + 1;
+        if (total > size) return -1;
+    }
+    if (specs == 0) return -1;
+
+    /* sort the ranges by offset and coalesce the ones which overlap or are adjacent */
+    for (size_t j = 1; j < count; j++) {
+        http_range_t range = ranges[j];
+        size_t k = j;
+        for (; k > 0 && ranges[k - 1].offset > range.offset; k--) ranges[k] = ranges[k - 1];
+        ranges[k] = range;
+    }
+    size_t merged = 0;
+    for (size_t j = 0; j < count; j++) {
+        size_t end = ranges[j].offset + ranges[j].length;
+        size_t prev_end = merged > 0 ? ranges[merged - 1].offset + ranges[merged - 1].length : 0;
+        if (merged > 0 && ranges[j].offset <= prev_end) {
+            if (end > prev_end) ranges[merged - 1].length = end - ranges[merged - 1].offset;
+        } else {
+            ranges[merged++] = ranges[j];
+        }
+    }
+    return merged;
+}
+
+bool http_request_range_applies(http_request_t *req, buffer_view_t etag, time_t last_modified) {
+    buffer_view_t *if_range = http_request_header_id(req, HTTP_HEADER_IF_RANGE);
+    if (if_range == NULL) return true;
+    time_t date;
+    if (if_range->length > 0 && (if_range->data[0] == '"' || if_range->data[0] == 'W')) {
+        return buffer_compare(*if_range, etag) == 0;
+    }
+    return http_date_parse(*if_range, &date) == 0 && date == last_modified;
+}
+
+struct http_stream {
+    http_response_t *res;
+    http_write_cb write;
+    void *data;
+    bool chunked;
+    bool close;
+    bool started;
+    bool ended;
+    char size_line[2 * sizeof(size_t) + 3];
+};
+
+http_stream_t* http_stream_create(http_request_t *req, http_response_t *res, http_write_cb write, void *data) {
+    http_stream_t *stream = arena_calloc(res->arena, sizeof(http_stream_t));
+    stream->res = res;
+    stream->write = write;
+    stream->data = data;
+
+    /* without a length the body is delimited by chunked encoding, or by closing on HTTP/1.0 */
+    bool http_1_1 = buffer_compare(req->version, buffer_view_from_string("HTTP/1.1")) == 0;
+    buffer_view_t *connection = http_headers_get_id(&res->headers, HTTP_HEADER_CONNECTION);
+    stream->close = connection != NULL && buffer_case_compare(*connection, buffer_view_from_string("close")) == 0;
+    if (http_headers_get_id(&res->headers, HTTP_HEADER_CONTENT_LENGTH) == NULL) {
+        if (http_1_1) {
+            stream->chunked = true;
+            http_headers_set_id(&res->headers, HTTP_HEADER_TRANSFER_ENCODING, "chunked");
+        } else {
+            stream->close = true;
+            http_headers_set_id(&res->headers, HTTP_HEADER_CONNECTION, "close");
+        }
+    }
+    return stream;
+}
+
+bool http_stream_write_head(http_stream_t *stream) {
+    assert(!stream->started && "head already written");
+    stream->started = true;
+    buffer_view_t head = http_response_write_head(stream->res);
+    return stream->write(stream->data, &head, 1);
+}
+
+bool http_stream_write_chunk(http_stream_t *stream, buffer_view_t chunk) {
+    assert(stream->started && !stream->ended && "head not written or stream ended");
+    if (chunk.length == 0) return true;
+    if (!stream->chunked) return stream->write(stream->data, &chunk, 1);
+    int len = sprintf(stream->size_line, "%zx\r\n", chunk.length);
+    buffer_view_t buffers[] = {
+        {(uint8_t*) stream->size_line, len},
+        chunk,
+        buffer_view_from_string("\r\n"),
+    };
+    return stream->write(stream->data, buffers, 3);
+}
+
+bool http_stream_end(http_stream_t *stream) {
+    assert(stream->started && !stream->ended && "head not written or stream ended");
+    stream->ended = true;
+    if (!stream->chunked) return true;
+    buffer_view_t last_chunk = buffer_view_from_string("0\r\n\r\n");
+    return stream->write(stream->data, &last_chunk, 1);
+}
+
+bool http_stream_closes_connection(http_stream_t *stream) {
+    return stream->close;
+}
 
 long parse_http_response(buffer_t buffer, http_response_t *res) {
     long len, acc_len = 0; 
@@ -556,10 +1296,10 @@ long parse_http_response(buffer_t buffer, http_response_t *res) {
     acc_len += len;
     buffer_slice(buffer, len, &buffer);
 
-    res->version = buffer_to_string(version);
+    res->version = version;
     res->status = status;
 
-    len = parse_http_headers(buffer, res->headers);
+    len = parse_http_headers(buffer, &res->headers);
     if (len < 0) return len;
     acc_len += len;
     return acc_len;
@@ -0,0 +1,331 @@
+#include <http_file.h>
+#include <http.h>
+#include <path.h>
+#include <buffer.h>
+#include <arena.h>
+#include <tree_map.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define HEAD_ARENA_SIZE 1024
+
+struct http_file_entry {
+    char *path;
+    buffer_t data;
+    buffer_t head;      /* the pre-rendered status line and headers */
+    char etag[HTTP_FILE_ETAG_SIZE];
+    size_t size;
+    time_t mtime;
+    ino_t ino;
+    time_t checked;     /* the second in which the file was last found unchanged */
+    struct http_file_entry *prev;
+    struct http_file_entry *next;
+};
+
+/**
+ * Entries are indexed by path in `entries` and linked from the most recently used at `head` to
+ * the least recently used at `tail`. Removed entries are kept in the `retired` list, linked by
+ * `next`, until they are collected.
+ */
+struct http_file_cache {
+    tree_map_t *entries;
+    http_file_entry_t *head;
+    http_file_entry_t *tail;
+    http_file_entry_t *retired;
+    size_t size;
+    size_t max_size;
+    size_t max_file_size;
+};
+
+typedef struct content_type {
+    const char *extension;
+    const char *type;
+} content_type_t;
+
+static const content_type_t content_types[] = {
+    {"css", "text/css"},
+    {"gif", "image/gif"},
+    {"htm", "text/html"},
+    {"html", "text/html"},
+    {"ico", "image/x-icon"},
+    {"jpeg", "image/jpeg"},
+    {"jpg", "image/jpeg"},
+    {"js", "text/javascript"},
+    {"json", "application/json"},
+    {"mp4", "video/mp4"},
+    {"pdf", "application/pdf"},
+    {"png", "image/png"},
+    {"svg", "image/svg+xml"},
+    {"txt", "text/plain"},
+    {"wasm", "application/wasm"},
+    {"webm", "video/webm"},
+    {"webp", "image/webp"},
+    {"woff", "font/woff"},
+    {"woff2", "font/woff2"},
+    {"xml", "application/xml"},
+};
+
+/* Return true if the decoded segment would leave the directory it is in. */
+static bool is_unsafe_segment(buffer_view_t seg) {
+    if (seg.length == 1 && seg.data[0] == '.') return true;
+    if (seg.length == 2 && seg.data[0] == '.' && seg.data[1] == '.') return true;
+    return memchr(seg.data, '/', seg.length) != NULL || memchr(seg.data, '\0', seg.length) != NULL;
+}
+
+/* Append the decoded segment to dest, or return -1 if it is unsafe or does not fit. */
+static long append_segment(buffer_view_t seg, char *dest, size_t len, size_t size) {
+    if (len + 1 + seg.length >= size) return -1;
+    long decoded = path_segment_decode_to(seg, (uint8_t*) dest + len + 1);
+    if (decoded < 0 || is_unsafe_segment((buffer_view_t) {(uint8_t*) dest + len + 1, decoded})) return -1;
+    dest[len] = '/';
+    return len + 1 + decoded;
+}
+
+long http_file_path(const char *root, buffer_view_t uri, char *dest, size_t size) {
+    long path_length = parse_absolute_path(uri, NULL);
+    if (path_length < 0 || (path_length < (long) uri.length && uri.data[path_length] != '?')) return -1;
+    uri.length = path_length;
+    size_t len = strlen(root);
+    while (len > 0 && root[len - 1] == '/') len--;
+    if (len >= size) return -1;
+    memcpy(dest, root, len);
+
+    /* the path is valid, so it is a sequence of "/" followed by a segment */
+    size_t i = 1;
+    while (i <= uri.length) {
+        buffer_view_t rest = {uri.data + i, uri.length - i};
+        long seg_len = parse_path_segment(rest);
+        long res = append_segment((buffer_view_t) {rest.data, seg_len}, dest, len, size);
+        if (res < 0) return -1;
+        len = res;
+        i += seg_len + 1;
+    }
+    dest[len] = '\0';
+    return len;
+}
+
+int http_file_open(http_file_t *file, const char *path) {
+    file->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (file->fd < 0) return -1;
+    struct stat st;
+    int res = fstat(file->fd, &st);
+    if (res != 0 || !S_ISREG(st.st_mode)) {
+        int err = res != 0 ? errno : EISDIR;
+        close(file->fd);
+        file->fd = -1;
+        errno = err;
+        return -1;
+    }
+    file->size = st.st_size;
+    file->mtime = st.st_mtime;
+    file->ino = st.st_ino;
+    file->content_type = http_file_content_type(path);
+    return 0;
+}
+
+void http_file_close(http_file_t *file) {
+    if (file->fd >= 0) close(file->fd);
+    file->fd = -1;
+}
+
+const char* http_file_content_type(const char *path) {
+    const char *dot = strrchr(path, '.');
+    const char *slash = strrchr(path, '/');
+    if (dot == NULL || (slash != NULL && dot < slash)) return "application/octet-stream";
+    size_t count = sizeof(content_types) / sizeof(content_types[0]);
+    for (size_t i = 0; i < count; i++) {
+        if (strcasecmp(dot + 1, content_types[i].extension) == 0) return content_types[i].type;
+    }
+    return "application/octet-stream";
+}
+
+static int path_compare(char **a, char **b) {
+    return strcmp(*a, *b);
+}
+
+http_file_cache_t* http_file_cache_create(size_t max_size, size_t max_file_size) {
+    http_file_cache_t *cache = calloc(1, sizeof(http_file_cache_t));
+    assert(cache != NULL && "out of memory");
+    cache->entries = tree_map_create(sizeof(char*), sizeof(http_file_entry_t*), (compare_t) path_compare, NULL, NULL);
+    cache->max_size = max_size;
+    cache->max_file_size = max_file_size;
+    return cache;
+}
+
+static void entry_destroy(http_file_entry_t *entry) {
+    free(entry->path);
+    buffer_destroy(entry->data);
+    buffer_destroy(entry->head);
+    free(entry);
+}
+
+void http_file_cache_destroy(http_file_cache_t *cache) {
+    http_file_cache_collect(cache);
+    http_file_entry_t *entry = cache->head;
+    while (entry != NULL) {
+        http_file_entry_t *next = entry->next;
+        entry_destroy(entry);
+        entry = next;
+    }
+    tree_map_destroy(cache->entries);
+    free(cache);
+}
+
+static void list_unlink(http_file_cache_t *cache, http_file_entry_t *entry) {
+    if (entry->prev != NULL) entry->prev->next = entry->next;
+    else cache->head = entry->next;
+    if (entry->next != NULL) entry->next->prev = entry->prev;
+    else cache->tail = entry->prev;
+}
+
+static void list_push_front(http_file_cache_t *cache, http_file_entry_t *entry) {
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head != NULL) cache->head->prev = entry;
+    else cache->tail = entry;
+    cache->head = entry;
+}
+
+/* Remove the entry from the cache. It is freed by the next http_file_cache_collect. */
+static void cache_retire(http_file_cache_t *cache, http_file_entry_t *entry) {
+    tree_map_remove(cache->entries, &entry->path);
+    list_unlink(cache, entry);
+    cache->size -= entry->data.length;
+    entry->next = cache->retired;
+    cache->retired = entry;
+}
+
+size_t http_file_etag(http_file_t *file, char *dest) {
+    return snprintf(dest, HTTP_FILE_ETAG_SIZE, "\"%lx-%zx-%llx\"", (unsigned long) file->ino, file->size, 
+        (unsigned long long) file->mtime);
+}
+
+/* Render the head of every response which serves the file. */
+static buffer_t render_head(http_file_t *file, const char *etag) {
+    arena_t *arena = arena_create(HEAD_ARENA_SIZE);
+    http_response_t *res = http_response_create(arena);
+    http_headers_t *headers = http_response_get_headers(res);
+    char length[24], modified[HTTP_DATE_LENGTH + 1];
+    snprintf(length, sizeof(length), "%zu", file->size);
+    http_date_format(file->mtime, modified);
+    http_headers_set_id(headers, HTTP_HEADER_CONTENT_LENGTH, length);
+    http_headers_set_id(headers, HTTP_HEADER_CONTENT_TYPE, (char*) file->content_type);
+    http_headers_set_id(headers, HTTP_HEADER_LAST_MODIFIED, modified);
+    http_headers_set_id(headers, HTTP_HEADER_ETAG, (char*) etag);
+    http_headers_set_id(headers, HTTP_HEADER_ACCEPT_RANGES, "bytes");
+    http_preset_t preset = http_response_render_preset(res);
+    buffer_t head = buffer_copy(preset.head);
+    arena_destroy(arena);
+    return head;
+}
+
+/* Read the whole file into a new entry, or return NULL if it could not be read. */
+static http_file_entry_t* entry_load(const char *path, http_file_t *file, time_t now) {
+    buffer_t data = buffer_create(file->size);
+    size_t nread = 0;
+    while (nread < file->size) {
+        ssize_t n = pread(file->fd, data.data + nread, file->size - nread, nread);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            /* the file was truncated while it was read */
+            if (n == 0) errno = EIO;
+            buffer_destroy(data);
+            return NULL;
+        }
+        nread += n;
+    }
+
+    http_file_entry_t *entry = calloc(1, sizeof(http_file_entry_t));
+    assert(entry != NULL && "out of memory");
+    entry->path = strdup(path);
+    assert(entry->path != NULL && "out of memory");
+    entry->data = data;
+    http_file_etag(file, entry->etag);
+    entry->head = render_head(file, entry->etag);
+    entry->size = file->size;
+    entry->mtime = file->mtime;
+    entry->ino = file->ino;
+    entry->checked = now;
+    return entry;
+}
+
+/* Return true if the file at the path of the entry is still the one it holds. */
+static bool entry_valid(http_file_entry_t *entry, time_t now) {
+    if (entry->checked == now) return true;
+    struct stat st;
+    if (stat(entry->path, &st) != 0 || !S_ISREG(st.st_mode)) return false;
+    if ((size_t) st.st_size != entry->size || st.st_mtime != entry->mtime || st.st_ino != entry->ino) {
+        return false;
+    }
+    entry->checked = now;
+    return true;
+}
+
+http_file_entry_t* http_file_cache_get(http_file_cache_t *cache, const char *path, time_t now, http_file_t *file) {
+    file->fd = -1;
+    http_file_entry_t **found = tree_map_get(cache->entries, &path);
+    if (found != NULL) {
+        http_file_entry_t *entry = *found;
+        if (entry_valid(entry, now)) {
+            list_unlink(cache, entry);
+            list_push_front(cache, entry);
+            return entry;
+        }
+        cache_retire(cache, entry);
+    }
+
+    if (http_file_open(file, path) != 0) return NULL;
+    if (file->size > cache->max_file_size || file->size > cache->max_size) return NULL;
+    http_file_entry_t *entry = entry_load(path, file, now);
+    int err = errno;
+    http_file_close(file);
+    if (entry == NULL) {
+        errno = err;
+        return NULL;
+    }
+
+    tree_map_set(cache->entries, &entry->path, &entry);
+    list_push_front(cache, entry);
+    cache->size += entry->data.length;
+    while (cache->size > cache->max_size) {
+        cache_retire(cache, cache->tail);
+    }
+    return entry;
+}
+
+void http_file_cache_collect(http_file_cache_t *cache) {
+    while (cache->retired != NULL) {
+        http_file_entry_t *next = cache->retired->next;
+        entry_destroy(cache->retired);
+        cache->retired = next;
+    }
+}
+
+size_t http_file_cache_size(http_file_cache_t *cache) {
+    return cache->size;
+}
+
+http_preset_t http_file_entry_head(http_file_entry_t *entry) {
+    return (http_preset_t) {200, entry->head};
+}
+
+buffer_view_t http_file_entry_data(http_file_entry_t *entry) {
+    return entry->data;
+}
+
+const char* http_file_entry_etag(http_file_entry_t *entry) {
+    return entry->etag;
+}
+
+time_t http_file_entry_mtime(http_file_entry_t *entry) {
+    return entry->mtime;
+}
@@ -0,0 +1,308 @@
+#include <http_scan.h>
+
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HTTP_SCAN_X86
+#endif
+
+#define IS_RANGE(c, lo, hi) ((c) >= (lo) && (c) <= (hi))
+#define IS_DIGIT(c) IS_RANGE(c, '0', '9')
+#define IS_ALPHA(c) (IS_RANGE(c, 'a', 'z') || IS_RANGE(c, 'A', 'Z'))
+#define IS_HEX(c) (IS_DIGIT(c) || IS_RANGE(c, 'a', 'f') || IS_RANGE(c, 'A', 'F'))
+#define IS_TCHAR(c) (IS_DIGIT(c) || IS_ALPHA(c) || \
+    (c) == '!' || (c) == '#' || (c) == '$' || (c) == '%' || (c) == '&' || (c) == '\'' || \
+    (c) == '*' || (c) == '+' || (c) == '-' || (c) == '.' || (c) == '^' || (c) == '_' || \
+    (c) == '`' || (c) == '|' || (c) == '~')
+#define IS_SUB_DELIM(c) ((c) == '!' || (c) == '$' || (c) == '&' || (c) == '\'' || (c) == '(' || \
+    (c) == ')' || (c) == '*' || (c) == '+' || (c) == ',' || (c) == ';' || (c) == '=')
+#define IS_PATH(c) (IS_DIGIT(c) || IS_ALPHA(c) || IS_SUB_DELIM(c) || \
+    (c) == '-' || (c) == '.' || (c) == '_' || (c) == '~' || (c) == ':' || (c) == '@' || (c) == '/')
+#define IS_PCHAR(c) (IS_PATH(c) && (c) != '/')
+#define IS_RESERVED(c) (IS_SUB_DELIM(c) || (c) == ':' || (c) == '/' || (c) == '?' || (c) == '#' || \
+    (c) == '[' || (c) == ']' || (c) == '@')
+
+#define CLASS(c) ( \
+    (IS_TCHAR(c) ? HTTP_CHAR_TCHAR : 0) | \
+    (IS_RANGE(c, 0x21, 0x7E) ? HTTP_CHAR_VCHAR : 0) | \
+    ((c) == ' ' || (c) == '\t' ? HTTP_CHAR_SPACE : 0) | \
+    ((c) >= 0x80 ? HTTP_CHAR_OBS_TEXT : 0) | \
+    (IS_DIGIT(c) ? HTTP_CHAR_DIGIT : 0) | \
+    (IS_HEX(c) ? HTTP_CHAR_HEX : 0) | \
+    (IS_PATH(c) ? HTTP_CHAR_PATH : 0))
+#define CLASS4(c) CLASS(c), CLASS((c) + 1), CLASS((c) + 2), CLASS((c) + 3)
+#define CLASS16(c) CLASS4(c), CLASS4((c) + 4), CLASS4((c) + 8), CLASS4((c) + 12)
+#define CLASS64(c) CLASS16(c), CLASS16((c) + 16), CLASS16((c) + 32), CLASS16((c) + 48)
+
+const uint8_t http_char_class[256] = {
+    CLASS64(0x00), CLASS64(0x40), CLASS64(0x80), CLASS64(0xC0)
+};
+
+/*
+ * Each byte is split into nibbles. Entry `lo` of a set's table has bit `hi` set when the byte
+ * (hi << 4 | lo) is in the set, and nibble_hi_table maps `hi` to that bit, so a byte is in the
+ * set when the two entries share a bit. Only ASCII bytes can be in a set. The tables are repeated
+ * for each 128-bit lane.
+ */
+#define NIBBLE_BITS(is, lo) ( \
+    (is((lo) + 0x00) ? 0x01 : 0) | (is((lo) + 0x10) ? 0x02 : 0) | (is((lo) + 0x20) ? 0x04 : 0) | \
+    (is((lo) + 0x30) ? 0x08 : 0) | (is((lo) + 0x40) ? 0x10 : 0) | (is((lo) + 0x50) ? 0x20 : 0) | \
+    (is((lo) + 0x60) ? 0x40 : 0) | (is((lo) + 0x70) ? 0x80 : 0))
+#define NIBBLE_BITS4(is, lo) NIBBLE_BITS(is, lo), NIBBLE_BITS(is, (lo) + 1), \
+    NIBBLE_BITS(is, (lo) + 2), NIBBLE_BITS(is, (lo) + 3)
+#define NIBBLE_TABLE(is) NIBBLE_BITS4(is, 0), NIBBLE_BITS4(is, 4), NIBBLE_BITS4(is, 8), NIBBLE_BITS4(is, 12)
+#define NIBBLE_HI 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0, 0, 0, 0, 0, 0, 0, 0
+
+static const uint8_t nibble_hi_table[32] = {NIBBLE_HI, NIBBLE_HI};
+static const uint8_t pchar_lo_table[32] = {NIBBLE_TABLE(IS_PCHAR), NIBBLE_TABLE(IS_PCHAR)};
+static const uint8_t reserved_lo_table[32] = {NIBBLE_TABLE(IS_RESERVED), NIBBLE_TABLE(IS_RESERVED)};
+
+#define IN_NIBBLE_SET(lo_table, c) ((lo_table)[(c) & 0x0f] & nibble_hi_table[(c) >> 4])
+
+static size_t scan_token_portable(const uint8_t *data, size_t length) {
+    size_t i = 0;
+    while (i < length && (http_char_class[data[i]] & HTTP_CHAR_TCHAR)) i++;
+    return i;
+}
+
+static size_t scan_field_portable(const uint8_t *data, size_t length) {
+    size_t i = 0;
+    while (i < length && (http_char_class[data[i]] & HTTP_CHAR_FIELD)) i++;
+    return i;
+}
+
+static size_t scan_pchar_portable(const uint8_t *data, size_t length) {
+    size_t i = 0;
+    while (i < length && IN_NIBBLE_SET(pchar_lo_table, data[i])) i++;
+    return i;
+}
+
+static size_t scan_reserved_portable(const uint8_t *data, size_t length) {
+    size_t i = 0;
+    while (i < length && !IN_NIBBLE_SET(reserved_lo_table, data[i])) i++;
+    return i;
+}
+
+#ifdef HTTP_SCAN_X86
+
+/* 
+ * pcmpestri can match at most eight ranges, which is not enough for the token characters. These
+ * ranges cover every delimiter and also '|' and '~', so each match is confirmed with the table.
+ */
+static const char token_ranges[16] = "\x00 \"\"(),,//:@[]{\xff";
+static const char field_ranges[16] = "\x00\x08\x0a\x1f\x7f\x7f";
+
+__attribute__((target("sse4.2")))
+static size_t scan_token_sse42(const uint8_t *data, size_t length) {
+    __m128i ranges = _mm_loadu_si128((const __m128i*) token_ranges);
+    size_t i = 0;
+    while (i + 16 <= length) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*) (data + i));
+        int index = _mm_cmpestri(ranges, 16, chunk, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES);
+        if (index == 16) {
+            i += 16;
+            continue;
+        }
+        i += index;
+        if (!(http_char_class[data[i]] & HTTP_CHAR_TCHAR)) return i;
+        i++;
+    }
+    return i + scan_token_portable(data + i, length - i);
+}
+
+__attribute__((target("sse4.2")))
+static size_t scan_field_sse42(const uint8_t *data, size_t length) {
+    __m128i ranges = _mm_loadu_si128((const __m128i*) field_ranges);
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*) (data + i));
+        int index = _mm_cmpestri(ranges, 6, chunk, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES);
+        if (index != 16) return i + index;
+    }
+    return i + scan_field_portable(data + i, length - i);
+}
+
+/* Return a mask of the bytes of the chunk which are not in the set of the nibble table. */
+__attribute__((target("sse4.2")))
+static inline uint32_t nibble_miss_sse42(__m128i chunk, __m128i lo_table) {
+    const __m128i hi_table = _mm_loadu_si128((const __m128i*) nibble_hi_table);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    __m128i lo = _mm_and_si128(chunk, nibble);
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(chunk, 4), nibble);
+    __m128i bits = _mm_and_si128(_mm_shuffle_epi8(lo_table, lo), _mm_shuffle_epi8(hi_table, hi));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(bits, _mm_setzero_si128()));
+}
+
+__attribute__((target("sse4.2")))
+static size_t scan_pchar_sse42(const uint8_t *data, size_t length) {
+    const __m128i lo_table = _mm_loadu_si128((const __m128i*) pchar_lo_table);
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        uint32_t mask = nibble_miss_sse42(_mm_loadu_si128((const __m128i*) (data + i)), lo_table);
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+    return i + scan_pchar_portable(data + i, length - i);
+}
+
+__attribute__((target("sse4.2")))
+static size_t scan_reserved_sse42(const uint8_t *data, size_t length) {
+    const __m128i lo_table = _mm_loadu_si128((const __m128i*) reserved_lo_table);
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        uint32_t mask = nibble_miss_sse42(_mm_loadu_si128((const __m128i*) (data + i)), lo_table) ^ 0xffff;
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+    return i + scan_reserved_portable(data + i, length - i);
+}
+
+/*
+ * Each byte is split into nibbles. Entry `lo` of the first table has bit `hi` set when the byte
+ * (hi << 4 | lo) is a token character, and the second table maps `hi` to that bit. Both tables
+ * are repeated for each 128-bit lane.
+ */
+#define TOKEN_LO_NIBBLES \
+    0xe8, 0xfc, 0xf8, 0xfc, 0xfc, 0xfc, 0xfc, 0xfc, 0xf8, 0xf8, 0xf4, 0x54, 0xd0, 0x54, 0xf4, 0x70
+#define TOKEN_HI_NIBBLES \
+    0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0, 0, 0, 0, 0, 0, 0, 0
+
+static const uint8_t token_lo_table[32] = {TOKEN_LO_NIBBLES, TOKEN_LO_NIBBLES};
+static const uint8_t token_hi_table[32] = {TOKEN_HI_NIBBLES, TOKEN_HI_NIBBLES};
+
+__attribute__((target("avx2")))
+static size_t scan_token_avx2(const uint8_t *data, size_t length) {
+    const __m256i lo_table = _mm256_loadu_si256((const __m256i*) token_lo_table);
+    const __m256i hi_table = _mm256_loadu_si256((const __m256i*) token_hi_table);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*) (data + i));
+        __m256i lo = _mm256_and_si256(chunk, nibble);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(chunk, 4), nibble);
+        __m256i bits = _mm256_and_si256(_mm256_shuffle_epi8(lo_table, lo), _mm256_shuffle_epi8(hi_table, hi));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(bits, _mm256_setzero_si256()));
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+    return i + scan_token_portable(data + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_field_avx2(const uint8_t *data, size_t length) {
+    const __m256i ctl = _mm256_set1_epi8(0x1f);
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*) (data + i));
+        __m256i is_ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(chunk, ctl), chunk);
+        __m256i is_tab = _mm256_cmpeq_epi8(chunk, tab);
+        __m256i is_del = _mm256_cmpeq_epi8(chunk, del);
+        __m256i invalid = _mm256_or_si256(_mm256_andnot_si256(is_tab, is_ctl), is_del);
+        uint32_t mask = _mm256_movemask_epi8(invalid);
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+    return i + scan_field_portable(data + i, length - i);
+}
+
+/* Return a mask of the bytes of the chunk which are not in the set of the nibble table. */
+__attribute__((target("avx2")))
+static inline uint32_t nibble_miss_avx2(__m256i chunk, __m256i lo_table) {
+    const __m256i hi_table = _mm256_loadu_si256((const __m256i*) nibble_hi_table);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_and_si256(chunk, nibble);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(chunk, 4), nibble);
+    __m256i bits = _mm256_and_si256(_mm256_shuffle_epi8(lo_table, lo), _mm256_shuffle_epi8(hi_table, hi));
+    return _mm256_movemask_epi8(_mm256_cmpeq_epi8(bits, _mm256_setzero_si256()));
+}
+
+__attribute__((target("avx2")))
+static size_t scan_pchar_avx2(const uint8_t *data, size_t length) {
+    const __m256i lo_table = _mm256_loadu_si256((const __m256i*) pchar_lo_table);
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        uint32_t mask = nibble_miss_avx2(_mm256_loadu_si256((const __m256i*) (data + i)), lo_table);
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+    return i + scan_pchar_portable(data + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_reserved_avx2(const uint8_t *data, size_t length) {
+    const __m256i lo_table = _mm256_loadu_si256((const __m256i*) reserved_lo_table);
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        uint32_t mask = ~nibble_miss_avx2(_mm256_loadu_si256((const __m256i*) (data + i)), lo_table);
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+    return i + scan_reserved_portable(data + i, length - i);
+}
+
+#endif /* HTTP_SCAN_X86 */
+
+static http_scan_impl_t scan_impl = HTTP_SCAN_PORTABLE;
+static size_t (*scan_token)(const uint8_t*, size_t) = scan_token_portable;
+static size_t (*scan_field)(const uint8_t*, size_t) = scan_field_portable;
+static size_t (*scan_pchar)(const uint8_t*, size_t) = scan_pchar_portable;
+static size_t (*scan_reserved)(const uint8_t*, size_t) = scan_reserved_portable;
+
+size_t http_scan_token(const uint8_t *data, size_t length) {
+    return scan_token(data, length);
+}
+
+size_t http_scan_field(const uint8_t *data, size_t length) {
+    return scan_field(data, length);
+}
+
+size_t http_scan_pchar(const uint8_t *data, size_t length) {
+    return scan_pchar(data, length);
+}
+
+size_t http_scan_reserved(const uint8_t *data, size_t length) {
+    return scan_reserved(data, length);
+}
+
+http_scan_impl_t http_scan_get_impl() {
+    return scan_impl;
+}
+
+int http_scan_set_impl(http_scan_impl_t impl) {
+    switch (impl) {
+    case HTTP_SCAN_PORTABLE:
+        scan_token = scan_token_portable;
+        scan_field = scan_field_portable;
+        scan_pchar = scan_pchar_portable;
+        scan_reserved = scan_reserved_portable;
+        break;
+#ifdef HTTP_SCAN_X86
+    case HTTP_SCAN_SSE42:
+        if (!__builtin_cpu_supports("sse4.2")) return -1;
+        scan_token = scan_token_sse42;
+        scan_field = scan_field_sse42;
+        scan_pchar = scan_pchar_sse42;
+        scan_reserved = scan_reserved_sse42;
+        break;
+    case HTTP_SCAN_AVX2:
+        if (!__builtin_cpu_supports("avx2")) return -1;
+        scan_token = scan_token_avx2;
+        scan_field = scan_field_avx2;
+        scan_pchar = scan_pchar_avx2;
+        scan_reserved = scan_reserved_avx2;
+        break;
+#endif
+    default:
+        return -1;
+    }
+    scan_impl = impl;
+    return 0;
+}
+
+__attribute__((constructor))
+static void http_scan_init() {
+#ifdef HTTP_SCAN_X86
+    __builtin_cpu_init();
+#endif
+    if (http_scan_set_impl(HTTP_SCAN_AVX2) != 0 && http_scan_set_impl(HTTP_SCAN_SSE42) != 0) {
+        http_scan_set_impl(HTTP_SCAN_PORTABLE);
+    }
+}
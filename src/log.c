@@ -7,14 +7,18 @@
 void print_log(char *file, int line, char *fmt, ...) {
     time_t now;
     time(&now);
-    struct tm *local = gmtime(&now);
+    struct tm tm;
+    struct tm *local = gmtime_r(&now, &tm);
     int h = local->tm_hour;
     int m = local->tm_min;
     int s = local->tm_sec;
+    flockfile(stdout);
     printf("%02d:%02d:%02d %s:%d ", h, m, s, file, line);
     va_list args;
     va_start(args, fmt);
     vprintf(fmt, args);
+    va_end(args);
     printf("\n");
+    funlockfile(stdout);
 }
 
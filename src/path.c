@@ -1,5 +1,8 @@
 #include <path.h>
+#include <http_scan.h>
 #include <ctype.h>
+#include <stdbool.h>
+#include <string.h>
 
 /**
  * Return 1 if the character `c` is unreserved, as defined in rfc3986. Unreserved characters
@@ -96,6 +99,19 @@ long parse_absolute_path(buffer_view_t buf, array_t *segments) {
     return acc;
 }
 
+long parse_query(buffer_view_t buf) {
+    if (buf.length == 0 || buf.data[0] != '?') return 0;
+    long acc = 0;
+    while (buf.length > 0) {
+        long len = buf.data[0] == '/' || buf.data[0] == '?' ? 1 : parse_path_segment(buf);
+        if (len < 0) return len;
+        else if (len == 0) break;
+        buffer_slice(buf, len, &buf);
+        acc += len;
+    }
+    return acc;
+}
+
 long parse_path_segment(buffer_view_t buf) {
     long acc = 0;
     for (size_t i = 0; buf.length > 0; i++) {
@@ -109,49 +125,176 @@ long parse_path_segment(buffer_view_t buf) {
     return acc;
 }
 
+size_t path_segment_encode_to(buffer_view_t seg, uint8_t *dest) {
+    size_t i = 0;
+    size_t j = 0;
+    while (i < seg.length) {
+        size_t run = http_scan_reserved(seg.data + i, seg.length - i);
+        memcpy(dest + j, seg.data + i, run);
+        i += run;
+        j += run;
+        if (i == seg.length) break;
+        char c = seg.data[i++];
+        dest[j] = '%';
+        dest[j + 1] = char_to_hex(c >> 4);
+        dest[j + 2] = char_to_hex(c & 0x0f);
+        j += 3;
+    }
+    return j;
+}
+
 int path_segment_encode(buffer_t buf, buffer_t *res) {
     if (buf.data == NULL) return -1;
     if (res == NULL) return -1;
-    size_t n_encoded = 0;
-    for (size_t i = 0; i < buf.length; i++) {
-        if (is_reserved(buf.data[i])) n_encoded++;
-    }
-    *res = buffer_create(buf.length + 2 * n_encoded);
+    *res = buffer_create(3 * buf.length);
+    size_t length = path_segment_encode_to(buf, res->data);
+    if (length < res->length) buffer_resize(res, length);
+    return 0;
+}
+
+static int hex_value(uint8_t c) {
+    return c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+}
+
+long path_segment_decode_to(buffer_view_t seg, uint8_t *dest) {
+    size_t i = 0;
     size_t j = 0;
-    for (size_t i = 0; i < buf.length; i++) {
-        char c = buf.data[i];
-        if (is_reserved(c)) {
-            res->data[j] = '%';
-            res->data[j + 1] = char_to_hex(c >> 4);
-            res->data[j + 2] = char_to_hex(c & 0x0f);
-            j += 3;
-        } else {
-            res->data[j] = c;
-            j += 1;
-        }
+    while (i < seg.length) {
+        size_t run = http_scan_pchar(seg.data + i, seg.length - i);
+        if (dest + j != seg.data + i) memmove(dest + j, seg.data + i, run);
+        i += run;
+        j += run;
+        if (i == seg.length) break;
+        if (seg.data[i] != '%' || i + 2 >= seg.length) return -1;
+        uint8_t c1 = seg.data[i + 1];
+        uint8_t c2 = seg.data[i + 2];
+        if (!(http_char_class[c1] & HTTP_CHAR_HEX) || !(http_char_class[c2] & HTTP_CHAR_HEX)) return -1;
+        dest[j++] = hex_value(c1) << 4 | hex_value(c2);
+        i += 3;
     }
-    return 0;
+    return j;
 }
 
 int path_segment_decode(buffer_t buf, buffer_t *res) {
     if (buf.data == NULL) return -1;
     if (res == NULL) return -1;
-    size_t n_encoded = 0;
-    for (size_t i = 0; i < buf.length; i++) {
-        if (buf.data[i] == '%') n_encoded++;
-    }
-    *res = buffer_create(buf.length - 2 * n_encoded);
-    for (size_t i = 0; buf.length > 0; i++) {
-        char c;
-        long len = parse_pchar(buf, &c);
-        if (len <= 0) return -1;
-        buffer_slice(buf, len, &buf);
-        res->data[i] = c;
+    *res = buffer_create(buf.length);
+    long length = path_segment_decode_to(buf, res->data);
+    if (length < 0) {
+        buffer_destroy(*res);
+        *res = (buffer_t) {NULL, 0};
+        return -1;
     }
+    res->data[length] = '\0';
+    res->length = length;
     return 0;
 }
 
-int path_normalize(buffer_t path, buffer_t *res) {
-    return -1;
+/**
+ * The state of path_normalize. Until the result first differs from the input it is a prefix of
+ * the input, so nothing is written and `out` points to the input. Once it differs, the prefix is
+ * copied to the destination and `out` points there instead.
+ */
+typedef struct normalizer {
+    buffer_view_t path;
+    buffer_t dest;
+    uint8_t *out;
+    size_t length;
+} normalizer_t;
+
+/* Switch from the input to the destination before the result differs from the input. */
+static int normalizer_diverge(normalizer_t *n) {
+    if (n->out == n->dest.data) return 0;
+    if (n->dest.length < n->path.length) return -1;
+    memcpy(n->dest.data, n->path.data, n->length);
+    n->out = n->dest.data;
+    return 0;
+}
+
+static void normalizer_emit(normalizer_t *n, uint8_t c) {
+    if (n->out == n->dest.data) n->out[n->length] = c;
+    n->length++;
+}
+
+/* Remove the last segment and the '/' in front of it, if any, from the result. */
+static void normalizer_pop(normalizer_t *n) {
+    while (n->length > 0 && n->out[n->length - 1] != '/') n->length--;
+    if (n->length > 0) n->length--;
+}
+
+/* Append the segment with normalized percent-encoding and return its length in the result. */
+static long normalize_segment(normalizer_t *n, buffer_view_t seg) {
+    size_t start = n->length;
+    size_t i = 0;
+    while (i < seg.length) {
+        size_t run = http_scan_pchar(seg.data + i, seg.length - i);
+        if (n->out == n->dest.data) memcpy(n->out + n->length, seg.data + i, run);
+        n->length += run;
+        i += run;
+        if (i == seg.length) break;
+
+        char decoded;
+        if (parse_percent_encoded((buffer_view_t) {seg.data + i, seg.length - i}, &decoded) != 3) return -1;
+        char c1 = seg.data[i + 1];
+        char c2 = seg.data[i + 2];
+        if (is_unreserved(decoded)) {
+            if (normalizer_diverge(n) != 0) return -1;
+            normalizer_emit(n, decoded);
+        } else {
+            if ((islower(c1) || islower(c2)) && normalizer_diverge(n) != 0) return -1;
+            normalizer_emit(n, '%');
+            normalizer_emit(n, toupper(c1));
+            normalizer_emit(n, toupper(c2));
+        }
+        i += 3;
+    }
+    return n->length - start;
+}
+
+static bool is_dot_segment(uint8_t *seg, size_t len, size_t dots) {
+    return len == dots && seg[0] == '.' && (dots == 1 || seg[1] == '.');
+}
+
+int path_normalize(buffer_view_t path, buffer_t dest, buffer_view_t *res) {
+    normalizer_t n = {path, dest, path.data, 0};
+    if (path.length == 0) {
+        *res = path;
+        return 0;
+    }
+
+    /*
+     * The path is a sequence of segments, each preceded by a '/' apart from the first one of a
+     * relative path. Each segment is appended to the result as it is normalized, and dot segments
+     * are then removed again as in rfc3986 section 5.2.4.
+     */
+    bool slash = path.length > 0 && path.data[0] == '/';
+    size_t i = slash ? 1 : 0;
+    while (i <= path.length) {
+        uint8_t *end = memchr(path.data + i, '/', path.length - i);
+        buffer_view_t seg = {path.data + i, end != NULL ? (size_t) (end - path.data) - i : path.length - i};
+        bool last = end == NULL;
+        if (slash) normalizer_emit(&n, '/');
+        long len = normalize_segment(&n, seg);
+        if (len < 0) return -1;
+
+        uint8_t *normal = n.out + n.length - len;
+        bool dot = is_dot_segment(normal, len, 1);
+        bool dot_dot = is_dot_segment(normal, len, 2);
+        if (dot || dot_dot) {
+            if (normalizer_diverge(&n) != 0) return -1;
+            n.length -= len + (slash ? 1 : 0);
+            if (dot_dot && slash) normalizer_pop(&n);
+
+            /* a dot segment at the end leaves the '/' in front of it, and one at the start of a relative path the '/' after it */
+            if (slash && last) normalizer_emit(&n, '/');
+        } else {
+            slash = true;
+        }
+        if (last) break;
+        i += seg.length + 1;
+    }
+
+    *res = (buffer_view_t) {n.out, n.length};
+    return 0;
 }
 
@@ -0,0 +1,252 @@
+#include <router.h>
+#include <path.h>
+#include <array.h>
+#include <buffer.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define NONE UINT32_MAX
+
+typedef struct route {
+    char *pattern;
+    void *data;
+    size_t param_count;
+    buffer_view_t names[ROUTER_MAX_PARAMS];     /* views into the pattern */
+} route_t;
+
+/* A node of the trie while routes are added. Labels are views into the patterns of the routes. */
+typedef struct build_node {
+    buffer_view_t label;
+    array_t *children;          /* the literal children */
+    struct build_node *param;
+    uint32_t route;             /* the route which ends at the node */
+    uint32_t wildcard;          /* the route which captures the rest of the path below the node */
+} build_node_t;
+
+/* A node of the compiled trie. The literal children of a node are sorted by label. */
+typedef struct router_node {
+    const uint8_t *label;
+    uint32_t label_length;
+    uint32_t children;          /* the index of the first literal child */
+    uint32_t child_count;
+    uint32_t param;
+    uint32_t route;
+    uint32_t wildcard;
+} router_node_t;
+
+struct router {
+    array_t *routes;
+    build_node_t *root;
+    size_t node_count;
+    router_node_t *nodes;       /* the compiled trie, with the root first */
+    bool compiled;
+};
+
+static build_node_t* build_node_create(router_t *router, buffer_view_t label) {
+    build_node_t *node = malloc(sizeof(build_node_t));
+    assert(node != NULL && "out of memory");
+    node->label = label;
+    node->children = array_create(sizeof(build_node_t*), 1);
+    node->param = NULL;
+    node->route = NONE;
+    node->wildcard = NONE;
+    router->node_count++;
+    return node;
+}
+
+static void build_node_destroy(build_node_t *node) {
+    if (node == NULL) return;
+    build_node_t **children = array_data(node->children);
+    for (size_t i = 0; i < array_size(node->children); i++) {
+        build_node_destroy(children[i]);
+    }
+    array_destroy(node->children, NULL);
+    build_node_destroy(node->param);
+    free(node);
+}
+
+static void route_destroy(route_t *route) {
+    free(route->pattern);
+}
+
+router_t* router_create(void) {
+    router_t *router = calloc(1, sizeof(router_t));
+    assert(router != NULL && "out of memory");
+    router->routes = array_create(sizeof(route_t), 16);
+    router->root = build_node_create(router, (buffer_view_t) {NULL, 0});
+    return router;
+}
+
+void router_destroy(router_t *router) {
+    build_node_destroy(router->root);
+    array_destroy(router->routes, (destroy_t) route_destroy);
+    free(router->nodes);
+    free(router);
+}
+
+/* Return the length of the segment at the start of str, which ends at a '/' or the end. */
+static size_t segment_length(const char *str) {
+    const char *slash = strchr(str, '/');
+    return slash != NULL ? (size_t) (slash - str) : strlen(str);
+}
+
+/* Check that the pattern of the route is valid and store the names of its parameters. */
+static int parse_pattern(route_t *route) {
+    char *pattern = route->pattern;
+    size_t length = strlen(pattern);
+    if (length == 0 || pattern[0] != '/') return -1;
+    for (size_t i = 1; i <= length; i += segment_length(pattern + i) + 1) {
+        buffer_view_t seg = {(uint8_t*) pattern + i, segment_length(pattern + i)};
+        if (parse_path_segment(seg) != (long) seg.length) return -1;
+        if (seg.length == 0 || (seg.data[0] != ':' && seg.data[0] != '*')) continue;
+        if (seg.data[0] == ':' && seg.length == 1) return -1;
+        if (seg.data[0] == '*' && i + seg.length != length) return -1;
+        if (route->param_count == ROUTER_MAX_PARAMS) return -1;
+        route->names[route->param_count++] = (buffer_view_t) {seg.data + 1, seg.length - 1};
+    }
+    return 0;
+}
+
+static build_node_t* literal_child(router_t *router, build_node_t *node, buffer_view_t label) {
+    build_node_t **children = array_data(node->children);
+    for (size_t i = 0; i < array_size(node->children); i++) {
+        if (buffer_compare(children[i]->label, label) == 0) return children[i];
+    }
+    build_node_t *child = build_node_create(router, label);
+    array_add(node->children, &child);
+    return child;
+}
+
+int router_add(router_t *router, const char *pattern, void *data) {
+    route_t route = {strdup(pattern), data, 0};
+    assert(route.pattern != NULL && "out of memory");
+    if (parse_pattern(&route) != 0) {
+        route_destroy(&route);
+        return -1;
+    }
+
+    /* the pattern is valid, so it is a sequence of "/" followed by a segment */
+    build_node_t *node = router->root;
+    uint32_t *slot = &node->route;
+    size_t length = strlen(route.pattern);
+    for (size_t i = 1; i <= length; i += segment_length(route.pattern + i) + 1) {
+        buffer_view_t seg = {(uint8_t*) route.pattern + i, segment_length(route.pattern + i)};
+        if (seg.length > 0 && seg.data[0] == '*') {
+            slot = &node->wildcard;
+            break;
+        }
+        if (seg.length > 0 && seg.data[0] == ':') {
+            if (node->param == NULL) node->param = build_node_create(router, (buffer_view_t) {NULL, 0});
+            node = node->param;
+        } else {
+            node = literal_child(router, node, seg);
+        }
+        slot = &node->route;
+    }
+    if (*slot != NONE) {
+        route_destroy(&route);
+        return -2;
+    }
+    *slot = array_size(router->routes);
+    array_add(router->routes, &route);
+    router->compiled = false;
+    return 0;
+}
+
+static int compare_labels(build_node_t **a, build_node_t **b) {
+    return buffer_compare((*a)->label, (*b)->label);
+}
+
+/* Store the node at `index` and lay out its children from `*next` onwards. */
+static void compile_node(router_t *router, build_node_t *build, uint32_t index, uint32_t *next) {
+    router_node_t *node = &router->nodes[index];
+    size_t count = array_size(build->children);
+    build_node_t **children = array_data(build->children);
+    qsort(children, count, sizeof(build_node_t*), (int (*)(const void*, const void*)) compare_labels);
+    node->label = build->label.data;
+    node->label_length = build->label.length;
+    node->children = *next;
+    node->child_count = count;
+    *next += count;
+    node->param = build->param != NULL ? (*next)++ : NONE;
+    node->route = build->route;
+    node->wildcard = build->wildcard;
+    for (size_t i = 0; i < count; i++) {
+        compile_node(router, children[i], node->children + i, next);
+    }
+    if (build->param != NULL) compile_node(router, build->param, node->param, next);
+}
+
+void router_compile(router_t *router) {
+    free(router->nodes);
+    router->nodes = malloc(router->node_count * sizeof(router_node_t));
+    assert(router->nodes != NULL && "out of memory");
+    uint32_t next = 1;
+    compile_node(router, router->root, 0, &next);
+    router->compiled = true;
+}
+
+static router_node_t* find_child(router_t *router, router_node_t *node, buffer_view_t seg) {
+    size_t low = node->children;
+    size_t high = node->children + node->child_count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        router_node_t *child = &router->nodes[mid];
+        int cmp = buffer_compare((buffer_view_t) {(uint8_t*) child->label, child->label_length}, seg);
+        if (cmp == 0) return child;
+        if (cmp < 0) low = mid + 1;
+        else high = mid;
+    }
+    return NULL;
+}
+
+static bool match_route(router_t *router, uint32_t index, router_match_t *match) {
+    route_t *route = array_get(router->routes, index);
+    match->data = route->data;
+    match->names = route->names;
+    return true;
+}
+
+/* Match the rest of the path, which is empty or starts with a '/', below the node. */
+static bool match_node(router_t *router, router_node_t *node, buffer_view_t path, router_match_t *match) {
+    if (path.length == 0) {
+        return node->route != NONE && match_route(router, node->route, match);
+    }
+    buffer_view_t rest = {path.data + 1, path.length - 1};
+    uint8_t *slash = memchr(rest.data, '/', rest.length);
+    buffer_view_t seg = {rest.data, slash != NULL ? (size_t) (slash - rest.data) : rest.length};
+    buffer_view_t next = {rest.data + seg.length, rest.length - seg.length};
+
+    router_node_t *child = find_child(router, node, seg);
+    if (child != NULL && match_node(router, child, next, match)) return true;
+    if (node->param != NONE && seg.length > 0) {
+        match->params[match->param_count++] = seg;
+        if (match_node(router, &router->nodes[node->param], next, match)) return true;
+        match->param_count--;
+    }
+    if (node->wildcard != NONE) {
+        match->params[match->param_count++] = rest;
+        return match_route(router, node->wildcard, match);
+    }
+    return false;
+}
+
+bool router_match(router_t *router, buffer_view_t path, router_match_t *match) {
+    assert(router->compiled && "router_compile must be called after router_add");
+    match->data = NULL;
+    match->param_count = 0;
+    match->names = NULL;
+    if (parse_absolute_path(path, NULL) != (long) path.length) return false;
+    return match_node(router, &router->nodes[0], path, match);
+}
+
+buffer_view_t* router_match_param(router_match_t *match, const char *name) {
+    buffer_view_t key = buffer_view_from_string(name);
+    for (size_t i = 0; i < match->param_count; i++) {
+        if (buffer_compare(match->names[i], key) == 0) return &match->params[i];
+    }
+    return NULL;
+}
@@ -1,9 +1,13 @@
 #include <tcp.h>
 #include <array.h>
+#include <write_queue.h>
+#include <hash_map.h>
 #include <log.h>
 
 #include <netinet/in.h>
-#include <poll.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <assert.h>
@@ -11,71 +15,162 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
 
 #define DEFAULT_CLIENT_CAPACITY 16
-#define DEFAULT_CHUNK_SIZE 1024
+#define DEFAULT_CHUNK_SIZE (16 * 1024)
+#define DEFAULT_EVENT_CAPACITY 64
+#define DEFAULT_TIMER_CAPACITY 16
+#define DEFAULT_LOW_WATERMARK (16 * 1024)
+#define DEFAULT_HIGH_WATERMARK (64 * 1024)
+#define TCP_IOV_MAX 64
+
+typedef struct tcp_timer {
+    uint64_t deadline;
+    uint64_t id;
+    tcp_timer_cb cb;
+    void *data;
+} tcp_timer_t;
 
 typedef struct tcp_server {
     int listen_fd;
-    array_t *fds;
+    int epoll_fd;
+    int wake_fd;
+    atomic_bool stopped;
     array_t *clients;
+    array_t *closed;
+    array_t *timers;
+    hash_map_t *timer_index;        /* the heap index of each pending timer by id */
+    uint64_t next_timer_id;
+    size_t worker;
+    void *data;
     tcp_error_cb on_error;
     tcp_connect_cb on_connect;
     tcp_close_cb on_close;
     tcp_read_cb on_read;
-    bool closed;
+    tcp_drain_cb on_drain;
+    size_t low_watermark;
+    size_t high_watermark;
 } tcp_server_t;
 
+typedef struct tcp_cluster {
+    tcp_server_t **workers;
+    pthread_t *threads;
+    size_t size;
+} tcp_cluster_t;
+
 typedef struct tcp_client {
     struct sockaddr_in addr;
     int fd;
+    size_t index;
     void *data;
+    write_queue_t *queue;
+    bool writing;
+    bool draining;
+    bool ending;
     bool closed;
 } tcp_client_t ;
 
 tcp_client_t *tcp_client_create(struct sockaddr_in addr, int fd) {
    tcp_client_t *res = calloc(1, sizeof(tcp_client_t));
+   assert(res != NULL && "out of memory");
    res->addr = addr;
    res->fd = fd;
+   res->queue = write_queue_create();
    return res;
 }
 
+static void tcp_client_destroy(tcp_client_t *client) {
+    write_queue_destroy(client->queue);
+    free(client);
+}
+
 tcp_server_t* tcp_server_create(tcp_connect_cb on_connect, tcp_close_cb on_close, tcp_read_cb on_read, tcp_error_cb on_error) {
-    tcp_server_t *server = calloc(1, sizeof(tcp_server_t));
     assert(on_connect != NULL);
     assert(on_close != NULL);
     assert(on_read != NULL);
     assert(on_error != NULL);
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) return NULL;
+    int wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) {
+        close(epoll_fd);
+        return NULL;
+    }
+    tcp_server_t *server = calloc(1, sizeof(tcp_server_t));
+    assert(server != NULL && "out of memory");
+    struct epoll_event event = {0};
+    event.events = EPOLLIN | EPOLLET;
+    event.data.ptr = &server->wake_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event) != 0) {
+        close(wake_fd);
+        close(epoll_fd);
+        free(server);
+        return NULL;
+    }
     server->listen_fd = -1;
-    server->fds = array_create(sizeof(struct pollfd), 1 + DEFAULT_CLIENT_CAPACITY);
+    server->epoll_fd = epoll_fd;
+    server->wake_fd = wake_fd;
+    atomic_init(&server->stopped, false);
     server->clients = array_create(sizeof(tcp_client_t*), DEFAULT_CLIENT_CAPACITY);
+    server->closed = array_create(sizeof(tcp_client_t*), DEFAULT_CLIENT_CAPACITY);
+    server->timers = array_create(sizeof(tcp_timer_t), DEFAULT_TIMER_CAPACITY);
+    server->timer_index = hash_map_create(sizeof(uint64_t), sizeof(size_t), NULL, NULL, NULL, NULL);
+    server->next_timer_id = 1;
     server->on_connect = on_connect;
     server->on_close = on_close;
     server->on_read = on_read;
     server->on_error = on_error;
+    server->low_watermark = DEFAULT_LOW_WATERMARK;
+    server->high_watermark = DEFAULT_HIGH_WATERMARK;
     return server;
 }
 
-static tcp_client_t* get_client(tcp_server_t *server, int i) {
+static tcp_client_t* get_client(tcp_server_t *server, size_t i) {
     return *(tcp_client_t**) array_get(server->clients, i);
 }
 
-static void add_client(tcp_server_t *server, tcp_client_t *client) {
-    array_add(server->fds, &(struct pollfd){client->fd, POLLIN, 0});
+/**
+ * Register the client with the epoll instance and add it to the client table. The client is
+ * registered once in edge-triggered mode, so it is never touched again by the event loop
+ * until the kernel reports new data on its file descriptor.
+ */
+static int add_client(tcp_server_t *server, tcp_client_t *client) {
+    struct epoll_event event = {0};
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = client;
+    int res = epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, client->fd, &event);
+    if (res != 0) return -1;
+    client->index = array_size(server->clients);
     array_add(server->clients, &client);
+    return 0;
 }
 
-static void remove_client(tcp_server_t *server, int i) {
-    array_remove(server->fds, i + 1);
-    array_remove(server->clients, i);
+/**
+ * Deregister the client from the epoll instance and remove it from the client table in
+ * constant time by moving the last client into its slot.
+ */
+static void remove_client(tcp_server_t *server, tcp_client_t *client) {
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    size_t last = array_size(server->clients) - 1;
+    if (client->index != last) {
+        tcp_client_t *moved = get_client(server, last);
+        moved->index = client->index;
+        *(tcp_client_t**) array_get(server->clients, client->index) = moved;
+    }
+    array_remove(server->clients, last);
 }
 
-static void remove_closed_clients(tcp_server_t *server) {
-    for (size_t i = 0; i < array_size(server->clients); i++) {
-        tcp_client_t *client = get_client(server, i);
-        if (client->closed) {
-            remove_client(server, i--);
-        }
+static void free_closed_clients(tcp_server_t *server) {
+    while (array_size(server->closed) > 0) {
+        size_t last = array_size(server->closed) - 1;
+        tcp_client_destroy(*(tcp_client_t**) array_get(server->closed, last));
+        array_remove(server->closed, last);
     }
 }
 
@@ -101,7 +196,7 @@ int tcp_server_listen(tcp_server_t *server, int port, int backlog) {
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
     server_addr.sin_port = htons(port);
-  
+
     socklen_t in_addr_size = sizeof(struct sockaddr_in);
 
     res = bind(listen_fd, (struct sockaddr*) &server_addr, in_addr_size);
@@ -112,69 +207,397 @@ int tcp_server_listen(tcp_server_t *server, int port, int backlog) {
 
     res = listen(listen_fd, backlog);
     if (res != 0) {
-        close(server->listen_fd);
+        close(listen_fd);
+        return -1;
+    }
+
+    struct epoll_event event = {0};
+    event.events = EPOLLIN | EPOLLET;
+    event.data.ptr = &server->listen_fd;
+    res = epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+    if (res != 0) {
+        close(listen_fd);
         return -1;
     }
 
-    array_add(server->fds, &(struct pollfd){listen_fd, POLLIN, 0});
     server->listen_fd = listen_fd;
     return 0;
 }
 
 void tcp_server_destroy(tcp_server_t *server) {
     assert(server != NULL);
-    for (size_t i = 0; i < array_size(server->clients); i++) {
-        tcp_client_t *client = get_client(server, i);
-        close(client->fd);
-        server->on_close(server, client);
+    while (array_size(server->clients) > 0) {
+        tcp_server_close_client(server, get_client(server, 0));
     }
+    free_closed_clients(server);
     array_destroy(server->clients, NULL);
-    array_destroy(server->fds, NULL);
+    array_destroy(server->closed, NULL);
+    array_destroy(server->timers, NULL);
+    hash_map_destroy(server->timer_index);
+    if (server->listen_fd >= 0) close(server->listen_fd);
+    close(server->wake_fd);
+    close(server->epoll_fd);
+    free(server);
 }
 
-int tcp_server_poll(tcp_server_t *server) {
-    assert(server != NULL);
-    
-    if (server->closed) {
-        remove_closed_clients(server);
-        server->closed = false;
-    }
-
-    int res = poll(array_data(server->fds), array_size(server->fds), 0);
-    if (res <= 0) return res;
-    for (size_t i = 0; i < array_size(server->fds); i++) {
-        struct pollfd *fdi = array_get(server->fds, i);
-        if (fdi->revents == 0) continue;
-        if (fdi->fd == server->listen_fd) {
-            struct sockaddr_in client_addr = {0};
-            socklen_t in_addr_size = sizeof(struct sockaddr_in);
-            int client_fd = accept(server->listen_fd, (struct sockaddr*) &client_addr, &in_addr_size);
-            if (client_fd < 0) {
-                log(strerror(errno));
-            } else {
-                tcp_client_t *client = tcp_client_create(client_addr, client_fd);
-                fcntl(client_fd, F_SETFL, O_NONBLOCK);
-                add_client(server, client);
-                server->on_connect(server, client);
-            }
-        } else {
-            tcp_client_t *client = get_client(server, i - 1);
-            if (client->closed) continue;
-            uint8_t chunk[DEFAULT_CHUNK_SIZE] = {0};
-            ssize_t nread = read(fdi->fd, chunk, DEFAULT_CHUNK_SIZE);
-            if (nread < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+/**
+ * Accept every pending connection. The listening socket is edge-triggered, so the backlog
+ * must be drained until accept reports EAGAIN.
+ */
+static void server_accept(tcp_server_t *server) {
+    while (1) {
+        struct sockaddr_in client_addr = {0};
+        socklen_t in_addr_size = sizeof(struct sockaddr_in);
+        int client_fd = accept4(server->listen_fd, (struct sockaddr*) &client_addr, &in_addr_size, SOCK_NONBLOCK);
+        if (client_fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) log(strerror(errno));
+            return;
+        }
+        tcp_client_t *client = tcp_client_create(client_addr, client_fd);
+        if (add_client(server, client) != 0) {
+            log(strerror(errno));
+            close(client_fd);
+            tcp_client_destroy(client);
+            continue;
+        }
+        server->on_connect(server, client);
+    }
+}
+
+/**
+ * Read from the client until the socket is drained. The client is edge-triggered, so no
+ * further events are reported for data that is left unread.
+ */
+static void client_read(tcp_server_t *server, tcp_client_t *client) {
+    while (!client->closed) {
+        uint8_t chunk[DEFAULT_CHUNK_SIZE];
+        ssize_t nread = read(client->fd, chunk, DEFAULT_CHUNK_SIZE);
+        if (nread < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
                 server->on_error(server, client, errno);
                 tcp_server_close_client(server, client);
-            } else if (nread == 0) {
-                tcp_server_close_client(server, client);
-            } else {
-                server->on_read(server, client, (buffer_t){chunk, nread});
             }
+            return;
+        } else if (nread == 0) {
+            tcp_server_close_client(server, client);
+            return;
+        } else if (!client->ending) {
+            server->on_read(server, client, (buffer_t){chunk, nread});
+        }
+    }
+}
+
+/**
+ * Register or deregister interest in EPOLLOUT for the client. Write readiness is only
+ * requested while the client has queued data, so idle clients never generate write events.
+ */
+static int client_set_writing(tcp_server_t *server, tcp_client_t *client, bool writing) {
+    if (client->writing == writing) return 0;
+    struct epoll_event event = {0};
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLET | (writing ? EPOLLOUT: 0);
+    event.data.ptr = client;
+    int res = epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, client->fd, &event);
+    if (res != 0) return -1;
+    client->writing = writing;
+    return 0;
+}
+
+/**
+ * Flush the client's write queue after the socket has become writable. Call on_drain once the
+ * queue falls to the low watermark after a write exceeded the high watermark, and complete a
+ * pending tcp_server_end_client once the queue is empty.
+ */
+static void client_write(tcp_server_t *server, tcp_client_t *client) {
+    while (write_queue_size(client->queue) > 0) {
+        ssize_t nwritten = write_queue_flush(client->queue, client->fd);
+        if (nwritten < 0) {
+            server->on_error(server, client, errno);
+            tcp_server_close_client(server, client);
+            return;
+        }
+        if (nwritten == 0) break;
+    }
+
+    size_t queued = write_queue_size(client->queue);
+    if (queued == 0 && client->ending) {
+        tcp_server_close_client(server, client);
+        return;
+    }
+    if (queued == 0 && client_set_writing(server, client, false) != 0) {
+        server->on_error(server, client, errno);
+        tcp_server_close_client(server, client);
+        return;
+    }
+    if (client->draining && queued <= server->low_watermark) {
+        client->draining = false;
+        if (server->on_drain) server->on_drain(server, client);
+    }
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static tcp_timer_t* get_timer(tcp_server_t *server, size_t i) {
+    return array_get(server->timers, i);
+}
+
+static bool timer_before(tcp_timer_t *a, tcp_timer_t *b) {
+    return a->deadline < b->deadline || (a->deadline == b->deadline && a->id < b->id);
+}
+
+/* Record that the timer at index i of the heap is there. */
+static void timer_place(tcp_server_t *server, size_t i) {
+    *(size_t*) hash_map_get(server->timer_index, &get_timer(server, i)->id) = i;
+}
+
+static void timer_swap(tcp_server_t *server, size_t i, size_t j) {
+    tcp_timer_t tmp = *get_timer(server, i);
+    *get_timer(server, i) = *get_timer(server, j);
+    *get_timer(server, j) = tmp;
+    timer_place(server, i);
+    timer_place(server, j);
+}
+
+static void timer_sift_up(tcp_server_t *server, size_t i) {
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!timer_before(get_timer(server, i), get_timer(server, parent))) return;
+        timer_swap(server, i, parent);
+        i = parent;
+    }
+}
+
+static void timer_sift_down(tcp_server_t *server, size_t i) {
+    size_t n = array_size(server->timers);
+    while (1) {
+        size_t min = i, l = 2 * i + 1, r = 2 * i + 2;
+        if (l < n && timer_before(get_timer(server, l), get_timer(server, min))) min = l;
+        if (r < n && timer_before(get_timer(server, r), get_timer(server, min))) min = r;
+        if (min == i) return;
+        timer_swap(server, i, min);
+        i = min;
+    }
+}
+
+/**
+ * Remove the ith timer from the timer heap by replacing it with the last timer and restoring
+ * the heap property.
+ */
+static void timer_remove(tcp_server_t *server, size_t i) {
+    size_t last = array_size(server->timers) - 1;
+    hash_map_remove(server->timer_index, &get_timer(server, i)->id);
+    if (i != last) {
+        *get_timer(server, i) = *get_timer(server, last);
+        timer_place(server, i);
+    }
+    array_remove(server->timers, last);
+    if (i < last) {
+        timer_sift_down(server, i);
+        timer_sift_up(server, i);
+    }
+}
+
+uint64_t tcp_server_set_timeout(tcp_server_t *server, int timeout, tcp_timer_cb cb, void *data) {
+    assert(server != NULL);
+    assert(cb != NULL);
+    assert(timeout >= 0);
+    tcp_timer_t timer = {now_ns() + (uint64_t) timeout * 1000000, server->next_timer_id++, cb, data};
+    array_add(server->timers, &timer);
+    hash_map_set(server->timer_index, &timer.id, &(size_t){array_size(server->timers) - 1});
+    timer_sift_up(server, array_size(server->timers) - 1);
+    return timer.id;
+}
+
+void tcp_server_clear_timeout(tcp_server_t *server, uint64_t id) {
+    assert(server != NULL);
+    size_t *i = hash_map_get(server->timer_index, &id);
+    if (i != NULL) timer_remove(server, *i);
+}
+
+/**
+ * Return the number of milliseconds until the earliest timer expires, or -1 if there are no
+ * pending timers.
+ */
+static int next_timeout(tcp_server_t *server) {
+    if (array_size(server->timers) == 0) return -1;
+    uint64_t deadline = get_timer(server, 0)->deadline;
+    uint64_t now = now_ns();
+    if (deadline <= now) return 0;
+    uint64_t timeout = (deadline - now + 999999) / 1000000;
+    return timeout > INT32_MAX ? INT32_MAX : (int) timeout;
+}
+
+/**
+ * Run every timer that has expired. Timers that are scheduled by a callback are deferred to
+ * the next call, even if they are already due, so a timer cannot starve the event loop.
+ */
+static void run_timers(tcp_server_t *server) {
+    uint64_t now = now_ns();
+    uint64_t limit = server->next_timer_id;
+    while (array_size(server->timers) > 0) {
+        tcp_timer_t timer = *get_timer(server, 0);
+        if (timer.deadline > now || timer.id >= limit) return;
+        timer_remove(server, 0);
+        timer.cb(server, timer.data);
+    }
+}
+
+int tcp_server_poll_timeout(tcp_server_t *server, int timeout) {
+    assert(server != NULL);
+
+    int timer_timeout = next_timeout(server);
+    if (timeout < 0 || (timer_timeout >= 0 && timer_timeout < timeout)) {
+        timeout = timer_timeout;
+    }
+    if (atomic_load(&server->stopped)) timeout = 0;
+
+    struct epoll_event events[DEFAULT_EVENT_CAPACITY];
+    int n = epoll_wait(server->epoll_fd, events, DEFAULT_EVENT_CAPACITY, timeout);
+    if (n < 0 && errno != EINTR) return -1;
+    for (int i = 0; i < n; i++) {
+        if (events[i].data.ptr == &server->listen_fd) {
+            server_accept(server);
+            continue;
+        }
+        if (events[i].data.ptr == &server->wake_fd) {
+            uint64_t count;
+            while (read(server->wake_fd, &count, sizeof(count)) > 0);
+            continue;
+        }
+        tcp_client_t *client = events[i].data.ptr;
+        if (!client->closed && (events[i].events & EPOLLOUT)) {
+            client_write(server, client);
+        }
+        if (!client->closed && (events[i].events & ~EPOLLOUT)) {
+            client_read(server, client);
+        }
+    }
+
+    /* clients closed during this batch may still be referenced by later events */
+    free_closed_clients(server);
+    run_timers(server);
+    return 0;
+}
+
+int tcp_server_poll(tcp_server_t *server) {
+    return tcp_server_poll_timeout(server, 0);
+}
+
+int tcp_server_run(tcp_server_t *server) {
+    assert(server != NULL);
+    while (!atomic_load(&server->stopped)) {
+        int res = tcp_server_poll_timeout(server, -1);
+        if (res != 0) return res;
+    }
+    atomic_store(&server->stopped, false);
+    return 0;
+}
+
+void tcp_server_stop(tcp_server_t *server) {
+    atomic_store(&server->stopped, true);
+    tcp_server_wakeup(server);
+}
+
+void tcp_server_wakeup(tcp_server_t *server) {
+    uint64_t one = 1;
+    ssize_t res = write(server->wake_fd, &one, sizeof(one));
+    (void) res;
+}
+
+size_t tcp_server_worker(tcp_server_t *server) {
+    return server->worker;
+}
+
+void tcp_server_set_data(tcp_server_t *server, void *data) {
+    server->data = data;
+}
+
+void* tcp_server_data(tcp_server_t *server) {
+    return server->data;
+}
+
+tcp_cluster_t* tcp_cluster_create(size_t size, tcp_connect_cb on_connect, tcp_close_cb on_close, tcp_read_cb on_read, tcp_error_cb on_error) {
+    assert(size > 0);
+    tcp_cluster_t *cluster = calloc(1, sizeof(tcp_cluster_t));
+    assert(cluster != NULL && "out of memory");
+    cluster->workers = calloc(size, sizeof(tcp_server_t*));
+    cluster->threads = calloc(size, sizeof(pthread_t));
+    assert(cluster->workers != NULL && cluster->threads != NULL && "out of memory");
+    for (size_t i = 0; i < size; i++) {
+        tcp_server_t *worker = tcp_server_create(on_connect, on_close, on_read, on_error);
+        if (worker == NULL) {
+            tcp_cluster_destroy(cluster);
+            return NULL;
         }
+        worker->worker = i;
+        cluster->workers[i] = worker;
+        cluster->size += 1;
+    }
+    return cluster;
+}
+
+void tcp_cluster_destroy(tcp_cluster_t *cluster) {
+    assert(cluster != NULL);
+    for (size_t i = 0; i < cluster->size; i++) {
+        tcp_server_destroy(cluster->workers[i]);
+    }
+    free(cluster->workers);
+    free(cluster->threads);
+    free(cluster);
+}
+
+int tcp_cluster_listen(tcp_cluster_t *cluster, int port, int backlog) {
+    for (size_t i = 0; i < cluster->size; i++) {
+        int res = tcp_server_listen(cluster->workers[i], port, backlog);
+        if (res != 0) return res;
     }
     return 0;
 }
 
+static void* worker_run(void *arg) {
+    tcp_server_t *worker = arg;
+    if (tcp_server_run(worker) != 0) {
+        log("worker %zu: %s", worker->worker, strerror(errno));
+    }
+    return NULL;
+}
+
+int tcp_cluster_run(tcp_cluster_t *cluster) {
+    size_t started = 0;
+    int res = 0;
+    for (; started < cluster->size; started++) {
+        res = pthread_create(&cluster->threads[started], NULL, worker_run, cluster->workers[started]);
+        if (res != 0) {
+            errno = res;
+            tcp_cluster_stop(cluster);
+            break;
+        }
+    }
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(cluster->threads[i], NULL);
+    }
+    return res == 0 ? 0: -1;
+}
+
+void tcp_cluster_stop(tcp_cluster_t *cluster) {
+    for (size_t i = 0; i < cluster->size; i++) {
+        tcp_server_stop(cluster->workers[i]);
+    }
+}
+
+size_t tcp_cluster_size(tcp_cluster_t *cluster) {
+    return cluster->size;
+}
+
+tcp_server_t* tcp_cluster_worker(tcp_cluster_t *cluster, size_t i) {
+    assert(i < cluster->size);
+    return cluster->workers[i];
+}
+
 struct sockaddr_in tcp_client_addr(tcp_client_t *client) {
 	return client->addr;
 }
@@ -191,9 +614,193 @@ int tcp_client_fd(tcp_client_t *self) {
     return self->fd;
 }
 
+size_t tcp_client_queue_size(tcp_client_t *self) {
+    return write_queue_size(self->queue);
+}
+
+bool tcp_client_closed(tcp_client_t *self) {
+    return self->closed;
+}
+
+void tcp_server_on_drain(tcp_server_t *server, tcp_drain_cb on_drain) {
+    server->on_drain = on_drain;
+}
+
+void tcp_server_set_watermarks(tcp_server_t *server, size_t low, size_t high) {
+    assert(low <= high);
+    server->low_watermark = low;
+    server->high_watermark = high;
+}
+
+/**
+ * Write directly to the socket while nothing is queued. Return the number of bytes written or
+ * -1 if an error other than EAGAIN occurs.
+ */
+static ssize_t client_send(tcp_client_t *client, buffer_view_t buffer) {
+    if (write_queue_size(client->queue) > 0) return 0;
+    size_t acc = 0;
+    while (acc < buffer.length) {
+        ssize_t nwritten = send(client->fd, buffer.data + acc, buffer.length - acc, MSG_NOSIGNAL);
+        if (nwritten < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
+        }
+        acc += nwritten;
+    }
+    return acc;
+}
+
+/**
+ * Send as much of the buffers as possible with sendmsg, at most TCP_IOV_MAX buffers per call.
+ * Like client_send, nothing is sent while data is already queued.
+ */
+static ssize_t client_sendv(tcp_client_t *client, const buffer_view_t *buffers, size_t count) {
+    if (write_queue_size(client->queue) > 0) return 0;
+    struct iovec iov[TCP_IOV_MAX];
+    size_t acc = 0, skip = 0, i = 0;
+    while (i < count) {
+        size_t n = 0, total = 0;
+        for (size_t j = i; j < count && n < TCP_IOV_MAX; j++) {
+            size_t offset = j == i ? skip : 0;
+            iov[n].iov_base = buffers[j].data + offset;
+            iov[n].iov_len = buffers[j].length - offset;
+            total += iov[n++].iov_len;
+        }
+        struct msghdr msg = {.msg_iov = iov, .msg_iovlen = n};
+        ssize_t nwritten = sendmsg(client->fd, &msg, MSG_NOSIGNAL);
+        if (nwritten < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
+        }
+        acc += nwritten;
+
+        /* advance past the buffers which were written completely */
+        size_t remaining = nwritten + skip;
+        while (i < count && remaining >= buffers[i].length) {
+            remaining -= buffers[i++].length;
+        }
+        skip = remaining;
+        if ((size_t) nwritten < total) break;
+    }
+    return acc;
+}
+
+/**
+ * Send as much of the file range as possible with sendfile. Like client_send, nothing is sent
+ * while data is already queued.
+ */
+static ssize_t client_sendfile(tcp_client_t *client, int fd, off_t offset, size_t length) {
+    if (write_queue_size(client->queue) > 0) return 0;
+    size_t acc = 0;
+    while (acc < length) {
+        ssize_t nwritten = sendfile(client->fd, fd, &offset, length - acc);
+        if (nwritten < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
+        }
+        if (nwritten == 0) {
+            /* the file is shorter than the range */
+            errno = EIO;
+            return -1;
+        }
+        acc += nwritten;
+    }
+    return acc;
+}
+
+/**
+ * Complete a write after `nwritten` bytes were sent directly and the rest was queued.
+ */
+static bool client_queued(tcp_server_t *server, tcp_client_t *client, ssize_t nwritten) {
+    if (nwritten < 0) {
+        server->on_error(server, client, errno);
+        tcp_server_close_client(server, client);
+        return false;
+    }
+    if (write_queue_size(client->queue) > 0 && client_set_writing(server, client, true) != 0) {
+        server->on_error(server, client, errno);
+        tcp_server_close_client(server, client);
+        return false;
+    }
+    if (write_queue_size(client->queue) > server->high_watermark) {
+        client->draining = true;
+        return false;
+    }
+    return true;
+}
+
+bool tcp_server_write(tcp_server_t *server, tcp_client_t *client, buffer_view_t buffer) {
+    if (client->closed || client->ending) return false;
+    ssize_t nwritten = client_send(client, buffer);
+    if (nwritten >= 0 && (size_t) nwritten < buffer.length) {
+        write_queue_push_copy(client->queue, (buffer_view_t){buffer.data + nwritten, buffer.length - nwritten});
+    }
+    return client_queued(server, client, nwritten);
+}
+
+bool tcp_server_writev(tcp_server_t *server, tcp_client_t *client, const buffer_view_t *buffers, size_t count) {
+    if (client->closed || client->ending) return false;
+    ssize_t nwritten = client_sendv(client, buffers, count);
+    if (nwritten >= 0) {
+        size_t skip = nwritten;
+        for (size_t i = 0; i < count; i++) {
+            if (skip >= buffers[i].length) {
+                skip -= buffers[i].length;
+                continue;
+            }
+            write_queue_push_copy(client->queue, (buffer_view_t){buffers[i].data + skip, buffers[i].length - skip});
+            skip = 0;
+        }
+    }
+    return client_queued(server, client, nwritten);
+}
+
+bool tcp_server_write_buffer(tcp_server_t *server, tcp_client_t *client, buffer_t buffer) {
+    if (client->closed || client->ending) {
+        buffer_destroy(buffer);
+        return false;
+    }
+    ssize_t nwritten = client_send(client, buffer);
+    if (nwritten >= 0) {
+        write_queue_push(client->queue, buffer, nwritten);
+    } else {
+        buffer_destroy(buffer);
+    }
+    return client_queued(server, client, nwritten);
+}
+
+bool tcp_server_sendfile(tcp_server_t *server, tcp_client_t *client, int fd, off_t offset, size_t length) {
+    if (client->closed || client->ending) return false;
+    ssize_t nwritten = client_sendfile(client, fd, offset, length);
+    if (nwritten >= 0 && (size_t) nwritten < length) {
+        /* the queue closes its descriptor once the rest of the range has been sent */
+        int queued_fd = dup(fd);
+        if (queued_fd >= 0) {
+            write_queue_push_file(client->queue, queued_fd, offset + nwritten, length - nwritten);
+        } else {
+            nwritten = -1;
+        }
+    }
+    return client_queued(server, client, nwritten);
+}
+
+void tcp_server_end_client(tcp_server_t *server, tcp_client_t *client) {
+    if (client->closed) return;
+    if (write_queue_size(client->queue) == 0) {
+        tcp_server_close_client(server, client);
+    } else {
+        client->ending = true;
+    }
+}
+
 void tcp_server_close_client(tcp_server_t *server, tcp_client_t *self) {
+    if (self->closed) return;
+    remove_client(server, self);
     close(self->fd);
     server->on_close(server, self);
     self->closed = true;
-    server->closed = true;
+    array_add(server->closed, &self);
 }
@@ -1,8 +1,10 @@
 #include <tcp_socket.h>
+#include <write_queue.h>
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
+#include <assert.h>
 
 #include <netinet/in.h>
 #include <sys/socket.h>
@@ -17,9 +19,12 @@ typedef struct tcp_socket {
     int fd;
     tcp_socket_handler_t handler;
     struct sockaddr_in remote_addr;
+    write_queue_t *queue;
     int connected;
     int open_read;
     int open_write;
+    int ending;
+    int corked;
 } tcp_socket_t;
 
 tcp_socket_t *tcp_socket_create(tcp_socket_handler_t handler) {
@@ -45,8 +50,10 @@ tcp_socket_t *tcp_socket_create(tcp_socket_handler_t handler) {
     }
 
     tcp_socket_t *sock = calloc(1, sizeof(tcp_socket_t));
+    assert(sock != NULL && "out of memory");
     sock->fd = fd;
     sock->handler = handler;
+    sock->queue = write_queue_create();
     return sock;
 }
 
@@ -64,59 +71,167 @@ int tcp_socket_connect(tcp_socket_t *sock, char *host, int port) {
     return 0;
 }
 
-int tcp_socket_poll(tcp_socket_t *sock) {
-    
+static void socket_close(tcp_socket_t *sock) {
+    close(sock->fd);
+    sock->fd = -1;
+    sock->open_read = 0;
+    sock->open_write = 0;
+    sock->handler.on_close(sock);
+}
+
+/* Report an error which leaves the socket unusable, then drop the unsent data and close it. */
+static void socket_fail(tcp_socket_t *sock, int errnum) {
+    sock->handler.on_error(sock, errnum);
+    write_queue_destroy(sock->queue);
+    sock->queue = write_queue_create();
+    sock->ending = 0;
+    socket_close(sock);
+}
+
+static void socket_shutdown(tcp_socket_t *sock) {
+    if (sock->open_write == 1) {
+        shutdown(sock->fd, SHUT_WR);
+        sock->open_write = 0;
+    }
+    if (sock->open_read == 0) {
+        socket_close(sock);
+    }
+}
+
+/**
+ * Flush the write queue with writev-style calls until it is empty or the socket would block.
+ * Call on_drain once the queue is empty and complete a pending tcp_socket_end. If a write
+ * fails, report the error and close the socket, so it is not polled for writing again.
+ */
+static void socket_flush(tcp_socket_t *sock) {
+    if (write_queue_size(sock->queue) == 0) return;
+    while (write_queue_size(sock->queue) > 0) {
+        ssize_t nwritten = write_queue_flush(sock->queue, sock->fd);
+        if (nwritten < 0) {
+            socket_fail(sock, errno);
+            return;
+        }
+        if (nwritten == 0) return;
+    }
+    if (sock->handler.on_drain) sock->handler.on_drain(sock);
+    if (sock->ending && sock->fd >= 0) {
+        sock->ending = 0;
+        socket_shutdown(sock);
+    }
+}
+
+bool tcp_socket_write(tcp_socket_t *sock, buffer_view_t buffer) {
+    if (sock->fd < 0 || (sock->connected && !sock->open_write) || sock->ending) return false;
+
+    /* append to pending data so that consecutive writes are flushed together */
+    if (!sock->connected || sock->corked || write_queue_size(sock->queue) > 0) {
+        write_queue_push_copy(sock->queue, buffer);
+        return buffer.length == 0;
+    }
+
+    size_t acc = 0;
+    while (acc < buffer.length) {
+        ssize_t nwritten = send(sock->fd, buffer.data + acc, buffer.length - acc, MSG_NOSIGNAL);
+        if (nwritten < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            socket_fail(sock, errno);
+            return false;
+        }
+        acc += nwritten;
+    }
+    if (acc == buffer.length) return true;
+    write_queue_push_copy(sock->queue, (buffer_view_t){buffer.data + acc, buffer.length - acc});
+    return false;
+}
+
+void tcp_socket_cork(tcp_socket_t *sock) {
+    sock->corked = 1;
+}
+
+void tcp_socket_uncork(tcp_socket_t *sock) {
+    sock->corked = 0;
+    if (sock->connected && sock->fd >= 0) socket_flush(sock);
+}
+
+void tcp_socket_destroy(tcp_socket_t *sock) {
+    if (sock == NULL) return;
+    if (sock->fd >= 0) close(sock->fd);
+    write_queue_destroy(sock->queue);
+    free(sock);
+}
+
+int tcp_socket_poll_timeout(tcp_socket_t *sock, int timeout) {
+
+    /* wait for the connection to complete or for data to become available */
+    if (sock->fd < 0) return 0;
+    bool writing = write_queue_size(sock->queue) > 0 && !sock->corked;
+    short events = 0;
+    events |= sock->connected == 0 ? POLLOUT: 0;
+    events |= sock->connected == 1 && sock->open_read ? POLLIN: 0;
+    events |= sock->connected == 1 && writing ? POLLOUT: 0;
+    if (events == 0) return 0;
+
+    struct pollfd fds = {sock->fd, events, 0};
+    int res = poll(&fds, 1, timeout);
+    if (res == -1) return errno == EINTR ? 0: -1;
+    if (res == 0) return 0;
+
+    /* check for errors */
+    int error;
+    res = getsockopt(sock->fd, SOL_SOCKET, SO_ERROR, &error, &(socklen_t){sizeof(int)});
+    if (res < 0) {
+        return -1;
+    }
+
+    if (error != 0) {
+        socket_fail(sock, error);
+        return 0;
+    }
+
     /* check if socket is connected */
     if (sock->connected == 0) {
         struct sockaddr_in peer_addr;
-        size_t addr_size = sizeof(struct sockaddr_in);
-        int res = getpeername(sock->fd, &peer_addr, &addr_size);
+        socklen_t addr_size = sizeof(struct sockaddr_in);
+        int res = getpeername(sock->fd, (struct sockaddr*) &peer_addr, &addr_size);
         if (res == 0) {
             sock->connected = 1;
             sock->open_read = 1;
             sock->open_write = 1;
             sock->handler.on_connect(sock);
+            if (!sock->corked && sock->fd >= 0) socket_flush(sock);
         }
-    }
-    
-    /* check for errors */
-    int error;
-    int res = getsockopt(sock->fd, SOL_SOCKET, SO_ERROR, &error, &(size_t){sizeof(int)});
-    if (res < 0) {
-        return -1;
+        return 0;
     }
 
-    if (error != 0) {
-        sock->handler.on_error(sock, error);
+    /* check if socket is available for writing */
+    if (fds.revents & POLLOUT) {
+        socket_flush(sock);
+        if (sock->fd < 0) return 0;
     }
 
     /* check if socket is available for reading */
-    if (sock->connected == 1) {
-        short events = 0;
-        events |= sock->open_read ? POLLIN: 0;
-        struct pollfd fds = {sock->fd, events, 0};
-        int res = poll(&fds, 1, 0);
-        if (res == -1) return -1;
-        if (res > 0) {
-            if (fds.revents & POLLIN) {
-                uint8_t chunk[DEFAULT_CHUNK_SIZE] = {0};
-                ssize_t nread = read(sock->fd, chunk, DEFAULT_CHUNK_SIZE);
-                if (nread < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
-                    sock->handler.on_error(sock, errno);
-                } else if (nread == 0) {
-                    sock->open_read = 0;
-                    if (sock->open_write == 1) {
-                        sock->handler.on_end(sock);
-                    } else {
-                        close(sock->fd);
-                        sock->handler.on_close(sock);
-                    }
-                } else {
-                    sock->handler.on_read(sock, (buffer_t){chunk, nread});
-                }
+    if (fds.revents & (POLLIN | POLLHUP)) {
+        uint8_t chunk[DEFAULT_CHUNK_SIZE] = {0};
+        ssize_t nread = read(sock->fd, chunk, DEFAULT_CHUNK_SIZE);
+        if (nread < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            socket_fail(sock, errno);
+        } else if (nread == 0) {
+            sock->open_read = 0;
+            if (sock->open_write == 1) {
+                sock->handler.on_end(sock);
+            } else {
+                socket_close(sock);
             }
+        } else if (nread > 0) {
+            sock->handler.on_read(sock, (buffer_t){chunk, nread});
         }
     }
+    return 0;
+}
+
+int tcp_socket_poll(tcp_socket_t *sock) {
+    return tcp_socket_poll_timeout(sock, 0);
 }
 
 int tcp_socket_fd(tcp_socket_t *sock) {
@@ -124,11 +239,10 @@ int tcp_socket_fd(tcp_socket_t *sock) {
 }
 
 void tcp_socket_end(tcp_socket_t *sock) {
-    if (sock->open_write == 1) {
-        shutdown(sock->fd, SHUT_WR);
-    }
-    if (sock->open_read == 0) {
-        close(sock->fd);
-        sock->handler.on_close(sock);
+    if (sock->fd < 0) return;
+    if (write_queue_size(sock->queue) > 0) {
+        sock->ending = 1;
+        return;
     }
+    socket_shutdown(sock);
 }
@@ -6,14 +6,22 @@
 #include <assert.h>
 #include <log.h>
 
+/* 
+ * The map is an AVL tree, so the heights of the two subtrees of a node differ by at most one and
+ * lookups stay logarithmic whatever the order of the keys. Nodes link to their parent, so every
+ * operation walks the tree iteratively and iteration needs no stack.
+ */
 typedef struct node {
     struct node *left;
     struct node *right;
-    uint8_t entry[];
+    struct node *parent;
+    int height;
+    _Alignas(max_align_t) uint8_t entry[];
 } node_t;
 
 typedef struct tree_map {
     node_t *root;
+    size_t size;
     size_t key_size;
     size_t val_size;
     compare_t cmp_key;
@@ -42,6 +50,7 @@ tree_map_t* tree_map_create(
 static node_t* node_create(tree_map_t *map, void *key, void *val) {
     node_t *node = calloc(1, sizeof(node_t) + map->key_size + map->val_size);
     assert(node != NULL && "out of memory");
+    node->height = 1;
     memcpy(node->entry, key, map->key_size);
     memcpy(node->entry + map->key_size, val, map->val_size);
     return node;
@@ -61,128 +70,228 @@ static void node_assign(tree_map_t *map, node_t *node, void *key, void *val) {
     memmove(node->entry + map->key_size, val, map->val_size);
 }
 
-static void node_destroy_recursive(tree_map_t *map, node_t *node) {
-    if (node == NULL) return;
-    if (map->key_free) map->key_free(node->entry);
-    if (map->val_free) map->val_free(node->entry + map->key_size);
-    node_destroy_recursive(map, node->left);
-    node_destroy_recursive(map, node->right);
-    free(node);
+static node_t* node_find_smallest(node_t *node) {
+    while (node->left != NULL) node = node->left;
+    return node;
+}
+
+static node_t* node_find_largest(node_t *node) {
+    while (node->right != NULL) node = node->right;
+    return node;
 }
 
 void tree_map_destroy(tree_map_t *map) {
-    node_destroy_recursive(map, map->root);
+    /* free the nodes in post-order by climbing back up through the parent links */
+    node_t *node = map->root;
+    while (node != NULL) {
+        if (node->left != NULL) {
+            node = node->left;
+        } else if (node->right != NULL) {
+            node = node->right;
+        } else {
+            node_t *parent = node->parent;
+            if (parent != NULL && parent->left == node) parent->left = NULL;
+            else if (parent != NULL) parent->right = NULL;
+            node_destroy(map, node);
+            node = parent;
+        }
+    }
     free(map);
 }
 
-static node_t* node_search(tree_map_t *m, node_t *root, void *key) {
-    if (root == NULL) return NULL;
-    int cmp = m->cmp_key(root->entry, key);
-    if (cmp == 0) return root;
-    else if (cmp > 0) return node_search(m, root->left, key);
-    else return node_search(m, root->right, key);
+size_t tree_map_size(tree_map_t *map) {
+    return map->size;
 }
 
-static node_t* parent_search(tree_map_t *m, node_t *parent, node_t *root, void *key) {
-    if (root == NULL) return parent;
-    int cmp = m->cmp_key(root->entry, key);
-    if (cmp == 0) return parent;
-    else if (cmp > 0) return parent_search(m, root, root->left, key);
-    else return parent_search(m, root, root->right, key);
+static node_t* node_search(tree_map_t *m, void *key) {
+    node_t *node = m->root;
+    while (node != NULL) {
+        int cmp = m->cmp_key(node->entry, key);
+        if (cmp == 0) return node;
+        node = cmp > 0 ? node->left : node->right;
+    }
+    return NULL;
 }
 
 void* tree_map_get(tree_map_t *map, void *key) {
-    node_t* node = node_search(map, map->root, key);
+    node_t* node = node_search(map, key);
     return node == NULL ? NULL: node->entry + map->key_size;
 }
 
-void tree_map_set(tree_map_t *map, void *key, void *val) {
-    // If there are no entries in map, create root node.
-    if (map->root == NULL) {
-        map->root = node_create(map, key, val);
-        return;
-    }
+static int node_height(node_t *node) {
+    return node == NULL ? 0 : node->height;
+}
+
+static void node_update(node_t *node) {
+    int left = node_height(node->left);
+    int right = node_height(node->right);
+    node->height = 1 + (left > right ? left : right);
+}
+
+/* Put `child` in the place of `node` below `parent`, or at the root if there is no parent. */
+static void replace_child(tree_map_t *map, node_t *parent, node_t *node, node_t *child) {
+    if (parent == NULL) map->root = child;
+    else if (parent->left == node) parent->left = child;
+    else parent->right = child;
+    if (child != NULL) child->parent = parent;
+}
+
+static node_t* rotate_left(tree_map_t *map, node_t *node) {
+    node_t *right = node->right;
+    node->right = right->left;
+    if (right->left != NULL) right->left->parent = node;
+    replace_child(map, node->parent, node, right);
+    right->left = node;
+    node->parent = right;
+    node_update(node);
+    node_update(right);
+    return right;
+}
 
-    // If there is no parent, assign to root node.
-    node_t* parent = parent_search(map, NULL, map->root, key);
-    if (parent == NULL) {
-        assert(map != NULL);
-        assert(map->root != NULL);
-        node_assign(map, map->root, key, val);
-        return;
+static node_t* rotate_right(tree_map_t *map, node_t *node) {
+    node_t *left = node->left;
+    node->left = left->right;
+    if (left->right != NULL) left->right->parent = node;
+    replace_child(map, node->parent, node, left);
+    left->right = node;
+    node->parent = left;
+    node_update(node);
+    node_update(left);
+    return left;
+}
+
+/* Restore the height and balance of the subtree at `node` and return its new root. */
+static node_t* node_rebalance(tree_map_t *map, node_t *node) {
+    int balance = node_height(node->left) - node_height(node->right);
+    if (balance > 1) {
+        if (node_height(node->left->left) < node_height(node->left->right)) rotate_left(map, node->left);
+        return rotate_right(map, node);
     }
+    if (balance < -1) {
+        if (node_height(node->right->right) < node_height(node->right->left)) rotate_right(map, node->right);
+        return rotate_left(map, node);
+    }
+    node_update(node);
+    return node;
+}
 
-    int cmp = map->cmp_key(parent->entry, key);
-    if (cmp > 0) {
-        if (parent->left == NULL) parent->left = node_create(map, key, val);
-        else node_assign(map, parent->left, key, val);
-    } else {
-        if (parent->right == NULL) parent->right = node_create(map, key, val);
-        else node_assign(map, parent->right, key, val);
+/* Rebalance every node from `node` up to the root after a node was inserted or removed below it. */
+static void retrace(tree_map_t *map, node_t *node) {
+    while (node != NULL) {
+        node = node_rebalance(map, node)->parent;
     }
 }
 
-typedef struct result {
-    node_t* parent;
-    node_t* child;
-} result_t;
-
-static result_t node_find_largest(node_t *parent, node_t *node) {
-    if (node->right == NULL) return (result_t) {parent, node};
-    else return node_find_largest(node, node->right);
-}
-
-static void node_remove(node_t *parent, node_t *node) {
-    if (node->left == NULL && node->right == NULL) {
-        if (parent->left == node) parent->left = NULL;
-        if (parent->right == node) parent->right = NULL;
-    } else if (node->left != NULL && node->right != NULL) {
-        result_t res = node_find_largest(node, node->right);
-        node_remove(res.parent, res.child);
-        res.child->left = node->left;
-        res.child->right = node->right;
-        if (parent->left == node) parent->left = res.child;
-        if (parent->right == node) parent->right = res.child;
-    } else if (node->left != NULL) {
-        if (parent->left == node) parent->left = node->left;
-        if (parent->right == node) parent->right = node->left;
-    } else if (node->right != NULL) {
-        if (parent->left == node) parent->left = node->right;
-        if (parent->right == node) parent->right = node->right;
+void tree_map_set(tree_map_t *map, void *key, void *val) {
+    node_t *parent = NULL;
+    node_t **link = &map->root;
+    while (*link != NULL) {
+        parent = *link;
+        int cmp = map->cmp_key(parent->entry, key);
+        if (cmp == 0) {
+            node_assign(map, parent, key, val);
+            return;
+        }
+        link = cmp > 0 ? &parent->left : &parent->right;
     }
-    node->left = NULL;
-    node->right = NULL;
+
+    node_t *node = node_create(map, key, val);
+    node->parent = parent;
+    *link = node;
+    map->size++;
+    retrace(map, parent);
 }
 
 void tree_map_remove(tree_map_t *map, void *key) {
-    if (map->root == NULL) {
-        return;
-    }
+    node_t *node = node_search(map, key);
+    if (node == NULL) return;
 
-    node_t* parent = parent_search(map, NULL, map->root, key);
-    if (parent == NULL) {
-        node_t *node = map->root;
-        if (node->left == NULL && node->right == NULL) {
-            map->root = NULL;
-        } else if (node->left != NULL && node->right != NULL) {
-            result_t res = node_find_largest(node, node->right);
-            node_remove(res.parent, res.child);
-            res.child->left = map->root->left;
-            res.child->right = map->root->right;
-            map->root = res.child;
-        } else if (node->left != NULL) {
-            map->root = node->left;
-        } else if (node->right != NULL) {
-            map->root = node->right;
+    /* a node with two children is replaced by its successor, so no other node moves in memory */
+    node_t *changed;
+    if (node->left != NULL && node->right != NULL) {
+        node_t *next = node_find_smallest(node->right);
+        if (next->parent != node) {
+            changed = next->parent;
+            replace_child(map, next->parent, next, next->right);
+            next->right = node->right;
+            next->right->parent = next;
+        } else {
+            changed = next;
         }
+        next->left = node->left;
+        next->left->parent = next;
+        next->height = node->height;
+        replace_child(map, node->parent, node, next);
+    } else {
+        changed = node->parent;
+        replace_child(map, node->parent, node, node->left != NULL ? node->left : node->right);
+    }
+    node_destroy(map, node);
+    map->size--;
+    retrace(map, changed);
+}
+
+tree_map_entry_t* tree_map_first(tree_map_t *map) {
+    return map->root == NULL ? NULL : (tree_map_entry_t*) node_find_smallest(map->root);
+}
+
+tree_map_entry_t* tree_map_last(tree_map_t *map) {
+    return map->root == NULL ? NULL : (tree_map_entry_t*) node_find_largest(map->root);
+}
+
+tree_map_entry_t* tree_map_next(tree_map_entry_t *entry) {
+    node_t *node = (node_t*) entry;
+    if (node->right != NULL) return (tree_map_entry_t*) node_find_smallest(node->right);
+    while (node->parent != NULL && node->parent->right == node) node = node->parent;
+    return (tree_map_entry_t*) node->parent;
+}
+
+tree_map_entry_t* tree_map_prev(tree_map_entry_t *entry) {
+    node_t *node = (node_t*) entry;
+    if (node->left != NULL) return (tree_map_entry_t*) node_find_largest(node->left);
+    while (node->parent != NULL && node->parent->left == node) node = node->parent;
+    return (tree_map_entry_t*) node->parent;
+}
 
-        node_destroy(map, node);
-        return;
+/* Return the first node whose key is greater than `key`, or also equal to it if `inclusive`. */
+static node_t* node_bound(tree_map_t *map, void *key, bool inclusive) {
+    node_t *node = map->root;
+    node_t *bound = NULL;
+    while (node != NULL) {
+        int cmp = map->cmp_key(node->entry, key);
+        if (cmp > 0 || (inclusive && cmp == 0)) {
+            bound = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
     }
+    return bound;
+}
 
-    int cmp = map->cmp_key(parent->entry, key);
-    node_t *node = cmp > 0 ? parent->left: parent->right;
-    node_remove(parent, node);
-    node_destroy(map, node);
+tree_map_entry_t* tree_map_lower_bound(tree_map_t *map, void *key) {
+    return (tree_map_entry_t*) node_bound(map, key, true);
+}
+
+tree_map_entry_t* tree_map_upper_bound(tree_map_t *map, void *key) {
+    return (tree_map_entry_t*) node_bound(map, key, false);
+}
+
+void* tree_map_entry_key(tree_map_entry_t *entry) {
+    return ((node_t*) entry)->entry;
 }
 
+void* tree_map_entry_val(tree_map_t *map, tree_map_entry_t *entry) {
+    return ((node_t*) entry)->entry + map->key_size;
+}
+
+size_t tree_map_range(tree_map_t *map, void *from, void *to, tree_map_visit_t visit, void *data) {
+    node_t *node = from != NULL ? node_bound(map, from, true) : (node_t*) tree_map_first(map);
+    size_t count = 0;
+    while (node != NULL && (to == NULL || map->cmp_key(node->entry, to) < 0)) {
+        count++;
+        if (!visit(node->entry, node->entry + map->key_size, data)) break;
+        node = (node_t*) tree_map_next((tree_map_entry_t*) node);
+    }
+    return count;
+}
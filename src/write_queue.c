@@ -0,0 +1,198 @@
+#include <write_queue.h>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+
+#define DEFAULT_QUEUE_CAPACITY 8
+#define MAX_FLUSH_IOV 64
+
+#define MAX_SENDFILE (1024 * 1024)
+
+/**
+ * Queued buffers live in the iovec array between `head` and `tail`. `owned` holds the start of
+ * each buffer, which is freed once the iovec entry has been written completely. File ranges
+ * use the same slots with `files` holding the descriptor, which is -1 for buffers, `offsets`
+ * the position of the next byte to send, and iov_len the number of bytes left.
+ */
+typedef struct write_queue {
+    struct iovec *iov;
+    uint8_t **owned;
+    int *files;
+    off_t *offsets;
+    size_t head;
+    size_t tail;
+    size_t capacity;
+    size_t size;
+} write_queue_t;
+
+write_queue_t* write_queue_create() {
+    write_queue_t *queue = calloc(1, sizeof(write_queue_t));
+    assert(queue != NULL && "out of memory");
+    queue->capacity = DEFAULT_QUEUE_CAPACITY;
+    queue->iov = malloc(queue->capacity * sizeof(struct iovec));
+    queue->owned = malloc(queue->capacity * sizeof(uint8_t*));
+    queue->files = malloc(queue->capacity * sizeof(int));
+    queue->offsets = malloc(queue->capacity * sizeof(off_t));
+    assert(queue->iov != NULL && queue->owned != NULL && "out of memory");
+    assert(queue->files != NULL && queue->offsets != NULL && "out of memory");
+    return queue;
+}
+
+void write_queue_destroy(write_queue_t *queue) {
+    if (queue == NULL) return;
+    for (size_t i = queue->head; i < queue->tail; i++) {
+        free(queue->owned[i]);
+        if (queue->files[i] >= 0) close(queue->files[i]);
+    }
+    free(queue->iov);
+    free(queue->owned);
+    free(queue->files);
+    free(queue->offsets);
+    free(queue);
+}
+
+size_t write_queue_size(write_queue_t *queue) {
+    return queue->size;
+}
+
+/**
+ * Make room for one more entry at the tail. Written entries at the front are reclaimed by
+ * moving the live entries to the start of the array before growing it.
+ */
+static void write_queue_reserve(write_queue_t *queue) {
+    if (queue->tail < queue->capacity) return;
+    size_t n = queue->tail - queue->head;
+    if (queue->head > 0) {
+        memmove(queue->iov, queue->iov + queue->head, n * sizeof(struct iovec));
+        memmove(queue->owned, queue->owned + queue->head, n * sizeof(uint8_t*));
+        memmove(queue->files, queue->files + queue->head, n * sizeof(int));
+        memmove(queue->offsets, queue->offsets + queue->head, n * sizeof(off_t));
+        queue->head = 0;
+        queue->tail = n;
+    }
+    if (queue->tail == queue->capacity) {
+        queue->capacity *= 2;
+        queue->iov = realloc(queue->iov, queue->capacity * sizeof(struct iovec));
+        queue->owned = realloc(queue->owned, queue->capacity * sizeof(uint8_t*));
+        queue->files = realloc(queue->files, queue->capacity * sizeof(int));
+        queue->offsets = realloc(queue->offsets, queue->capacity * sizeof(off_t));
+        assert(queue->iov != NULL && queue->owned != NULL && "out of memory");
+        assert(queue->files != NULL && queue->offsets != NULL && "out of memory");
+    }
+}
+
+void write_queue_push(write_queue_t *queue, buffer_t buffer, size_t offset) {
+    assert(offset <= buffer.length);
+    if (offset == buffer.length) {
+        buffer_destroy(buffer);
+        return;
+    }
+    write_queue_reserve(queue);
+    queue->iov[queue->tail].iov_base = buffer.data + offset;
+    queue->iov[queue->tail].iov_len = buffer.length - offset;
+    queue->owned[queue->tail] = buffer.data;
+    queue->files[queue->tail] = -1;
+    queue->tail += 1;
+    queue->size += buffer.length - offset;
+}
+
+void write_queue_push_file(write_queue_t *queue, int fd, off_t offset, size_t length) {
+    if (length == 0) {
+        close(fd);
+        return;
+    }
+    write_queue_reserve(queue);
+    queue->iov[queue->tail].iov_base = NULL;
+    queue->iov[queue->tail].iov_len = length;
+    queue->owned[queue->tail] = NULL;
+    queue->files[queue->tail] = fd;
+    queue->offsets[queue->tail] = offset;
+    queue->tail += 1;
+    queue->size += length;
+}
+
+/**
+ * Send the file range at the head of the queue with sendfile, so its bytes are copied from the
+ * page cache to the socket by the kernel.
+ */
+static ssize_t write_queue_flush_file(write_queue_t *queue, int fd) {
+    struct iovec *iov = &queue->iov[queue->head];
+    size_t count = iov->iov_len < MAX_SENDFILE ? iov->iov_len: MAX_SENDFILE;
+    ssize_t nwritten;
+    do {
+        nwritten = sendfile(fd, queue->files[queue->head], &queue->offsets[queue->head], count);
+    } while (nwritten < 0 && errno == EINTR);
+    if (nwritten < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK ? 0: -1;
+    }
+    if (nwritten == 0) {
+        /* the file was truncated after the range was queued */
+        errno = EIO;
+        return -1;
+    }
+    iov->iov_len -= nwritten;
+    queue->size -= nwritten;
+    if (iov->iov_len == 0) {
+        close(queue->files[queue->head]);
+        queue->head += 1;
+    }
+    return nwritten;
+}
+
+void write_queue_push_copy(write_queue_t *queue, buffer_view_t view) {
+    if (view.length == 0) return;
+    write_queue_push(queue, buffer_copy(view), 0);
+}
+
+ssize_t write_queue_flush(write_queue_t *queue, int fd) {
+    if (queue->size == 0) return 0;
+    if (queue->files[queue->head] >= 0) {
+        ssize_t nwritten = write_queue_flush_file(queue, fd);
+        if (queue->head == queue->tail) {
+            queue->head = 0;
+            queue->tail = 0;
+        }
+        return nwritten;
+    }
+
+    /* send the buffers up to the next file range */
+    size_t n = 0;
+    while (n < MAX_FLUSH_IOV && queue->head + n < queue->tail && queue->files[queue->head + n] < 0) n++;
+    struct msghdr msg = {0};
+    msg.msg_iov = queue->iov + queue->head;
+    msg.msg_iovlen = n;
+
+    ssize_t nwritten;
+    do {
+        nwritten = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    } while (nwritten < 0 && errno == EINTR);
+    if (nwritten < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK ? 0: -1;
+    }
+
+    /* remove every fully written buffer and advance into the partially written one */
+    size_t remaining = nwritten;
+    while (remaining > 0) {
+        struct iovec *iov = &queue->iov[queue->head];
+        if (remaining < iov->iov_len) {
+            iov->iov_base = (uint8_t*) iov->iov_base + remaining;
+            iov->iov_len -= remaining;
+            break;
+        }
+        remaining -= iov->iov_len;
+        free(queue->owned[queue->head]);
+        queue->head += 1;
+    }
+    queue->size -= nwritten;
+    if (queue->head == queue->tail) {
+        queue->head = 0;
+        queue->tail = 0;
+    }
+    return nwritten;
+}
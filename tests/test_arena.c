@@ -0,0 +1,71 @@
+#include <test.h>
+#include <arena.h>
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+void test_arena_alloc() {
+    arena_t *arena = arena_create(64);
+    assert(arena_used(arena) == 0);
+    char *a = arena_alloc(arena, 3);
+    char *b = arena_alloc(arena, 5);
+    assert(a != NULL && b != NULL && a != b);
+    assert((uintptr_t) b % _Alignof(max_align_t) == 0);
+    memcpy(a, "ab", 3);
+    memcpy(b, "cdef", 5);
+    assert(strcmp(a, "ab") == 0);
+    assert(strcmp(b, "cdef") == 0);
+    assert(arena_used(arena) == 2 * _Alignof(max_align_t));
+    arena_destroy(arena);
+}
+
+void test_arena_calloc() {
+    arena_t *arena = arena_create(64);
+    memset(arena_alloc(arena, 32), 0xff, 32);
+    arena_reset(arena);
+    uint8_t *data = arena_calloc(arena, 32);
+    for (size_t i = 0; i < 32; i++) {
+        assert(data[i] == 0);
+    }
+    arena_destroy(arena);
+}
+
+void test_arena_grow() {
+    arena_t *arena = arena_create(64);
+    /* allocations larger than a block get a block of their own */
+    uint8_t *large = arena_alloc(arena, 1000);
+    memset(large, 1, 1000);
+    uint8_t *data[100];
+    for (size_t i = 0; i < 100; i++) {
+        data[i] = arena_alloc(arena, 16);
+        memset(data[i], i, 16);
+    }
+    for (size_t i = 0; i < 100; i++) {
+        assert(data[i][0] == i && data[i][15] == i);
+    }
+    assert(large[0] == 1 && large[999] == 1);
+    arena_destroy(arena);
+}
+
+void test_arena_reset() {
+    arena_t *arena = arena_create(64);
+    uint8_t *first[10];
+    for (size_t i = 0; i < 10; i++) {
+        first[i] = arena_alloc(arena, 48);
+    }
+    arena_reset(arena);
+    assert(arena_used(arena) == 0);
+
+    /* the same blocks are handed out again in the same order */
+    for (size_t i = 0; i < 10; i++) {
+        assert(arena_alloc(arena, 48) == first[i]);
+    }
+    arena_destroy(arena);
+}
+
+int main(int argc, char *argv[]) {
+    TEST(test_arena_alloc);
+    TEST(test_arena_calloc);
+    TEST(test_arena_grow);
+    TEST(test_arena_reset);
+}
@@ -0,0 +1,207 @@
+#include <test.h>
+#include <btree_map.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* keys this large leave room for only 3 keys per node, so small maps already have deep trees */
+typedef struct big_key {
+    int64_t id;
+    char pad[120];
+} big_key_t;
+
+static int int_cmp(int *a, int *b) {
+    return *a - *b;
+}
+
+static int big_cmp(big_key_t *a, big_key_t *b) {
+    return (a->id > b->id) - (a->id < b->id);
+}
+
+static size_t freed;
+
+static void count_free(void *val) {
+    freed++;
+}
+
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+void test_btree_map_set() {
+    btree_map_t *map = btree_map_create(sizeof(int), sizeof(int), (compare_t) int_cmp, NULL, NULL);
+    assert(btree_map_get(map, &(int){1}) == NULL);
+
+    /* insert a permutation of the keys, which splits nodes at every level */
+    int count = 10000;
+    for (int i = 0; i < count; i++) {
+        int key = (i * 7919) % count;
+        btree_map_set(map, &key, &(int){key * 2});
+    }
+    assert(btree_map_size(map) == (size_t) count);
+    for (int i = 0; i < count; i++) {
+        int *val = btree_map_get(map, &i);
+        assert(val != NULL && *val == i * 2);
+    }
+    assert(btree_map_get(map, &(int){-1}) == NULL);
+    assert(btree_map_get(map, &count) == NULL);
+
+    /* existing keys are replaced */
+    btree_map_set(map, &(int){42}, &(int){-1});
+    assert(*(int*) btree_map_get(map, &(int){42}) == -1);
+    assert(btree_map_size(map) == (size_t) count);
+    btree_map_destroy(map);
+}
+
+/* Apply random sets and removes to the map and to an array of the expected values. */
+static void check_random(btree_map_t *map, size_t key_size, int range, size_t ops) {
+    int64_t *expected = malloc(range * sizeof(int64_t));
+    for (int i = 0; i < range; i++) expected[i] = -1;
+    size_t size = 0;
+    uint64_t state = 88172645463325252ULL;
+    big_key_t key = {0};
+
+    for (size_t op = 0; op < ops; op++) {
+        int id = next_random(&state) % range;
+        key.id = id;
+        if (key_size == 4) memcpy(&key, &id, 4);
+        if (next_random(&state) % 3 != 0) {
+            int64_t val = op;
+            if (expected[id] < 0) size++;
+            btree_map_set(map, &key, &val);
+            expected[id] = val;
+        } else {
+            if (expected[id] >= 0) size--;
+            btree_map_remove(map, &key);
+            expected[id] = -1;
+        }
+        assert(btree_map_size(map) == size);
+    }
+    for (int id = 0; id < range; id++) {
+        key.id = id;
+        if (key_size == 4) memcpy(&key, &id, 4);
+        int64_t *val = btree_map_get(map, &key);
+        if (expected[id] < 0) assert(val == NULL);
+        else assert(val != NULL && *val == expected[id]);
+    }
+
+    /* empty the map again, which shrinks the tree down to nothing */
+    for (int id = 0; id < range; id++) {
+        key.id = id;
+        if (key_size == 4) memcpy(&key, &id, 4);
+        btree_map_remove(map, &key);
+    }
+    assert(btree_map_size(map) == 0);
+    key.id = 0;
+    assert(btree_map_get(map, &key) == NULL);
+    free(expected);
+}
+
+void test_btree_map_remove() {
+    btree_map_t *map = btree_map_create(sizeof(int), sizeof(int64_t), (compare_t) int_cmp, NULL, NULL);
+    check_random(map, sizeof(int), 5000, 100000);
+    btree_map_destroy(map);
+
+    map = btree_map_create(sizeof(big_key_t), sizeof(int64_t), (compare_t) big_cmp, NULL, NULL);
+    check_random(map, sizeof(big_key_t), 2000, 50000);
+    btree_map_destroy(map);
+}
+
+void test_btree_map_keyed() {
+    btree_map_t *map = btree_map_create_keyed(BTREE_KEY_INT, sizeof(int64_t), sizeof(int64_t), NULL, NULL);
+    check_random(map, sizeof(int64_t), 5000, 100000);
+    btree_map_set(map, &(int64_t){-5}, &(int64_t){1});
+    btree_map_set(map, &(int64_t){5}, &(int64_t){2});
+    assert(*(int64_t*) btree_map_get(map, &(int64_t){-5}) == 1);
+    btree_map_destroy(map);
+
+    map = btree_map_create_keyed(BTREE_KEY_INT, sizeof(int32_t), sizeof(int64_t), NULL, NULL);
+    check_random(map, sizeof(int32_t), 5000, 100000);
+    btree_map_destroy(map);
+
+    map = btree_map_create_keyed(BTREE_KEY_UINT, sizeof(uint64_t), sizeof(int64_t), NULL, NULL);
+    btree_map_set(map, &(uint64_t){UINT64_MAX}, &(int64_t){1});
+    btree_map_set(map, &(uint64_t){0}, &(int64_t){2});
+    assert(*(int64_t*) btree_map_get(map, &(uint64_t){UINT64_MAX}) == 1);
+    assert(*(int64_t*) btree_map_get(map, &(uint64_t){0}) == 2);
+    btree_map_destroy(map);
+
+    map = btree_map_create_keyed(BTREE_KEY_BYTES, sizeof(big_key_t), sizeof(int64_t), NULL, NULL);
+    check_random(map, sizeof(big_key_t), 2000, 50000);
+    btree_map_destroy(map);
+}
+
+void test_btree_map_free() {
+    btree_map_t *map = btree_map_create(sizeof(int), sizeof(int), (compare_t) int_cmp, NULL, count_free);
+    for (int i = 0; i < 1000; i++) {
+        btree_map_set(map, &i, &i);
+    }
+
+    /* values are destroyed when they are replaced, removed and when the map is destroyed */
+    freed = 0;
+    btree_map_set(map, &(int){10}, &(int){0});
+    assert(freed == 1);
+    for (int i = 0; i < 1000; i += 2) {
+        btree_map_remove(map, &i);
+    }
+    assert(freed == 501);
+    btree_map_remove(map, &(int){0});
+    assert(freed == 501);
+    btree_map_destroy(map);
+    assert(freed == 1001);
+}
+
+void test_btree_map_load() {
+    size_t sizes[] = {0, 1, 31, 32, 33, 1000, 100000};
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t count = sizes[s];
+        int64_t *keys = malloc((count + 1) * sizeof(int64_t));
+        int64_t *vals = malloc((count + 1) * sizeof(int64_t));
+        for (size_t i = 0; i < count; i++) {
+            keys[i] = 2 * i;
+            vals[i] = i;
+        }
+        btree_map_t *map = btree_map_create_keyed(BTREE_KEY_INT, sizeof(int64_t), sizeof(int64_t), NULL, NULL);
+        assert(btree_map_load(map, keys, vals, count) == 0);
+        assert(btree_map_size(map) == count);
+        for (size_t i = 0; i < count; i++) {
+            assert(*(int64_t*) btree_map_get(map, &keys[i]) == (int64_t) i);
+            assert(btree_map_get(map, &(int64_t){keys[i] + 1}) == NULL);
+        }
+
+        /* the loaded tree is a valid B-tree, so it can be changed like any other */
+        for (size_t i = 0; i < count; i += 3) {
+            btree_map_remove(map, &keys[i]);
+            btree_map_set(map, &(int64_t){keys[i] + 1}, &vals[i]);
+        }
+        assert(btree_map_size(map) == count);
+        for (size_t i = 0; i < count; i++) {
+            int64_t *val = btree_map_get(map, &keys[i]);
+            if (i % 3 == 0) assert(val == NULL && btree_map_get(map, &(int64_t){keys[i] + 1}) != NULL);
+            else assert(val != NULL && *val == (int64_t) i);
+        }
+        if (count > 0) assert(btree_map_load(map, keys, vals, count) == -1);
+        btree_map_destroy(map);
+        free(keys);
+        free(vals);
+    }
+
+    /* the keys must be strictly ascending */
+    btree_map_t *map = btree_map_create_keyed(BTREE_KEY_INT, sizeof(int64_t), sizeof(int64_t), NULL, NULL);
+    assert(btree_map_load(map, (int64_t[]) {1, 3, 2}, (int64_t[]) {0, 0, 0}, 3) == -1);
+    assert(btree_map_load(map, (int64_t[]) {1, 1}, (int64_t[]) {0, 0}, 2) == -1);
+    assert(btree_map_size(map) == 0);
+    btree_map_destroy(map);
+}
+
+int main(int argc, char *argv[]) {
+    TEST(test_btree_map_set);
+    TEST(test_btree_map_remove);
+    TEST(test_btree_map_keyed);
+    TEST(test_btree_map_free);
+    TEST(test_btree_map_load);
+}
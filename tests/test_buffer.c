@@ -22,6 +22,13 @@ void test_buffer_create_from_string() {
     buffer_destroy(buffer2);
 }
 
+void test_buffer_view_from_string() {
+    const char *str = "hello";
+    buffer_view_t view = buffer_view_from_string(str);
+    assert(view.data == (uint8_t*) str);
+    assert(view.length == 5);
+}
+
 void test_buffer_copy() {
     const char *test_data = "testingtesting123";
     buffer_t buffer1 = buffer_create_from_string(test_data);
@@ -45,6 +52,23 @@ void test_buffer_compare() {
     buffer_destroy(buffer3);
 }
 
+void test_buffer_case_compare() {
+    buffer_t buffer1 = buffer_create_from_string("Content-Length");
+    buffer_t buffer2 = buffer_create_from_string("content-length");
+    buffer_t buffer3 = buffer_create_from_string("content-type");
+
+    assert(buffer_case_compare(buffer1, buffer2) == 0);
+    assert(buffer_compare(buffer1, buffer2) != 0);
+    assert(buffer_case_compare(buffer1, buffer3) < 0);
+    assert(buffer_case_compare(buffer3, buffer1) > 0);
+    buffer2.length = 7;
+    assert(buffer_case_compare(buffer2, buffer1) < 0);
+
+    buffer_destroy(buffer1);
+    buffer_destroy((buffer_t) {buffer2.data, 14});
+    buffer_destroy(buffer3);
+}
+
 void test_buffer_concat() {
     buffer_t buffer1 = buffer_create_from_string("foo");
     buffer_t buffer2 = buffer_create_from_string("bar");
@@ -97,8 +121,10 @@ void test_buffer_resize() {
 int main(int argc, char *argv[]) {
     TEST(test_buffer_create)
     TEST(test_buffer_create_from_string)
+    TEST(test_buffer_view_from_string)
     TEST(test_buffer_copy)
     TEST(test_buffer_compare)
+    TEST(test_buffer_case_compare)
     TEST(test_buffer_concat)
     TEST(test_buffer_append)
     TEST(test_buffer_resize)
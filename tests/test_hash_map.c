@@ -0,0 +1,219 @@
+#include <test.h>
+#include <hash_map.h>
+#include <buffer.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct hash_map {
+    int8_t *ctrl;
+    uint8_t *slots;
+    size_t capacity;
+    size_t size;
+    size_t growth_left;
+    size_t key_size;
+    size_t val_size;
+    size_t entry_size;
+    hash_t hash_key;
+    compare_t cmp_key;
+    destroy_t key_free;
+    destroy_t val_free;
+} hash_map_t;
+
+static size_t freed;
+
+static void count_free(void *val) {
+    freed++;
+}
+
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/* a poor hash which puts every key in the same few groups, so probes run long */
+static uint64_t bad_hash(int *key) {
+    return *key % 3;
+}
+
+static int int_cmp(int *a, int *b) {
+    return *a - *b;
+}
+
+static void key_destroy(buffer_t *key) {
+    buffer_destroy(*key);
+}
+
+void test_hash_map_set() {
+    hash_map_t *map = hash_map_create(sizeof(int), sizeof(int), NULL, NULL, NULL, NULL);
+    assert(hash_map_get(map, &(int){1}) == NULL);
+    hash_map_remove(map, &(int){1});
+    assert(hash_map_size(map) == 0);
+
+    int count = 100000;
+    for (int i = 0; i < count; i++) {
+        hash_map_set(map, &i, &(int){i * 2});
+    }
+    assert(hash_map_size(map) == (size_t) count);
+    for (int i = 0; i < count; i++) {
+        int *val = hash_map_get(map, &i);
+        assert(val != NULL && *val == i * 2);
+    }
+    assert(hash_map_get(map, &(int){-1}) == NULL);
+    assert(hash_map_get(map, &count) == NULL);
+
+    /* existing keys are replaced */
+    hash_map_set(map, &(int){42}, &(int){-1});
+    assert(*(int*) hash_map_get(map, &(int){42}) == -1);
+    assert(hash_map_size(map) == (size_t) count);
+    hash_map_destroy(map);
+}
+
+/* Apply random sets and removes to the map and to an array of the expected values. */
+static void check_random(hash_map_t *map, int range, size_t ops) {
+    int64_t *expected = malloc(range * sizeof(int64_t));
+    for (int i = 0; i < range; i++) expected[i] = -1;
+    size_t size = 0;
+    uint64_t state = 88172645463325252ULL;
+
+    for (size_t op = 0; op < ops; op++) {
+        int key = next_random(&state) % range;
+        if (next_random(&state) % 3 != 0) {
+            int64_t val = op;
+            if (expected[key] < 0) size++;
+            hash_map_set(map, &key, &val);
+            expected[key] = val;
+        } else {
+            if (expected[key] >= 0) size--;
+            hash_map_remove(map, &key);
+            expected[key] = -1;
+        }
+        assert(hash_map_size(map) == size);
+    }
+    for (int key = 0; key < range; key++) {
+        int64_t *val = hash_map_get(map, &key);
+        if (expected[key] < 0) assert(val == NULL);
+        else assert(val != NULL && *val == expected[key]);
+    }
+    free(expected);
+}
+
+void test_hash_map_remove() {
+    hash_map_t *map = hash_map_create(sizeof(int), sizeof(int64_t), NULL, NULL, NULL, NULL);
+    check_random(map, 5000, 200000);
+    hash_map_destroy(map);
+
+    map = hash_map_create(sizeof(int), sizeof(int64_t), (hash_t) bad_hash, (compare_t) int_cmp, NULL, NULL);
+    check_random(map, 300, 20000);
+    hash_map_destroy(map);
+}
+
+void test_hash_map_deleted() {
+    hash_map_t *map = hash_map_create(sizeof(int), sizeof(int), NULL, NULL, NULL, NULL);
+    hash_map_reserve(map, 800);
+    size_t capacity = map->capacity;
+    assert(capacity == 1024);
+
+    /* a stream of short-lived keys reuses the deleted slots instead of growing the table */
+    for (int i = 0; i < 100000; i++) {
+        hash_map_set(map, &i, &i);
+        if (i >= 500) hash_map_remove(map, &(int){i - 500});
+    }
+    assert(hash_map_size(map) == 500);
+    assert(map->capacity == capacity);
+    for (int i = 100000 - 500; i < 100000; i++) {
+        assert(*(int*) hash_map_get(map, &i) == i);
+    }
+
+    /* reserving fewer entries than fit never shrinks the table */
+    hash_map_reserve(map, 10);
+    assert(map->capacity == capacity);
+    hash_map_destroy(map);
+}
+
+void test_hash_map_buffer() {
+    hash_map_t *map = hash_map_create(sizeof(buffer_t), sizeof(int), hash_map_hash_buffer,
+        hash_map_compare_buffer, (destroy_t) key_destroy, NULL);
+    char name[32];
+    for (int i = 0; i < 10000; i++) {
+        sprintf(name, "header-%d", i);
+        buffer_t key = buffer_create_from_string(name);
+        hash_map_set(map, &key, &i);
+    }
+    for (int i = 0; i < 10000; i++) {
+        sprintf(name, "header-%d", i);
+        int *val = hash_map_get(map, &(buffer_view_t) {(uint8_t*) name, strlen(name)});
+        assert(val != NULL && *val == i);
+    }
+    assert(hash_map_get(map, &(buffer_view_t) {(uint8_t*) "header-", 7}) == NULL);
+    assert(hash_map_get(map, &(buffer_view_t) {(uint8_t*) "header-10000", 12}) == NULL);
+
+    /* equal bytes hash equally wherever they are, and the bytes after the last word count */
+    strcpy(name, "abcdefghijk");
+    assert(hash_map_hash_bytes(name, 11) == hash_map_hash_bytes("abcdefghijk", 11));
+    assert(hash_map_hash_bytes(name, 11) != hash_map_hash_bytes("abcdefghijj", 11));
+    assert(hash_map_hash_bytes(name, 10) != hash_map_hash_bytes(name, 11));
+    hash_map_destroy(map);
+}
+
+void test_hash_map_free() {
+    hash_map_t *map = hash_map_create(sizeof(int), sizeof(int), NULL, NULL, NULL, count_free);
+    for (int i = 0; i < 1000; i++) {
+        hash_map_set(map, &i, &i);
+    }
+
+    /* values are destroyed when they are replaced, removed and when the map is destroyed */
+    freed = 0;
+    hash_map_set(map, &(int){10}, &(int){0});
+    assert(freed == 1);
+    for (int i = 0; i < 1000; i += 2) {
+        hash_map_remove(map, &i);
+    }
+    assert(freed == 501);
+    hash_map_remove(map, &(int){0});
+    assert(freed == 501);
+    hash_map_destroy(map);
+    assert(freed == 1001);
+}
+
+void test_hash_map_next() {
+    hash_map_t *map = hash_map_create(sizeof(int), sizeof(int), NULL, NULL, NULL, NULL);
+    size_t pos = 0;
+    void *key, *val;
+    assert(!hash_map_next(map, &pos, &key, &val));
+
+    int count = 1000;
+    for (int i = 0; i < count; i++) {
+        hash_map_set(map, &i, &(int){i + 1});
+    }
+
+    /* every entry is seen once, and entries can be removed as they are seen */
+    char *seen = calloc(count, 1);
+    pos = 0;
+    while (hash_map_next(map, &pos, &key, &val)) {
+        int k = *(int*) key;
+        assert(k >= 0 && k < count && !seen[k]);
+        assert(*(int*) val == k + 1);
+        seen[k] = 1;
+        if (k % 3 == 0) hash_map_remove(map, &k);
+    }
+    for (int i = 0; i < count; i++) {
+        assert(seen[i]);
+    }
+    assert(hash_map_size(map) == 666);
+    free(seen);
+    hash_map_destroy(map);
+}
+
+int main(int argc, char *argv[]) {
+    TEST(test_hash_map_set);
+    TEST(test_hash_map_remove);
+    TEST(test_hash_map_deleted);
+    TEST(test_hash_map_buffer);
+    TEST(test_hash_map_free);
+    TEST(test_hash_map_next);
+}
@@ -1,3 +1,619 @@
-int main() {
+#include <test.h>
+#include <http.h>
+#include <string.h>
+#include <stdbool.h>
 
+static bool view_equal(buffer_view_t view, const char *str) {
+    return view.length == strlen(str) && memcmp(view.data, str, view.length) == 0;
+}
+
+static const char *requests[] = {
+    "GET / HTTP/1.1\r\n\r\n",
+    "GET /index.html HTTP/1.0\r\nHost: example.com\r\n\r\n",
+    "POST /api/v1/users%20list HTTP/1.1\r\n"
+    "Host: example.com\r\n"
+    "User-Agent:   curl/7.64.1  \r\n"
+    "Accept: */*\r\n"
+    "Content-Length: 0\r\n"
+    "X-Empty:\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n",
+    "GET /static/app.js HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Sec-Fetch-Destination-Override-Long-Name: script\r\n"
+    "Cookie: session=0123456789abcdef0123456789abcdef;\ttheme=dark \r\n"
+    "\r\n",
+    "GET /app.css?v=3&next=/a?b%20c HTTP/1.1\r\nHost: example.com\r\n\r\n",
+};
+
+static void assert_headers_equal(http_headers_t *a, http_headers_t *b) {
+    assert(http_headers_size(a) == http_headers_size(b));
+    for (size_t i = 0; i < http_headers_size(a); i++) {
+        http_header_t *ha = http_headers_at(a, i);
+        http_header_t *hb = http_headers_at(b, i);
+        assert(buffer_compare(ha->key, hb->key) == 0);
+        assert(buffer_compare(ha->value, hb->value) == 0);
+    }
+}
+
+static void assert_requests_equal(http_request_t *a, http_request_t *b) {
+    assert(buffer_compare(http_request_method(a), http_request_method(b)) == 0);
+    assert(buffer_compare(http_request_uri(a), http_request_uri(b)) == 0);
+    assert(buffer_compare(http_request_version(a), http_request_version(b)) == 0);
+    assert_headers_equal(http_request_get_headers(a), http_request_get_headers(b));
+}
+
+void test_parse_http_request() {
+    arena_t *arena = arena_create(4096);
+    buffer_t buf = buffer_create_from_string(requests[2]);
+    http_request_t *req = http_request_create(arena);
+    assert(parse_http_request(buf, req) == buf.length);
+    assert(view_equal(http_request_method(req), "POST"));
+    assert(view_equal(http_request_uri(req), "/api/v1/users%20list"));
+    assert(view_equal(http_request_version(req), "HTTP/1.1"));
+    http_headers_t *headers = http_request_get_headers(req);
+    assert(http_headers_size(headers) == 6);
+    assert(view_equal(*http_headers_get(headers, "host"), "example.com"));
+    assert(view_equal(*http_headers_get(headers, "user-agent"), "curl/7.64.1"));
+    assert(view_equal(*http_headers_get(headers, "x-empty"), ""));
+    assert(view_equal(*http_request_header(req, "CONTENT-LENGTH"), "0"));
+    assert(http_headers_get(headers, "cookie") == NULL);
+
+    /* the request refers to the buffer it was parsed from rather than copying it */
+    assert(http_request_method(req).data == buf.data);
+    buffer_destroy(buf);
+
+    /* a query follows the path in the uri */
+    buf = buffer_create_from_string(requests[4]);
+    req = http_request_create(arena);
+    assert(parse_http_request(buf, req) == buf.length);
+    assert(view_equal(http_request_uri(req), "/app.css?v=3&next=/a?b%20c"));
+    buffer_destroy(buf);
+    arena_destroy(arena);
+}
+
+void test_parse_http_request_error() {
+    arena_t *arena = arena_create(4096);
+    const char *invalid[] = {
+        " / HTTP/1.1\r\n\r\n",
+        "GET index.html HTTP/1.1\r\n\r\n",
+        "GET /?q#f HTTP/1.1\r\n\r\n",
+        "GET /?%zz HTTP/1.1\r\n\r\n",
+        "GET /%zz HTTP/1.1\r\n\r\n",
+        "GET / HTTX/1.1\r\n\r\n",
+        "GET / HTTP/1.1\n\r\n",
+        "GET / HTTP/1.1\r\nHost example.com\r\n\r\n",
+        "GET / HTTP/1.1\r\nHost: a\nb\r\n\r\n",
+        "GET / HTTP/1.1\r\n\r\r",
+    };
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        buffer_t buf = buffer_create_from_string(invalid[i]);
+        http_request_t *req = http_request_create(arena);
+        assert(parse_http_request(buf, req) == HTTP_PARSE_ERROR);
+
+        http_parser_t *parser = http_parser_create();
+        req = http_request_create(arena);
+        assert(http_parser_feed(parser, buf, req) == HTTP_PARSE_ERROR);
+        http_parser_destroy(parser);
+        buffer_destroy(buf);
+    }
+    arena_destroy(arena);
+}
+
+void test_http_parser_feed() {
+    arena_t *arena = arena_create(4096);
+    for (size_t i = 0; i < sizeof(requests) / sizeof(requests[0]); i++) {
+        buffer_t buf = buffer_create_from_string(requests[i]);
+        http_request_t *expected = http_request_create(arena);
+        assert(parse_http_request(buf, expected) == buf.length);
+
+        /* feed the request in two pieces split at every possible position */
+        http_parser_t *parser = http_parser_create();
+        for (size_t split = 0; split < buf.length; split++) {
+            http_request_t *req = http_request_create(arena);
+            long len = http_parser_feed(parser, (buffer_t){buf.data, split}, req);
+            assert(len == HTTP_PARSE_INCOMPLETE);
+            len = http_parser_feed(parser, buf, req);
+            assert(len == buf.length);
+            assert_requests_equal(req, expected);
+        }
+
+        /* feed the request one byte at a time */
+        http_request_t *req = http_request_create(arena);
+        for (size_t n = 1; n < buf.length; n++) {
+            assert(http_parser_feed(parser, (buffer_t){buf.data, n}, req) == HTTP_PARSE_INCOMPLETE);
+        }
+        assert(http_parser_feed(parser, buf, req) == buf.length);
+        assert_requests_equal(req, expected);
+
+        http_parser_destroy(parser);
+        buffer_destroy(buf);
+    }
+    arena_destroy(arena);
+}
+
+void test_http_parser_max_head() {
+    arena_t *arena = arena_create(4096);
+    const char *head = "GET / HTTP/1.1\r\nHost: example.com\r\n\r\n";
+    buffer_t buf = buffer_create_from_string(head);
+
+    /* a head of exactly the maximum size is accepted */
+    http_parser_t *parser = http_parser_create();
+    http_parser_set_max_head(parser, buf.length);
+    http_request_t *req = http_request_create(arena);
+    assert(http_parser_feed(parser, buf, req) == buf.length);
+
+    /* one byte less is too large, whether it arrives at once or a byte at a time */
+    http_parser_set_max_head(parser, buf.length - 1);
+    assert(http_parser_feed(parser, buf, req) == HTTP_PARSE_TOO_LARGE);
+    http_parser_reset(parser);
+    for (size_t n = 1; n < buf.length - 1; n++) {
+        assert(http_parser_feed(parser, (buffer_t){buf.data, n}, req) == HTTP_PARSE_INCOMPLETE);
+    }
+    assert(http_parser_feed(parser, (buffer_t){buf.data, buf.length - 1}, req) == HTTP_PARSE_TOO_LARGE);
+    http_parser_destroy(parser);
+    buffer_destroy(buf);
+
+    /* a header block which never ends is rejected at the default limit */
+    parser = http_parser_create();
+    buf = buffer_create(2 * HTTP_DEFAULT_MAX_HEAD);
+    memset(buf.data, 'a', buf.length);
+    memcpy(buf.data, "GET / HTTP/1.1\r\nX-Long: ", strlen("GET / HTTP/1.1\r\nX-Long: "));
+    assert(http_parser_feed(parser, (buffer_t){buf.data, HTTP_DEFAULT_MAX_HEAD - 1}, req) == HTTP_PARSE_INCOMPLETE);
+    assert(http_parser_feed(parser, buf, req) == HTTP_PARSE_TOO_LARGE);
+    http_parser_destroy(parser);
+    buffer_destroy(buf);
+    arena_destroy(arena);
+}
+
+void test_http_parser_pipelined() {
+    arena_t *arena = arena_create(4096);
+    buffer_t buf = buffer_create_from_string("GET /a HTTP/1.1\r\n\r\nGET /b HTTP/1.1\r\n\r\n");
+    http_parser_t *parser = http_parser_create();
+    http_request_t *req = http_request_create(arena);
+    long len = http_parser_feed(parser, buf, req);
+    assert(len == buf.length / 2);
+    assert(view_equal(http_request_uri(req), "/a"));
+
+    req = http_request_create(arena);
+    assert(http_parser_feed(parser, (buffer_t){buf.data + len, buf.length - len}, req) == len);
+    assert(view_equal(http_request_uri(req), "/b"));
+    http_parser_destroy(parser);
+    buffer_destroy(buf);
+    arena_destroy(arena);
+}
+
+void test_http_response_write_head() {
+    arena_t *arena = arena_create(4096);
+    http_response_t *res = http_response_create(arena);
+    http_headers_t *headers = http_response_get_headers(res);
+    http_response_set_status(res, 404);
+    http_headers_set(headers, "Content-Length", "10");
+    http_headers_set(headers, "Connection", "close");
+    http_headers_set(headers, "content-length", "0");
+    assert(http_headers_size(headers) == 2);
+    buffer_t head = http_response_write_head(res);
+    assert(view_equal(head, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"));
+
+    /* a destination which is too small only reports the length */
+    uint8_t dest[128];
+    assert(http_response_write_head_to(res, dest, 10) == head.length);
+    assert(http_response_write_head_to(res, dest, sizeof(dest)) == head.length);
+    assert(memcmp(dest, head.data, head.length) == 0);
+
+    http_response_set_status(res, 299);
+    head = http_response_write_head(res);
+    assert(view_equal(head, "HTTP/1.1 299 Unknown\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"));
+    arena_destroy(arena);
+}
+
+void test_http_header_lookup() {
+    for (http_header_id_t id = 0; id < HTTP_HEADER_OTHER; id++) {
+        assert(http_header_lookup(http_header_name(id)) == id);
+    }
+    assert(http_header_lookup(buffer_view_from_string("content-LENGTH")) == HTTP_HEADER_CONTENT_LENGTH);
+    assert(http_header_lookup(buffer_view_from_string("Content-Lengt")) == HTTP_HEADER_OTHER);
+    assert(http_header_lookup(buffer_view_from_string("X-Forwarded-For")) == HTTP_HEADER_OTHER);
+}
+
+void test_http_headers_id() {
+    arena_t *arena = arena_create(4096);
+    buffer_t buf = buffer_create_from_string(requests[3]);
+    http_request_t *req = http_request_create(arena);
+    assert(parse_http_request(buf, req) == buf.length);
+    http_headers_t *headers = http_request_get_headers(req);
+    assert(http_headers_at(headers, 0)->id == HTTP_HEADER_HOST);
+    assert(http_headers_at(headers, 3)->id == HTTP_HEADER_OTHER);
+    assert(view_equal(*http_request_header_id(req, HTTP_HEADER_HOST), "www.example.com"));
+    assert(view_equal(*http_request_header_id(req, HTTP_HEADER_ACCEPT_ENCODING), "gzip, deflate, br"));
+    assert(http_request_header_id(req, HTTP_HEADER_CONNECTION) == NULL);
+    assert(view_equal(*http_request_header(req, "sec-fetch-destination-override-long-name"), "script"));
+
+    /* lookups by name and by id see the same slot, and the first duplicate wins */
+    http_headers_add(headers, buffer_view_from_string("host"), buffer_view_from_string("other"));
+    http_headers_add(headers, buffer_view_from_string("x-a"), buffer_view_from_string("1"));
+    http_headers_add(headers, buffer_view_from_string("X-A"), buffer_view_from_string("2"));
+    assert(view_equal(*http_headers_get(headers, "HOST"), "www.example.com"));
+    assert(view_equal(*http_headers_get(headers, "x-a"), "1"));
+    http_headers_set_id(headers, HTTP_HEADER_CONNECTION, "close");
+    assert(view_equal(*http_headers_get(headers, "connection"), "close"));
+    assert(view_equal(http_headers_at(headers, http_headers_size(headers) - 1)->key, "Connection"));
+    buffer_destroy(buf);
+    arena_destroy(arena);
+}
+
+void test_http_headers_grow() {
+    arena_t *arena = arena_create(256);
+    http_headers_t *headers = http_headers_create(arena);
+    char keys[100][8];
+    for (size_t i = 0; i < 100; i++) {
+        snprintf(keys[i], sizeof(keys[i]), "x-%zu", i);
+        http_headers_set(headers, keys[i], keys[i]);
+    }
+    assert(http_headers_size(headers) == 100);
+    for (size_t i = 0; i < 100; i++) {
+        assert(view_equal(http_headers_at(headers, i)->key, keys[i]));
+        assert(view_equal(*http_headers_get(headers, keys[i]), keys[i]));
+    }
+    arena_destroy(arena);
+}
+
+static void collect_body(void *data, buffer_view_t chunk) {
+    buffer_append(data, chunk);
+}
+
+/* parse a request head and body, feeding the body in pieces of at most `step` bytes */
+static long parse_message(http_parser_t *parser, const char *message, size_t step, buffer_t *body) {
+    arena_t *arena = arena_create(4096);
+    buffer_t buf = buffer_view_from_string(message);
+    http_request_t *req = http_request_create(arena);
+    long len = http_parser_feed(parser, buf, req);
+    assert(len > 0);
+    long res = http_parser_start_body(parser, req);
+    arena_destroy(arena);
+    if (res <= 0) return res == 0 ? len : res;
+
+    size_t offset = len;
+    res = HTTP_PARSE_INCOMPLETE;
+    size_t end = len;
+    while (res == HTTP_PARSE_INCOMPLETE && end < buf.length) {
+        end = end + step < buf.length ? end + step : buf.length;
+        size_t consumed;
+        res = http_parser_feed_body(parser, (buffer_t){buf.data + offset, end - offset}, &consumed, collect_body, body);
+        offset += consumed;
+    }
+    return res == 0 ? (long) offset : res;
+}
+
+void test_http_parser_body() {
+    const char *messages[] = {
+        "POST /upload HTTP/1.1\r\nContent-Length: 11\r\n\r\nhello world",
+        "POST /upload HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+        "5\r\nhello\r\n1;ext=\"a b\"\r\n \r\nA \r\n0123456789\r\n0\r\n\r\n",
+        "POST /upload HTTP/1.1\r\ntransfer-encoding: gzip, Chunked\r\n\r\n"
+        "b\r\nhello world\r\n0\r\nExpires: never\r\nX-Checksum: 1234\r\n\r\n",
+    };
+    const char *bodies[] = {"hello world", "hello 0123456789", "hello world"};
+    for (size_t i = 0; i < sizeof(messages) / sizeof(messages[0]); i++) {
+        for (size_t step = 1; step <= strlen(messages[i]); step++) {
+            http_parser_t *parser = http_parser_create();
+            buffer_t body = buffer_create(0);
+            assert(parse_message(parser, messages[i], step, &body) == strlen(messages[i]));
+            assert(view_equal(body, bodies[i]));
+            buffer_destroy(body);
+            http_parser_destroy(parser);
+        }
+    }
+}
+
+void test_http_parser_body_pipelined() {
+    const char *message = 
+        "POST /a HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc"
+        "GET /b HTTP/1.1\r\n\r\n";
+    http_parser_t *parser = http_parser_create();
+    buffer_t body = buffer_create(0);
+    long len = parse_message(parser, message, 64, &body);
+    assert(len == strlen(message) - strlen("GET /b HTTP/1.1\r\n\r\n"));
+    assert(view_equal(body, "abc"));
+
+    /* the parser is ready for the next request head, which has no body */
+    assert(parse_message(parser, message + len, 64, &body) == strlen(message) - len);
+    assert(view_equal(body, "abc"));
+    buffer_destroy(body);
+    http_parser_destroy(parser);
+}
+
+void test_http_parser_body_error() {
+    const char *invalid[] = {
+        "POST / HTTP/1.1\r\nContent-Length: 1x\r\n\r\n",
+        "POST / HTTP/1.1\r\nContent-Length: 1\r\nContent-Length: 2\r\n\r\n",
+        "POST / HTTP/1.1\r\nContent-Length: 1\r\nTransfer-Encoding: chunked\r\n\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nx\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n1\r\naa\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n0\r\nbad trailer\r\n\r\n",
+    };
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        http_parser_t *parser = http_parser_create();
+        buffer_t body = buffer_create(0);
+        assert(parse_message(parser, invalid[i], 64, &body) == HTTP_PARSE_ERROR);
+        buffer_destroy(body);
+        http_parser_destroy(parser);
+    }
+
+    const char *too_large[] = {
+        "POST / HTTP/1.1\r\nContent-Length: 11\r\n\r\nhello world",
+        "POST / HTTP/1.1\r\nContent-Length: 99999999999999999999999\r\n\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n6\r\nhello \r\n5\r\nworld\r\n0\r\n\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nfffffffffffffffffffff\r\n",
+    };
+    for (size_t i = 0; i < sizeof(too_large) / sizeof(too_large[0]); i++) {
+        http_parser_t *parser = http_parser_create();
+        http_parser_set_max_body(parser, 10);
+        buffer_t body = buffer_create(0);
+        assert(parse_message(parser, too_large[i], 64, &body) == HTTP_PARSE_TOO_LARGE);
+        assert(body.length <= 10);
+        buffer_destroy(body);
+        http_parser_destroy(parser);
+    }
+}
+
+static bool collect_writes(void *data, const buffer_view_t *buffers, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        buffer_append(data, buffers[i]);
+    }
+    return true;
+}
+
+/* stream "hello" and "world" in response to the request */
+static void stream_response(const char *request, const char *content_length, buffer_t *out, bool *close) {
+    arena_t *arena = arena_create(4096);
+    buffer_t buf = buffer_view_from_string(request);
+    http_request_t *req = http_request_create(arena);
+    assert(parse_http_request(buf, req) == buf.length);
+    http_response_t *res = http_response_create(arena);
+    if (content_length != NULL) {
+        http_headers_set_id(http_response_get_headers(res), HTTP_HEADER_CONTENT_LENGTH, (char*) content_length);
+    }
+    http_stream_t *stream = http_stream_create(req, res, collect_writes, out);
+    assert(http_stream_write_head(stream));
+    assert(http_stream_write_chunk(stream, buffer_view_from_string("hello")));
+    assert(http_stream_write_chunk(stream, buffer_view_from_string("")));
+    assert(http_stream_write_chunk(stream, buffer_view_from_string(" world of streams")));
+    assert(http_stream_end(stream));
+    *close = http_stream_closes_connection(stream);
+    arena_destroy(arena);
+}
+
+void test_http_stream() {
+    buffer_t out = buffer_create(0);
+    bool close;
+    stream_response("GET / HTTP/1.1\r\n\r\n", NULL, &out, &close);
+    assert(view_equal(out, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+        "5\r\nhello\r\n11\r\n world of streams\r\n0\r\n\r\n"));
+    assert(!close);
+    buffer_destroy(out);
+
+    out = buffer_create(0);
+    stream_response("GET / HTTP/1.1\r\n\r\n", "22", &out, &close);
+    assert(view_equal(out, "HTTP/1.1 200 OK\r\nContent-Length: 22\r\n\r\nhello world of streams"));
+    assert(!close);
+    buffer_destroy(out);
+
+    out = buffer_create(0);
+    stream_response("GET / HTTP/1.0\r\n\r\n", NULL, &out, &close);
+    assert(view_equal(out, "HTTP/1.1 200 OK\r\nConnection: close\r\n\r\nhello world of streams"));
+    assert(close);
+    buffer_destroy(out);
+}
+
+void test_http_stream_after_body() {
+    arena_t *arena = arena_create(4096);
+    const char *message = "GET /generate HTTP/1.1\r\nContent-Length: 5\r\n\r\nhelloGET /health HTTP/1.1\r\n\r\n";
+    buffer_t buf = buffer_create_from_string(message);
+    http_parser_t *parser = http_parser_create();
+    http_request_t *req = http_request_create(arena);
+    long head = http_parser_feed(parser, buf, req);
+    assert(head > 0);
+    assert(http_parser_start_body(parser, req) == 1);
+
+    /* the stream is created from the head, which the body may then be read over */
+    buffer_t out = buffer_create(0);
+    http_response_t *res = http_response_create(arena);
+    http_stream_t *stream = http_stream_create(req, res, collect_writes, &out);
+    size_t consumed;
+    buffer_t rest = {buf.data + head, buf.length - head};
+    assert(http_parser_feed_body(parser, rest, &consumed, NULL, NULL) == 0 && consumed == 5);
+    memset(buf.data, 'x', head + consumed);
+
+    /* the response is framed, so the next request on the connection can follow it */
+    assert(http_stream_write_head(stream));
+    assert(http_stream_write_chunk(stream, buffer_view_from_string("abc")));
+    assert(http_stream_end(stream));
+    assert(!http_stream_closes_connection(stream));
+    assert(view_equal(out, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n0\r\n\r\n"));
+    rest = (buffer_t) {rest.data + consumed, rest.length - consumed};
+    req = http_request_create(arena);
+    assert(http_parser_feed(parser, rest, req) == rest.length);
+    assert(view_equal(http_request_uri(req), "/health"));
+
+    buffer_destroy(out);
+    http_parser_destroy(parser);
+    buffer_destroy(buf);
+    arena_destroy(arena);
+}
+
+void test_http_response_preset() {
+    arena_t *arena = arena_create(4096);
+    http_response_t *template = http_response_create(arena);
+    http_headers_set(http_response_get_headers(template), "Content-Type", "text/plain");
+    http_headers_set(http_response_get_headers(template), "Server", "test");
+    http_preset_t preset = http_response_render_preset(template);
+    assert(preset.status == 200);
+    assert(view_equal(preset.head, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nServer: test\r\n"));
+
+    http_response_t *res = http_response_create(arena);
+    http_response_use_preset(res, preset);
+    http_headers_set(http_response_get_headers(res), "Content-Length", "2");
+    buffer_t head = http_response_write_head(res);
+    assert(view_equal(head, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nServer: test\r\nContent-Length: 2\r\n\r\n"));
+
+    /* a different status discards the preset */
+    http_response_set_status(res, 500);
+    head = http_response_write_head(res);
+    assert(view_equal(head, "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 2\r\n\r\n"));
+    arena_destroy(arena);
+}
+
+void test_http_date() {
+    char value[HTTP_DATE_LENGTH + 1];
+    http_date_format(784111777, value);
+    assert(strcmp(value, "Sun, 06 Nov 1994 08:49:37 GMT") == 0);
+    http_date_format(0, value);
+    assert(strcmp(value, "Thu, 01 Jan 1970 00:00:00 GMT") == 0);
+
+    http_date_t date = {0};
+    assert(http_date_update(&date, 784111777));
+    assert(!http_date_update(&date, 784111777));
+    assert(http_date_update(&date, 784111778));
+    assert(strcmp(date.value, "Sun, 06 Nov 1994 08:49:38 GMT") == 0);
+}
+
+void test_http_date_parse() {
+    time_t time;
+    assert(http_date_parse(buffer_view_from_string("Sun, 06 Nov 1994 08:49:37 GMT"), &time) == 0);
+    assert(time == 784111777);
+    char value[HTTP_DATE_LENGTH + 1];
+    http_date_format(1700000000, value);
+    assert(http_date_parse(buffer_view_from_string(value), &time) == 0 && time == 1700000000);
+
+    assert(http_date_parse(buffer_view_from_string("Sunday, 06-Nov-94 08:49:37 GMT"), &time) == -1);
+    assert(http_date_parse(buffer_view_from_string("Sun, 06 Nov 1994 08:49:37 UTC"), &time) == -1);
+    assert(http_date_parse(buffer_view_from_string("Sun, 06 Foo 1994 08:49:37 GMT"), &time) == -1);
+    assert(http_date_parse(buffer_view_from_string("Sun, 06 Nov 1994 24:49:37 GMT"), &time) == -1);
+    assert(http_date_parse(buffer_view_from_string("Sun, 0x Nov 1994 08:49:37 GMT"), &time) == -1);
+}
+
+void test_http_etag_match() {
+    buffer_view_t etag = buffer_view_from_string("\"abc-1\"");
+    assert(http_etag_match(buffer_view_from_string("\"abc-1\""), etag));
+    assert(http_etag_match(buffer_view_from_string("*"), etag));
+    assert(http_etag_match(buffer_view_from_string("\"x\", W/\"abc-1\""), etag));
+    assert(http_etag_match(buffer_view_from_string("\"x\",\"y\" ,\"abc-1\""), etag));
+    assert(!http_etag_match(buffer_view_from_string("\"abc-2\""), etag));
+    assert(!http_etag_match(buffer_view_from_string("\"abc-1"), etag));
+    assert(!http_etag_match(buffer_view_from_string("abc-1"), etag));
+    assert(!http_etag_match(buffer_view_from_string(""), etag));
+}
+
+void test_http_request_not_modified() {
+    arena_t *arena = arena_create(4096);
+    buffer_view_t etag = buffer_view_from_string("\"abc-1\"");
+    time_t modified = 784111777;
+
+    http_request_t *req = http_request_create(arena);
+    assert(!http_request_not_modified(req, etag, modified));
+
+    http_headers_set(http_request_get_headers(req), "If-Modified-Since", "Sun, 06 Nov 1994 08:49:37 GMT");
+    assert(http_request_not_modified(req, etag, modified));
+    assert(!http_request_not_modified(req, etag, modified + 1));
+
+    /* If-None-Match takes precedence over If-Modified-Since */
+    http_headers_set(http_request_get_headers(req), "If-None-Match", "\"abc-2\"");
+    assert(!http_request_not_modified(req, etag, modified));
+    http_headers_set(http_request_get_headers(req), "If-None-Match", "\"abc-1\"");
+    assert(http_request_not_modified(req, etag, modified + 1));
+    arena_destroy(arena);
+}
+
+static int parse_ranges(const char *value, size_t size, http_range_t *ranges) {
+    return http_range_parse(buffer_view_from_string(value), size, ranges, 4);
+}
+
+void test_http_range_parse() {
+    http_range_t ranges[4];
+    assert(parse_ranges("bytes=0-99", 1000, ranges) == 1);
+    assert(ranges[0].offset == 0 && ranges[0].length == 100);
+    assert(parse_ranges("bytes=500-", 1000, ranges) == 1);
+    assert(ranges[0].offset == 500 && ranges[0].length == 500);
+    assert(parse_ranges("bytes=-200", 1000, ranges) == 1);
+    assert(ranges[0].offset == 800 && ranges[0].length == 200);
+    assert(parse_ranges("bytes=-2000", 1000, ranges) == 1);
+    assert(ranges[0].offset == 0 && ranges[0].length == 1000);
+    assert(parse_ranges("bytes=900-1999", 1000, ranges) == 1);
+    assert(ranges[0].offset == 900 && ranges[0].length == 100);
+
+    /* several ranges, skipping the unsatisfiable ones */
+    assert(parse_ranges("bytes=0-0, 2000-3000 ,-1", 1000, ranges) == 2);
+    assert(ranges[0].offset == 0 && ranges[0].length == 1);
+    assert(ranges[1].offset == 999 && ranges[1].length == 1);
+    assert(parse_ranges("bytes=1000-", 1000, ranges) == 0);
+
+    /* ranges are sorted, and overlapping or adjacent ones coalesced */
+    assert(parse_ranges("bytes=500-599,0-99", 1000, ranges) == 2);
+    assert(ranges[0].offset == 0 && ranges[0].length == 100);
+    assert(ranges[1].offset == 500 && ranges[1].length == 100);
+    assert(parse_ranges("bytes=100-199,0-99,150-249", 1000, ranges) == 1);
+    assert(ranges[0].offset == 0 && ranges[0].length == 250);
+    assert(parse_ranges("bytes=0-9,20-29,10-19,-1", 1000, ranges) == 2);
+    assert(ranges[0].offset == 0 && ranges[0].length == 30);
+    assert(ranges[1].offset == 999 && ranges[1].length == 1);
+    assert(parse_ranges("bytes=0-499,0-499", 1000, ranges) == 1);
+    assert(ranges[0].offset == 0 && ranges[0].length == 500);
+
+    /* ranges which ask for more than the whole representation are ignored */
+    assert(parse_ranges("bytes=0-,0-", 1000, ranges) == -1);
+    assert(parse_ranges("bytes=0-,0-,0-,0-", 1000, ranges) == -1);
+    assert(parse_ranges("bytes=0-599,-500", 1000, ranges) == -1);
+    assert(parse_ranges("bytes=-0", 1000, ranges) == 0);
+    assert(parse_ranges("bytes=0-", 0, ranges) == 0);
+
+    /* headers which are ignored */
+    assert(parse_ranges("items=0-1", 1000, ranges) == -1);
+    assert(parse_ranges("bytes=", 1000, ranges) == -1);
+    assert(parse_ranges("bytes=5-1", 1000, ranges) == -1);
+    assert(parse_ranges("bytes=a-b", 1000, ranges) == -1);
+    assert(parse_ranges("bytes=1-2,3-4,5-6,7-8,9-10", 1000, ranges) == -1);
+    assert(parse_ranges("bytes=99999999999999999999999-", 1000, ranges) == -1);
+}
+
+void test_http_request_range_applies() {
+    arena_t *arena = arena_create(4096);
+    buffer_view_t etag = buffer_view_from_string("\"abc-1\"");
+    http_request_t *req = http_request_create(arena);
+    assert(http_request_range_applies(req, etag, 784111777));
+    http_headers_set(http_request_get_headers(req), "If-Range", "\"abc-1\"");
+    assert(http_request_range_applies(req, etag, 784111777));
+    http_headers_set(http_request_get_headers(req), "If-Range", "W/\"abc-1\"");
+    assert(!http_request_range_applies(req, etag, 784111777));
+    http_headers_set(http_request_get_headers(req), "If-Range", "Sun, 06 Nov 1994 08:49:37 GMT");
+    assert(http_request_range_applies(req, etag, 784111777));
+    assert(!http_request_range_applies(req, etag, 784111778));
+    arena_destroy(arena);
+}
+
+int main(int argc, char *argv[]) {
+    TEST(test_parse_http_request);
+    TEST(test_parse_http_request_error);
+    TEST(test_http_parser_feed);
+    TEST(test_http_parser_max_head);
+    TEST(test_http_parser_pipelined);
+    TEST(test_http_response_write_head);
+    TEST(test_http_header_lookup);
+    TEST(test_http_headers_id);
+    TEST(test_http_headers_grow);
+    TEST(test_http_parser_body);
+    TEST(test_http_parser_body_pipelined);
+    TEST(test_http_parser_body_error);
+    TEST(test_http_stream);
+    TEST(test_http_stream_after_body);
+    TEST(test_http_response_preset);
+    TEST(test_http_date);
+    TEST(test_http_date_parse);
+    TEST(test_http_etag_match);
+    TEST(test_http_request_not_modified);
+    TEST(test_http_range_parse);
+    TEST(test_http_request_range_applies);
 }
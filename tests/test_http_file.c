@@ -0,0 +1,161 @@
+#include <test.h>
+#include <http_file.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static bool view_equal(buffer_view_t view, const char *str) {
+    return view.length == strlen(str) && memcmp(view.data, str, view.length) == 0;
+}
+
+static bool path_equal(const char *uri, const char *expected) {
+    char dest[64];
+    long len = http_file_path("/srv/www/", buffer_view_from_string(uri), dest, sizeof(dest));
+    if (expected == NULL) return len == -1;
+    return len == (long) strlen(expected) && strcmp(dest, expected) == 0;
+}
+
+void test_http_file_path() {
+    assert(path_equal("/", "/srv/www/"));
+    assert(path_equal("/index.html", "/srv/www/index.html"));
+    assert(path_equal("/css/site.css", "/srv/www/css/site.css"));
+    assert(path_equal("/a%20b/c%41", "/srv/www/a b/cA"));
+    assert(path_equal("/.well-known/x", "/srv/www/.well-known/x"));
+
+    /* the query is not part of the file name */
+    assert(path_equal("/app.css?v=3", "/srv/www/app.css"));
+    assert(path_equal("/a%20b?v=1&x=/../..", "/srv/www/a b"));
+    assert(path_equal("/?v=1", "/srv/www/"));
+    assert(path_equal("/a?", "/srv/www/a"));
+
+    /* paths which would leave the document root */
+    assert(path_equal("/..", NULL));
+    assert(path_equal("/a/../../etc/passwd", NULL));
+    assert(path_equal("/a/./b", NULL));
+    assert(path_equal("/%2e%2e/etc/passwd", NULL));
+    assert(path_equal("/a%2F..%2F..%2Fetc", NULL));
+    assert(path_equal("/a%00.html", NULL));
+
+    /* invalid paths */
+    assert(path_equal("", NULL));
+    assert(path_equal("index.html", NULL));
+    assert(path_equal("/a%zz", NULL));
+    assert(path_equal("/a b", NULL));
+    assert(path_equal("/a-very-long-segment-which-does-not-fit-in-the-destination-buffer", NULL));
+}
+
+void test_http_file_open() {
+    char path[] = "/tmp/test_http_file_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    assert(write(fd, "hello", 5) == 5);
+    close(fd);
+
+    http_file_t file;
+    assert(http_file_open(&file, path) == 0);
+    assert(file.fd >= 0);
+    assert(file.size == 5);
+    assert(strcmp(file.content_type, "application/octet-stream") == 0);
+    char etag[HTTP_FILE_ETAG_SIZE], expected[HTTP_FILE_ETAG_SIZE];
+    snprintf(expected, sizeof(expected), "\"%lx-5-%lx\"", (unsigned long) file.ino, (unsigned long) file.mtime);
+    assert(http_file_etag(&file, etag) == strlen(expected));
+    assert(strcmp(etag, expected) == 0);
+    http_file_close(&file);
+    assert(file.fd == -1);
+
+    /* a request for the file with a query string finds the same file */
+    char uri[64], file_path[64];
+    snprintf(uri, sizeof(uri), "%s?v=1", path + strlen("/tmp"));
+    assert(http_file_path("/tmp", buffer_view_from_string(uri), file_path, sizeof(file_path)) == (long) strlen(path));
+    assert(strcmp(file_path, path) == 0);
+    assert(http_file_open(&file, file_path) == 0 && file.size == 5);
+    http_file_close(&file);
+    unlink(path);
+
+    assert(http_file_open(&file, path) == -1 && errno == ENOENT);
+    assert(http_file_open(&file, "/tmp") == -1 && errno == EISDIR);
+    assert(file.fd == -1);
+}
+
+void test_http_file_content_type() {
+    assert(strcmp(http_file_content_type("/srv/index.html"), "text/html") == 0);
+    assert(strcmp(http_file_content_type("/srv/logo.PNG"), "image/png") == 0);
+    assert(strcmp(http_file_content_type("/srv/font.woff2"), "font/woff2") == 0);
+    assert(strcmp(http_file_content_type("/srv/archive.tar.gz"), "application/octet-stream") == 0);
+    assert(strcmp(http_file_content_type("/srv/v1.2/README"), "application/octet-stream") == 0);
+}
+
+static void write_file(const char *path, const char *contents) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    assert(fd >= 0);
+    assert(write(fd, contents, strlen(contents)) == (ssize_t) strlen(contents));
+    close(fd);
+}
+
+void test_http_file_cache() {
+    char dir[] = "/tmp/test_http_file_XXXXXX";
+    assert(mkdtemp(dir) != NULL);
+    char a[64], b[64], c[64], big[64];
+    snprintf(a, sizeof(a), "%s/a.txt", dir);
+    snprintf(b, sizeof(b), "%s/b.txt", dir);
+    snprintf(c, sizeof(c), "%s/c.txt", dir);
+    snprintf(big, sizeof(big), "%s/big.txt", dir);
+    write_file(a, "aaaa");
+    write_file(b, "bbbb");
+    write_file(c, "cccc");
+    write_file(big, "0123456789");
+
+    http_file_cache_t *cache = http_file_cache_create(8, 8);
+    http_file_t file;
+    http_file_entry_t *entry = http_file_cache_get(cache, a, 100, &file);
+    assert(entry != NULL && file.fd == -1);
+    assert(view_equal(http_file_entry_data(entry), "aaaa"));
+    http_preset_t head = http_file_entry_head(entry);
+    assert(head.status == 200);
+    const char *prefix = "HTTP/1.1 200 OK\r\nContent-Length: 4\r\nContent-Type: text/plain\r\nLast-Modified: ";
+    assert(memcmp(head.head.data, prefix, strlen(prefix)) == 0);
+    assert(http_file_entry_etag(entry)[0] == '"');
+    assert(memmem(head.head.data, head.head.length, http_file_entry_etag(entry), strlen(http_file_entry_etag(entry))) != NULL);
+    assert(http_file_cache_size(cache) == 4);
+
+    /* hits within the same second are not revalidated */
+    write_file(a, "AAAAA");
+    assert(http_file_cache_get(cache, a, 100, &file) == entry);
+    entry = http_file_cache_get(cache, a, 101, &file);
+    assert(view_equal(http_file_entry_data(entry), "AAAAA"));
+    http_file_cache_collect(cache);
+
+    /* the least recently used entry is evicted, so b is no longer served once it is deleted */
+    write_file(a, "aaaa");
+    assert(http_file_cache_get(cache, a, 102, &file) != NULL);
+    assert(http_file_cache_get(cache, b, 102, &file) != NULL);
+    assert(http_file_cache_get(cache, a, 102, &file) != NULL);
+    assert(http_file_cache_get(cache, c, 102, &file) != NULL);
+    assert(http_file_cache_size(cache) == 8);
+    http_file_entry_t *cached_a = http_file_cache_get(cache, a, 102, &file);
+    http_file_cache_collect(cache);
+    unlink(b);
+    assert(http_file_cache_get(cache, a, 102, &file) == cached_a);
+    assert(http_file_cache_get(cache, b, 102, &file) == NULL && errno == ENOENT);
+
+    /* files which are too large are left open for the caller */
+    assert(http_file_cache_get(cache, big, 102, &file) == NULL);
+    assert(file.fd >= 0 && file.size == 10);
+    http_file_close(&file);
+
+    http_file_cache_destroy(cache);
+    unlink(a);
+    unlink(c);
+    unlink(big);
+    rmdir(dir);
+}
+
+int main(int argc, char *argv[]) {
+    TEST(test_http_file_path);
+    TEST(test_http_file_open);
+    TEST(test_http_file_content_type);
+    TEST(test_http_file_cache);
+}
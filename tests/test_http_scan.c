@@ -0,0 +1,122 @@
+#include <test.h>
+#include <http_scan.h>
+#include <assert.h>
+#include <ctype.h>
+#include <string.h>
+
+static const http_scan_impl_t impls[] = {HTTP_SCAN_PORTABLE, HTTP_SCAN_SSE42, HTTP_SCAN_AVX2};
+
+void test_http_char_class() {
+    for (int c = 0; c < 256; c++) {
+        int tchar = isalnum(c) || (c != 0 && strchr("!#$%&'*+-.^_`|~", c) != NULL);
+        int path = isalnum(c) || (c != 0 && strchr("-._~!$&'()*+,;=:@/", c) != NULL);
+        assert(!!(http_char_class[c] & HTTP_CHAR_TCHAR) == tchar);
+        assert(!!(http_char_class[c] & HTTP_CHAR_VCHAR) == (c >= 0x21 && c <= 0x7e));
+        assert(!!(http_char_class[c] & HTTP_CHAR_SPACE) == (c == ' ' || c == '\t'));
+        assert(!!(http_char_class[c] & HTTP_CHAR_OBS_TEXT) == (c >= 0x80));
+        assert(!!(http_char_class[c] & HTTP_CHAR_DIGIT) == !!isdigit(c));
+        assert(!!(http_char_class[c] & HTTP_CHAR_HEX) == !!isxdigit(c));
+        assert(!!(http_char_class[c] & HTTP_CHAR_PATH) == path);
+    }
+}
+
+void test_http_scan_impl() {
+    http_scan_impl_t impl = http_scan_get_impl();
+    assert(http_scan_set_impl(HTTP_SCAN_PORTABLE) == 0);
+    assert(http_scan_get_impl() == HTTP_SCAN_PORTABLE);
+    assert(http_scan_set_impl(impl) == 0);
+}
+
+/* place every byte value at every position of buffers whose lengths exercise the vector tails */
+static void check_scan(size_t (*scan)(const uint8_t*, size_t), uint8_t fill, uint8_t flags) {
+    uint8_t data[80];
+    for (size_t length = 0; length <= sizeof(data); length += 13) {
+        memset(data, fill, sizeof(data));
+        assert(scan(data, length) == length);
+        for (size_t pos = 0; pos < length; pos++) {
+            for (int c = 0; c < 256; c++) {
+                data[pos] = c;
+                size_t expected = (http_char_class[c] & flags) ? length : pos;
+                assert(scan(data, length) == expected);
+            }
+            data[pos] = fill;
+        }
+    }
+}
+
+void test_http_scan_token() {
+    http_scan_impl_t impl = http_scan_get_impl();
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+        if (http_scan_set_impl(impls[i]) != 0) continue;
+        check_scan(http_scan_token, 'a', HTTP_CHAR_TCHAR);
+        assert(http_scan_token((uint8_t*) "Accept-Encoding: gzip", 21) == 15);
+    }
+    http_scan_set_impl(impl);
+}
+
+void test_http_scan_field() {
+    http_scan_impl_t impl = http_scan_get_impl();
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+        if (http_scan_set_impl(impls[i]) != 0) continue;
+        check_scan(http_scan_field, 'a', HTTP_CHAR_FIELD);
+        assert(http_scan_field((uint8_t*) "gzip, deflate\r\n", 15) == 13);
+    }
+    http_scan_set_impl(impl);
+}
+
+static int is_pchar(int c) {
+    return isalnum(c) || (c != 0 && strchr("-._~!$&'()*+,;=:@", c) != NULL);
+}
+
+static int is_reserved(int c) {
+    return c != 0 && strchr(":/?#[]@!$&'()*+,;=", c) != NULL;
+}
+
+/* like check_scan, but the scan stops at the first byte for which `stop` is true */
+static void check_scan_set(size_t (*scan)(const uint8_t*, size_t), uint8_t fill, int (*stop)(int)) {
+    uint8_t data[80];
+    for (size_t length = 0; length <= sizeof(data); length += 13) {
+        memset(data, fill, sizeof(data));
+        assert(scan(data, length) == length);
+        for (size_t pos = 0; pos < length; pos++) {
+            for (int c = 0; c < 256; c++) {
+                data[pos] = c;
+                assert(scan(data, length) == (stop(c) ? pos : length));
+            }
+            data[pos] = fill;
+        }
+    }
+}
+
+static int is_not_pchar(int c) {
+    return !is_pchar(c);
+}
+
+void test_http_scan_pchar() {
+    http_scan_impl_t impl = http_scan_get_impl();
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+        if (http_scan_set_impl(impls[i]) != 0) continue;
+        check_scan_set(http_scan_pchar, 'a', is_not_pchar);
+        assert(http_scan_pchar((uint8_t*) "token-with-no-escapes%20here", 28) == 21);
+    }
+    http_scan_set_impl(impl);
+}
+
+void test_http_scan_reserved() {
+    http_scan_impl_t impl = http_scan_get_impl();
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+        if (http_scan_set_impl(impls[i]) != 0) continue;
+        check_scan_set(http_scan_reserved, 'a', is_reserved);
+        assert(http_scan_reserved((uint8_t*) "a-long-run-of-unreserved-bytes?q", 32) == 30);
+    }
+    http_scan_set_impl(impl);
+}
+
+int main(int argc, char *argv[]) {
+    TEST(test_http_char_class);
+    TEST(test_http_scan_impl);
+    TEST(test_http_scan_token);
+    TEST(test_http_scan_field);
+    TEST(test_http_scan_pchar);
+    TEST(test_http_scan_reserved);
+}
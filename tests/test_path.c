@@ -60,6 +60,38 @@ void test_path_segment_decode() {
     test_path_segment_decode_helper("-_.~", "-_.~");
     test_path_segment_decode_helper("%3A%2F%3F%23%5B%5D%40", ":/?#[]@");
     test_path_segment_decode_helper("%21%24%26%27%28%29%2A%2B%2C%3B%3D", "!$&'()*+,;=");
+
+    /* an invalid segment leaves nothing to free */
+    const char *invalid[] = {"%4", "abc%zz", "a b"};
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        buffer_t buf = {0};
+        assert(path_segment_decode((buffer_t){(uint8_t*) invalid[i], strlen(invalid[i])}, &buf) == -1);
+        assert(buf.data == NULL && buf.length == 0);
+    }
+}
+
+void test_path_segment_decode_to() {
+    /* long runs go through the vector scans, and the result may overwrite the input */
+    char seg[] = "a-long-query-token-which-is-mostly-plain%2Fwith%20a%3dfew%3Dpercent-escapes%7e";
+    char *out = "a-long-query-token-which-is-mostly-plain/with a=few=percent-escapes~";
+    long len = path_segment_decode_to(buffer_view_from_string(seg), (uint8_t*) seg);
+    assert(len == (long) strlen(out) && memcmp(seg, out, len) == 0);
+
+    uint8_t dest[64];
+    assert(path_segment_decode_to(buffer_view_from_string("abc%4"), dest) == -1);
+    assert(path_segment_decode_to(buffer_view_from_string("abc%g0"), dest) == -1);
+    assert(path_segment_decode_to(buffer_view_from_string("a/b"), dest) == -1);
+    assert(path_segment_decode_to(buffer_view_from_string("a b"), dest) == -1);
+    assert(path_segment_decode_to(buffer_view_from_string("\xc3\xa9"), dest) == -1);
+    assert(path_segment_decode_to(buffer_view_from_string(""), dest) == 0);
+}
+
+void test_path_segment_encode_to() {
+    uint8_t dest[128];
+    char *in = "a-long-segment-of-plain-characters/with some:reserved@ones";
+    char *out = "a-long-segment-of-plain-characters%2Fwith some%3Areserved%40ones";
+    size_t len = path_segment_encode_to(buffer_view_from_string(in), dest);
+    assert(len == strlen(out) && memcmp(dest, out, len) == 0);
 }
 
 void test_parse_absolute_path() {
@@ -80,6 +112,22 @@ void test_parse_absolute_path() {
 }
 
 
+static long parse_query_string(const char *str) {
+    return parse_query((buffer_view_t) {(uint8_t*) str, strlen(str)});
+}
+
+void test_parse_query() {
+    assert(parse_query_string("?v=3") == 4);
+    assert(parse_query_string("?a=/b?c&d=%20") == 13);
+    assert(parse_query_string("?") == 1);
+    assert(parse_query_string("") == 0);
+    assert(parse_query_string("v=3") == 0);
+    assert(parse_query_string("?v=3 HTTP/1.1") == 4);
+    assert(parse_query_string("?v=3#top") == 4);
+    assert(parse_query_string("?v=%zz") == -2);
+    assert(parse_query_string("?v=%2") == -1);
+}
+
 void test_parse_absolute_path_with_segments() {
     array_t *segments = array_create(sizeof(buffer_view_t), 3);
     buffer_t buf = buffer_create_from_string("/foo/bar/baz");
@@ -99,10 +147,74 @@ void test_parse_absolute_path_with_segments() {
     array_destroy(segments, NULL);
 }
 
+static void test_path_normalize_helper(char *in, char *out) {
+    uint8_t dest[64];
+    buffer_view_t path = {(uint8_t*) in, strlen(in)};
+    buffer_view_t res;
+    assert(path_normalize(path, (buffer_t) {dest, sizeof(dest)}, &res) == 0);
+    if (res.length != strlen(out) || memcmp(res.data, out, res.length) != 0) {
+        printf("expected:'%s'\nactually: '%.*s'\n", out, (int) res.length, res.data);
+        assert(0 && "fail");
+    }
+
+    /* normal paths are returned as they are */
+    assert(res.data == (strcmp(in, out) == 0 ? path.data : dest));
+}
+
+void test_path_normalize() {
+    test_path_normalize_helper("", "");
+    test_path_normalize_helper("/", "/");
+    test_path_normalize_helper("/a/b/c", "/a/b/c");
+    test_path_normalize_helper("/a//b/", "/a//b/");
+    test_path_normalize_helper("/a%2Fb%20c", "/a%2Fb%20c");
+
+    /* percent-encoding */
+    test_path_normalize_helper("/a%2fb", "/a%2Fb");
+    test_path_normalize_helper("/%7euser/%41%62c", "/~user/Abc");
+    test_path_normalize_helper("/%2E%2e/x", "/x");
+
+    /* dot segments, with the examples from rfc3986 section 5.2.4 */
+    test_path_normalize_helper("/a/b/c/./../../g", "/a/g");
+    test_path_normalize_helper("mid/content=5/../6", "mid/6");
+    test_path_normalize_helper("/.", "/");
+    test_path_normalize_helper("/..", "/");
+    test_path_normalize_helper("/a/.", "/a/");
+    test_path_normalize_helper("/a/..", "/");
+    test_path_normalize_helper("/a/b/..", "/a/");
+    test_path_normalize_helper("/a/./b", "/a/b");
+    test_path_normalize_helper("/../../a", "/a");
+    test_path_normalize_helper("/a/b/../../../c/", "/c/");
+    test_path_normalize_helper("/a/.b/..c/...", "/a/.b/..c/...");
+    test_path_normalize_helper(".", "");
+    test_path_normalize_helper("..", "");
+    test_path_normalize_helper("./a", "a");
+    test_path_normalize_helper("../../a/b", "a/b");
+    test_path_normalize_helper("a/../b", "/b");
+    test_path_normalize_helper("a/.", "a/");
+}
+
+void test_path_normalize_error() {
+    uint8_t dest[4];
+    buffer_view_t res;
+    assert(path_normalize(buffer_view_from_string("/a b"), (buffer_t) {dest, sizeof(dest)}, &res) == -1);
+    assert(path_normalize(buffer_view_from_string("/a%2"), (buffer_t) {dest, sizeof(dest)}, &res) == -1);
+    assert(path_normalize(buffer_view_from_string("/a%zz"), (buffer_t) {dest, sizeof(dest)}, &res) == -1);
+    assert(path_normalize(buffer_view_from_string("/a?b"), (buffer_t) {dest, sizeof(dest)}, &res) == -1);
+
+    /* the destination is only needed if the path is not normal */
+    assert(path_normalize(buffer_view_from_string("/abcdef"), (buffer_t) {dest, sizeof(dest)}, &res) == 0);
+    assert(path_normalize(buffer_view_from_string("/abc/.."), (buffer_t) {dest, sizeof(dest)}, &res) == -1);
+}
+
 int main(int argc, char *argv[]) {
     TEST(test_path_segment_encode_error);
     TEST(test_path_segment_encode);
     TEST(test_path_segment_decode);
+    TEST(test_path_segment_decode_to);
+    TEST(test_path_segment_encode_to);
     TEST(test_parse_absolute_path);
+    TEST(test_parse_query);
     TEST(test_parse_absolute_path_with_segments);
+    TEST(test_path_normalize);
+    TEST(test_path_normalize_error);
 }
@@ -0,0 +1,162 @@
+#include <test.h>
+#include <router.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+static bool view_equal(buffer_view_t view, const char *str) {
+    return view.length == strlen(str) && memcmp(view.data, str, view.length) == 0;
+}
+
+static int users, user, user_posts, post, files, root, health;
+
+static void* match(router_t *router, const char *path, router_match_t *res) {
+    return router_match(router, buffer_view_from_string(path), res) ? res->data : NULL;
+}
+
+void test_router_add() {
+    router_t *router = router_create();
+    assert(router_add(router, "/users", &users) == 0);
+    assert(router_add(router, "/users/:id", &user) == 0);
+    assert(router_add(router, "/static/*file", &files) == 0);
+    assert(router_add(router, "/users/:name", &user) == -2);
+    assert(router_add(router, "/users", &users) == -2);
+    assert(router_add(router, "/static/*path", &files) == -2);
+
+    /* invalid patterns */
+    assert(router_add(router, "", &root) == -1);
+    assert(router_add(router, "users", &root) == -1);
+    assert(router_add(router, "/users/:", &root) == -1);
+    assert(router_add(router, "/static/*file/more", &root) == -1);
+    assert(router_add(router, "/a b", &root) == -1);
+    assert(router_add(router, "/:a/:b/:c/:d/:e/:f/:g/:h/:i/:j/:k/:l/:m/:n/:o/:p/:q", &root) == -1);
+    router_destroy(router);
+}
+
+void test_router_match() {
+    router_t *router = router_create();
+    router_add(router, "/", &root);
+    router_add(router, "/health", &health);
+    router_add(router, "/users", &users);
+    router_add(router, "/users/:id", &user);
+    router_add(router, "/users/:id/posts", &user_posts);
+    router_add(router, "/users/:user/posts/:post", &post);
+    router_add(router, "/static/*file", &files);
+    router_compile(router);
+
+    router_match_t res;
+    assert(match(router, "/", &res) == &root && res.param_count == 0);
+    assert(match(router, "/health", &res) == &health);
+    assert(match(router, "/users", &res) == &users);
+    assert(match(router, "/users/42", &res) == &user);
+    assert(res.param_count == 1 && view_equal(*router_match_param(&res, "id"), "42"));
+    assert(router_match_param(&res, "user") == NULL);
+    assert(match(router, "/users/42/posts", &res) == &user_posts);
+    assert(view_equal(*router_match_param(&res, "id"), "42"));
+    assert(match(router, "/users/42/posts/7", &res) == &post);
+    assert(view_equal(*router_match_param(&res, "user"), "42"));
+    assert(view_equal(*router_match_param(&res, "post"), "7"));
+    assert(match(router, "/static/css/site.css", &res) == &files);
+    assert(view_equal(*router_match_param(&res, "file"), "css/site.css"));
+    assert(match(router, "/static/", &res) == &files);
+    assert(view_equal(*router_match_param(&res, "file"), ""));
+
+    /* parameter values are views into the path */
+    const char *path = "/users/a%20b";
+    assert(match(router, path, &res) == &user);
+    assert(res.params[0].data == (uint8_t*) path + 7 && view_equal(res.params[0], "a%20b"));
+
+    assert(match(router, "/users/", &res) == NULL);
+    assert(match(router, "/users/42/comments", &res) == NULL);
+    assert(match(router, "/static", &res) == NULL);
+    assert(match(router, "/healthz", &res) == NULL);
+    assert(match(router, "", &res) == NULL);
+    assert(match(router, "health", &res) == NULL);
+    assert(match(router, "/users/a b", &res) == NULL);
+    router_destroy(router);
+}
+
+void test_router_precedence() {
+    router_t *router = router_create();
+    router_add(router, "/users/me", &users);
+    router_add(router, "/users/:id", &user);
+    router_add(router, "/users/:id/posts", &user_posts);
+    router_add(router, "/users/me/settings", &health);
+    router_add(router, "/*path", &files);
+    router_compile(router);
+
+    router_match_t res;
+    assert(match(router, "/users/me", &res) == &users && res.param_count == 0);
+    assert(match(router, "/users/you", &res) == &user);
+
+    /* a literal segment which leads nowhere falls back to the parameter */
+    assert(match(router, "/users/me/posts", &res) == &user_posts);
+    assert(res.param_count == 1 && view_equal(*router_match_param(&res, "id"), "me"));
+    assert(match(router, "/users/me/settings", &res) == &health);
+
+    /* and a parameter which leads nowhere falls back to the wildcard */
+    assert(match(router, "/users/you/settings", &res) == &files);
+    assert(res.param_count == 1 && view_equal(*router_match_param(&res, "path"), "users/you/settings"));
+    assert(match(router, "/", &res) == &files);
+    router_destroy(router);
+}
+
+void test_router_backtrack() {
+    router_t *router = router_create();
+    router_add(router, "/a/b/c/x", &root);
+    router_add(router, "/a/:p/c/y", &user);
+    router_add(router, "/:q/b/c/z", &post);
+    router_add(router, "/*rest", &files);
+    router_compile(router);
+
+    router_match_t res;
+    assert(match(router, "/a/b/c/x", &res) == &root && res.param_count == 0);
+
+    /* the literal "b" leads nowhere, so the parameter below "a" is tried */
+    assert(match(router, "/a/b/c/y", &res) == &user);
+    assert(res.param_count == 1 && view_equal(*router_match_param(&res, "p"), "b"));
+
+    /* both branches below "a" lead nowhere, so matching goes back to the parameter at the root */
+    assert(match(router, "/a/b/c/z", &res) == &post);
+    assert(res.param_count == 1 && view_equal(*router_match_param(&res, "q"), "a"));
+
+    /* and the wildcard comes last, after the captures of the failed branches are dropped */
+    assert(match(router, "/a/b/c/w", &res) == &files);
+    assert(res.param_count == 1 && view_equal(*router_match_param(&res, "rest"), "a/b/c/w"));
+    router_destroy(router);
+}
+
+void test_router_many() {
+    router_t *router = router_create();
+    static int data[1000];
+    char pattern[64];
+    for (int i = 0; i < 1000; i++) {
+        snprintf(pattern, sizeof(pattern), "/api/v%d/items/:id/%d", i % 10, i);
+        assert(router_add(router, pattern, &data[i]) == 0);
+    }
+    router_compile(router);
+
+    router_match_t res;
+    for (int i = 0; i < 1000; i++) {
+        snprintf(pattern, sizeof(pattern), "/api/v%d/items/x%d/%d", i % 10, i, i);
+        assert(match(router, pattern, &res) == &data[i]);
+        snprintf(pattern, sizeof(pattern), "x%d", i);
+        assert(view_equal(*router_match_param(&res, "id"), pattern));
+    }
+    assert(match(router, "/api/v1/items/x/2", &res) == NULL);
+
+    /* routes can be added after compiling, as long as the router is compiled again */
+    assert(router_add(router, "/api", &root) == 0);
+    router_compile(router);
+    assert(match(router, "/api", &res) == &root);
+    assert(match(router, "/api/v3/items/x/3", &res) == &data[3]);
+    router_destroy(router);
+}
+
+int main(int argc, char *argv[]) {
+    TEST(test_router_add);
+    TEST(test_router_match);
+    TEST(test_router_precedence);
+    TEST(test_router_backtrack);
+    TEST(test_router_many);
+}
@@ -1,4 +1,308 @@
+#include <test.h>
+#include <tcp.h>
+#include <array.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
 
-int main() {
+#define TEST_PORT 8300
 
+static void on_connect(tcp_server_t *server, tcp_client_t *client) {}
+static void on_close(tcp_server_t *server, tcp_client_t *client) {}
+static void on_read(tcp_server_t *server, tcp_client_t *client, buffer_t chunk) {}
+static void on_error(tcp_server_t *server, tcp_client_t *client, int errnum) {}
+
+static tcp_server_t* server_create() {
+    return tcp_server_create(on_connect, on_close, on_read, on_error);
+}
+
+static long elapsed_ms(struct timespec start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+}
+
+/* a timer which records its id in `fired` when it runs */
+typedef struct timer_record {
+    array_t *fired;
+    int id;
+} timer_record_t;
+
+static void record_timer(tcp_server_t *server, void *data) {
+    timer_record_t *record = data;
+    array_add(record->fired, &record->id);
+}
+
+static void stop_timer(tcp_server_t *server, void *data) {
+    tcp_server_stop(server);
+}
+
+void test_tcp_server_timeout_order() {
+    tcp_server_t *server = server_create();
+    array_t *fired = array_create(sizeof(int), 4);
+    timer_record_t records[] = {{fired, 3}, {fired, 1}, {fired, 2}, {fired, -1}};
+    int order[3];
+
+    /* the timers are set out of order, and each is numbered by its place in deadline order */
+    tcp_server_set_timeout(server, 30, record_timer, &records[0]);
+    tcp_server_set_timeout(server, 10, record_timer, &records[1]);
+    tcp_server_set_timeout(server, 20, record_timer, &records[2]);
+    uint64_t cancelled = tcp_server_set_timeout(server, 15, record_timer, &records[3]);
+    tcp_server_clear_timeout(server, cancelled);
+    tcp_server_set_timeout(server, 40, stop_timer, NULL);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    assert(tcp_server_run(server) == 0);
+    assert(elapsed_ms(start) >= 40);
+    assert(array_size(fired) == 3);
+    for (int i = 0; i < 3; i++) order[i] = *(int*) array_get(fired, i);
+    assert(order[0] == 1 && order[1] == 2 && order[2] == 3);
+
+    array_destroy(fired, NULL);
+    tcp_server_destroy(server);
+}
+
+void test_tcp_server_clear_timeout() {
+    tcp_server_t *server = server_create();
+    array_t *fired = array_create(sizeof(int), 64);
+    timer_record_t records[200];
+    uint64_t ids[200];
+
+    /* timer i is due after i % 20 ms, and every timer with an odd i is cancelled */
+    for (int i = 0; i < 200; i++) {
+        records[i] = (timer_record_t) {fired, i};
+        ids[i] = tcp_server_set_timeout(server, i % 20, record_timer, &records[i]);
+    }
+    for (int i = 1; i < 200; i += 2) {
+        tcp_server_clear_timeout(server, ids[i]);
+    }
+    tcp_server_clear_timeout(server, ids[1]);
+    tcp_server_set_timeout(server, 30, stop_timer, NULL);
+    assert(tcp_server_run(server) == 0);
+
+    assert(array_size(fired) == 100);
+    int prev = -1;
+    for (size_t i = 0; i < array_size(fired); i++) {
+        int id = *(int*) array_get(fired, i);
+        assert(id % 2 == 0);
+        assert(prev < 0 || prev % 20 < id % 20 || (prev % 20 == id % 20 && prev < id));
+        prev = id;
+    }
+
+    /* a timer which has already fired can no longer be cancelled */
+    tcp_server_clear_timeout(server, ids[0]);
+    array_destroy(fired, NULL);
+    tcp_server_destroy(server);
+}
+
+void test_tcp_server_poll_timeout() {
+    tcp_server_t *server = server_create();
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    assert(tcp_server_poll_timeout(server, 20) == 0);
+    assert(elapsed_ms(start) >= 20);
+    tcp_server_destroy(server);
+}
+
+static void* stop_thread(void *arg) {
+    struct timespec delay = {0, 20 * 1000000};
+    nanosleep(&delay, NULL);
+    tcp_server_stop(arg);
+    return NULL;
+}
+
+void test_tcp_server_stop() {
+    tcp_server_t *server = server_create();
+
+    /* a stop request before the loop starts returns immediately */
+    tcp_server_stop(server);
+    assert(tcp_server_run(server) == 0);
+
+    /* a stop request from another thread wakes the sleeping loop */
+    pthread_t thread;
+    pthread_create(&thread, NULL, stop_thread, server);
+    assert(tcp_server_run(server) == 0);
+    pthread_join(thread, NULL);
+
+    tcp_server_destroy(server);
+}
+
+void test_tcp_cluster() {
+    tcp_cluster_t *cluster = tcp_cluster_create(4, on_connect, on_close, on_read, on_error);
+    assert(cluster != NULL);
+    assert(tcp_cluster_size(cluster) == 4);
+    for (size_t i = 0; i < 4; i++) {
+        assert(tcp_server_worker(tcp_cluster_worker(cluster, i)) == i);
+    }
+
+    /* every worker stops when the cluster is stopped */
+    tcp_cluster_stop(cluster);
+    assert(tcp_cluster_run(cluster) == 0);
+    tcp_cluster_destroy(cluster);
+}
+
+static tcp_client_t *last_client = NULL;
+static size_t drained = 0;
+
+static void on_connect_record(tcp_server_t *server, tcp_client_t *client) {
+    last_client = client;
+}
+
+static void on_drain(tcp_server_t *server, tcp_client_t *client) {
+    drained++;
+}
+
+static int connect_client(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &(int){4096}, sizeof(int));
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    int res = connect(fd, (struct sockaddr*) &addr, sizeof(addr));
+    assert(res == 0);
+    return fd;
+}
+
+void test_tcp_server_write() {
+    tcp_server_t *server = tcp_server_create(on_connect_record, on_close, on_read, on_error);
+    tcp_server_on_drain(server, on_drain);
+    tcp_server_set_watermarks(server, 0, 1024);
+    assert(tcp_server_listen(server, TEST_PORT, 16) == 0);
+    int fd = connect_client(TEST_PORT);
+    while (last_client == NULL) tcp_server_poll_timeout(server, 10);
+
+    /* small writes go straight to the socket */
+    assert(tcp_server_write(server, last_client, (buffer_view_t){(uint8_t*) "hello", 5}));
+    assert(tcp_client_queue_size(last_client) == 0);
+
+    /* a slow reader pushes the queue over the high watermark */
+    size_t total = 5;
+    bool writable = true;
+    for (int i = 0; writable; i++) {
+        buffer_t buffer = buffer_create(64 * 1024);
+        memset(buffer.data, 'a' + i % 26, buffer.length);
+        total += buffer.length;
+        writable = tcp_server_write_buffer(server, last_client, buffer);
+    }
+    assert(tcp_client_queue_size(last_client) > 1024);
+    assert(drained == 0);
+
+    /* the event loop flushes the queue as the reader catches up */
+    uint8_t chunk[64 * 1024];
+    size_t nread = 0;
+    while (nread < total) {
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        assert(n > 0);
+        if (nread == 0) assert(memcmp(chunk, "hello", 5) == 0);
+        nread += n;
+        tcp_server_poll(server);
+    }
+    while (drained == 0) tcp_server_poll_timeout(server, 10);
+    assert(drained == 1);
+    assert(tcp_client_queue_size(last_client) == 0);
+
+    close(fd);
+    tcp_server_destroy(server);
+}
+
+void test_tcp_server_writev() {
+    tcp_server_t *server = tcp_server_create(on_connect_record, on_close, on_read, on_error);
+    last_client = NULL;
+    assert(tcp_server_listen(server, TEST_PORT, 16) == 0);
+    int fd = connect_client(TEST_PORT);
+    while (last_client == NULL) tcp_server_poll_timeout(server, 10);
+
+    /* more buffers than fit in one sendmsg, and more bytes than fit in the socket buffer */
+    size_t count = 150, total = 0;
+    buffer_view_t buffers[150];
+    uint8_t *data = malloc(4 * 1024 * 1024);
+    for (size_t i = 0; i < count; i++) {
+        size_t length = i == 100 ? 3 * 1024 * 1024 : i % 7;
+        buffers[i] = (buffer_view_t){data + total, length};
+        total += length;
+    }
+    for (size_t i = 0; i < total; i++) {
+        data[i] = i % 251;
+    }
+    tcp_server_writev(server, last_client, buffers, count);
+    assert(tcp_client_queue_size(last_client) > 0);
+    memset(data, 0, total);
+
+    uint8_t chunk[64 * 1024];
+    size_t nread = 0;
+    while (nread < total) {
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        assert(n > 0);
+        for (ssize_t i = 0; i < n; i++) {
+            assert(chunk[i] == (nread + i) % 251);
+        }
+        nread += n;
+        tcp_server_poll(server);
+    }
+    assert(tcp_client_queue_size(last_client) == 0);
+    assert(!tcp_client_closed(last_client));
+
+    free(data);
+    close(fd);
+    tcp_server_destroy(server);
+}
+
+void test_tcp_server_sendfile() {
+    tcp_server_t *server = tcp_server_create(on_connect_record, on_close, on_read, on_error);
+    last_client = NULL;
+    assert(tcp_server_listen(server, TEST_PORT, 16) == 0);
+    int fd = connect_client(TEST_PORT);
+    while (last_client == NULL) tcp_server_poll_timeout(server, 10);
+
+    /* a file larger than the socket buffer, sent between two writes */
+    char path[] = "/tmp/test_tcp_XXXXXX";
+    int file = mkstemp(path);
+    assert(file >= 0);
+    unlink(path);
+    size_t size = 3 * 1024 * 1024 + 7;
+    uint8_t *data = malloc(size);
+    for (size_t i = 0; i < size; i++) {
+        data[i] = i % 251;
+    }
+    assert(write(file, data, size) == (ssize_t) size);
+
+    tcp_server_write(server, last_client, (buffer_view_t){(uint8_t*) "head", 4});
+    tcp_server_sendfile(server, last_client, file, 1, size - 1);
+    close(file);
+    assert(tcp_client_queue_size(last_client) > 0);
+    tcp_server_write(server, last_client, (buffer_view_t){(uint8_t*) "tail", 4});
+
+    size_t total = 4 + size - 1 + 4, nread = 0;
+    uint8_t *out = malloc(total);
+    while (nread < total) {
+        ssize_t n = read(fd, out + nread, total - nread);
+        assert(n > 0);
+        nread += n;
+        tcp_server_poll(server);
+    }
+    assert(memcmp(out, "head", 4) == 0);
+    assert(memcmp(out + 4, data + 1, size - 1) == 0);
+    assert(memcmp(out + total - 4, "tail", 4) == 0);
+    assert(tcp_client_queue_size(last_client) == 0);
+
+    free(out);
+    free(data);
+    close(fd);
+    tcp_server_destroy(server);
+}
+
+int main(int argc, char *argv[]) {
+    TEST(test_tcp_server_timeout_order);
+    TEST(test_tcp_server_clear_timeout);
+    TEST(test_tcp_server_poll_timeout);
+    TEST(test_tcp_server_stop);
+    TEST(test_tcp_cluster);
+    TEST(test_tcp_server_write);
+    TEST(test_tcp_server_writev);
+    TEST(test_tcp_server_sendfile);
 }
@@ -0,0 +1,199 @@
+#include <test.h>
+#include <tcp_socket.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define TEST_PORT 8301
+
+static bool connected = false;
+static bool ended = false;
+static bool closed = false;
+static size_t drained = 0;
+static uint8_t received[64];
+static size_t received_length = 0;
+
+static void on_connect(tcp_socket_t *sock) { connected = true; }
+static void on_close(tcp_socket_t *sock) { closed = true; }
+static void on_error(tcp_socket_t *sock, int errnum) { assert(0 && "unexpected error"); }
+static void on_drain(tcp_socket_t *sock) { drained++; }
+
+static void on_read(tcp_socket_t *sock, buffer_view_t chunk) {
+    assert(received_length + chunk.length <= sizeof(received));
+    memcpy(received + received_length, chunk.data, chunk.length);
+    received_length += chunk.length;
+}
+
+static void on_end(tcp_socket_t *sock) {
+    ended = true;
+    tcp_socket_end(sock);
+}
+
+static tcp_socket_handler_t handler = {
+    on_connect, on_close, on_error, on_read, on_drain, on_end
+};
+
+static size_t errors = 0;
+
+static void count_error(tcp_socket_t *sock, int errnum) { errors++; }
+
+static tcp_socket_handler_t failing_handler = {
+    on_connect, on_close, count_error, on_read, on_drain, on_end
+};
+
+static int listen_socket(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int));
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert(bind(fd, (struct sockaddr*) &addr, sizeof(addr)) == 0);
+    assert(listen(fd, 16) == 0);
+    return fd;
+}
+
+static size_t read_all(int fd, uint8_t *data, size_t capacity) {
+    size_t acc = 0;
+    while (acc < capacity) {
+        ssize_t n = read(fd, data + acc, capacity - acc);
+        if (n <= 0) break;
+        acc += n;
+    }
+    return acc;
+}
+
+void test_tcp_socket_read() {
+    connected = ended = closed = false;
+    received_length = 0;
+    int listen_fd = listen_socket(TEST_PORT);
+    tcp_socket_t *sock = tcp_socket_create(handler);
+    assert(sock != NULL);
+    assert(tcp_socket_connect(sock, "127.0.0.1", TEST_PORT) == 0);
+    while (!connected) tcp_socket_poll_timeout(sock, 10);
+    int peer = accept(listen_fd, NULL, NULL);
+    assert(peer >= 0);
+
+    /* data written by the peer arrives through on_read */
+    assert(write(peer, "hello world", 11) == 11);
+    while (received_length < 11) tcp_socket_poll_timeout(sock, 10);
+    assert(memcmp(received, "hello world", 11) == 0);
+
+    /* the peer's FIN triggers on_end, and ending the socket in turn closes it */
+    close(peer);
+    while (!ended) tcp_socket_poll_timeout(sock, 10);
+    assert(closed);
+    tcp_socket_destroy(sock);
+    close(listen_fd);
+}
+
+void test_tcp_socket_write() {
+    connected = closed = false;
+    drained = 0;
+    int listen_fd = listen_socket(TEST_PORT);
+    tcp_socket_t *sock = tcp_socket_create(handler);
+    assert(tcp_socket_connect(sock, "127.0.0.1", TEST_PORT) == 0);
+
+    /* writes before the connection is established are queued */
+    assert(!tcp_socket_write(sock, (buffer_view_t){(uint8_t*) "hello ", 6}));
+    while (!connected) tcp_socket_poll_timeout(sock, 10);
+    int peer = accept(listen_fd, NULL, NULL);
+    assert(peer >= 0);
+    assert(drained == 1);
+
+    /* corked writes are batched and flushed together */
+    tcp_socket_cork(sock);
+    for (int i = 0; i < 100; i++) {
+        assert(!tcp_socket_write(sock, (buffer_view_t){(uint8_t*) "ab", 2}));
+    }
+    tcp_socket_uncork(sock);
+    assert(drained == 2);
+
+    tcp_socket_end(sock);
+    uint8_t data[256] = {0};
+    assert(read_all(peer, data, sizeof(data)) == 206);
+    assert(memcmp(data, "hello abab", 10) == 0);
+
+    close(peer);
+    while (!closed) tcp_socket_poll_timeout(sock, 10);
+    tcp_socket_destroy(sock);
+    close(listen_fd);
+}
+
+void test_tcp_socket_write_queue() {
+    connected = closed = false;
+    drained = 0;
+    int listen_fd = listen_socket(TEST_PORT);
+    tcp_socket_t *sock = tcp_socket_create(handler);
+    assert(tcp_socket_connect(sock, "127.0.0.1", TEST_PORT) == 0);
+    while (!connected) tcp_socket_poll_timeout(sock, 10);
+    int peer = accept(listen_fd, NULL, NULL);
+
+    /* write until the socket would block */
+    size_t total = 0;
+    buffer_t buffer = buffer_create(64 * 1024);
+    bool written = true;
+    while (written) {
+        written = tcp_socket_write(sock, buffer);
+        total += buffer.length;
+    }
+    buffer_destroy(buffer);
+    assert(drained == 0);
+
+    uint8_t chunk[64 * 1024];
+    size_t nread = 0;
+    while (nread < total) {
+        ssize_t n = read(peer, chunk, sizeof(chunk));
+        assert(n > 0);
+        nread += n;
+        tcp_socket_poll(sock);
+    }
+    assert(drained == 1);
+
+    close(peer);
+    tcp_socket_destroy(sock);
+    close(listen_fd);
+}
+
+void test_tcp_socket_write_reset() {
+    connected = closed = false;
+    errors = 0;
+    int listen_fd = listen_socket(TEST_PORT);
+    tcp_socket_t *sock = tcp_socket_create(failing_handler);
+    assert(tcp_socket_connect(sock, "127.0.0.1", TEST_PORT) == 0);
+    while (!connected) tcp_socket_poll_timeout(sock, 10);
+    int peer = accept(listen_fd, NULL, NULL);
+    assert(peer >= 0);
+
+    /* the peer resets the connection while writes are queued */
+    tcp_socket_cork(sock);
+    buffer_t buffer = buffer_create(64 * 1024);
+    tcp_socket_write(sock, buffer);
+    buffer_destroy(buffer);
+    setsockopt(peer, SOL_SOCKET, SO_LINGER, &(struct linger){1, 0}, sizeof(struct linger));
+    close(peer);
+    tcp_socket_uncork(sock);
+
+    /* the failed flush is reported once, and the socket is closed rather than polled again */
+    assert(errors == 1);
+    assert(closed);
+    assert(tcp_socket_fd(sock) < 0);
+    for (int i = 0; i < 10; i++) {
+        assert(tcp_socket_poll_timeout(sock, 1) == 0);
+    }
+    assert(!tcp_socket_write(sock, (buffer_view_t){(uint8_t*) "ab", 2}));
+    assert(errors == 1);
+
+    tcp_socket_destroy(sock);
+    close(listen_fd);
+}
+
+int main(int argc, char *argv[]) {
+    TEST(test_tcp_socket_read);
+    TEST(test_tcp_socket_write);
+    TEST(test_tcp_socket_write_queue);
+    TEST(test_tcp_socket_write_reset);
+}
@@ -1,17 +1,21 @@
 #include <test.h>
 #include <tree_map.h>
 #include <assert.h>
+#include <stdint.h>
 #include <string.h>
 #include <log.h>
 
 typedef struct node {
     struct node *left;
     struct node *right;
-    uint8_t entry[];
+    struct node *parent;
+    int height;
+    _Alignas(max_align_t) uint8_t entry[];
 } node_t;
 
 typedef struct tree_map {
     node_t *root;
+    size_t size;
     size_t key_size;
     size_t val_size;
     compare_t cmp_key;
@@ -43,10 +47,13 @@ void test_tree_map_set() {
     assert(map->root->right != NULL);
     assert(*(int*)map->root->right->entry == 2);
 
+    /* the third ascending key rotates the tree so 2 becomes the root */
     tree_map_set(map, &(int){3}, &(int){9});
     assert(map->root != NULL);
-    assert(map->root->right->right != NULL);
-    assert(*(int*)map->root->right->right->entry == 3);
+    assert(*(int*)map->root->entry == 2);
+    assert(*(int*)map->root->left->entry == 1);
+    assert(*(int*)map->root->right->entry == 3);
+    assert(map->root->height == 2);
 
     assert(*(int*)tree_map_get(map, &(int){1}) == 1);
     assert(*(int*)tree_map_get(map, &(int){2}) == 4);
@@ -97,9 +104,148 @@ void test_tree_map_remove() {
     tree_map_destroy(map);
 }
 
+void test_tree_map_remove_inner() {
+    tree_map_t *map = tree_map_create(sizeof(int), sizeof(int), (compare_t) int_cmp, NULL, NULL);
+    int keys[] = {50, 20, 80, 10, 30, 70, 90, 25, 35, 75, 85, 95};
+    size_t count = sizeof(keys) / sizeof(keys[0]);
+    for (size_t i = 0; i < count; i++) {
+        tree_map_set(map, &keys[i], &keys[i]);
+    }
+
+    /* nodes with two children are replaced by their successor, which keeps the order */
+    tree_map_remove(map, &(int){80});
+    tree_map_remove(map, &(int){20});
+    tree_map_remove(map, &(int){50});
+    for (size_t i = 0; i < count; i++) {
+        int *val = tree_map_get(map, &keys[i]);
+        if (keys[i] == 80 || keys[i] == 20 || keys[i] == 50) assert(val == NULL);
+        else assert(val != NULL && *val == keys[i]);
+    }
+    tree_map_destroy(map);
+}
+
+/* Check the order, parent links and balance of the subtree and return its height. */
+static int check_node(node_t *node, node_t *parent, int *prev) {
+    if (node == NULL) return 0;
+    assert(node->parent == parent);
+    int left = check_node(node->left, node, prev);
+    assert(*prev < *(int*) node->entry);
+    *prev = *(int*) node->entry;
+    int right = check_node(node->right, node, prev);
+    assert(left - right <= 1 && right - left <= 1);
+    assert(node->height == 1 + (left > right ? left : right));
+    return node->height;
+}
+
+static void check_tree(tree_map_t *map) {
+    int prev = -1;
+    check_node(map->root, NULL, &prev);
+}
+
+void test_tree_map_balanced() {
+    tree_map_t *map = tree_map_create(sizeof(int), sizeof(int), (compare_t) int_cmp, NULL, NULL);
+    int count = 100000;
+    for (int i = 0; i < count; i++) {
+        tree_map_set(map, &i, &(int){i * 2});
+    }
+    check_tree(map);
+    assert(tree_map_size(map) == (size_t) count);
+
+    /* an AVL tree of n nodes is at most about 1.44 log2(n) high */
+    assert(map->root->height <= 25);
+
+    /* remove every other key in descending order */
+    for (int i = count - 1; i >= 0; i -= 2) {
+        tree_map_remove(map, &i);
+    }
+    check_tree(map);
+    assert(tree_map_size(map) == (size_t) count / 2);
+    for (int i = 0; i < count; i++) {
+        int *val = tree_map_get(map, &i);
+        if (i % 2 == 1) assert(val == NULL);
+        else assert(val != NULL && *val == i * 2);
+    }
+    tree_map_remove(map, &(int){count});
+    assert(tree_map_size(map) == (size_t) count / 2);
+    tree_map_destroy(map);
+}
+
+void test_tree_map_iterate() {
+    tree_map_t *map = tree_map_create(sizeof(int), sizeof(int), (compare_t) int_cmp, NULL, NULL);
+    assert(tree_map_first(map) == NULL && tree_map_last(map) == NULL);
+    for (int i = 0; i < 100; i++) {
+        int key = (i * 37) % 100;
+        tree_map_set(map, &key, &(int){key + 1});
+    }
+
+    int expected = 0;
+    for (tree_map_entry_t *e = tree_map_first(map); e != NULL; e = tree_map_next(e)) {
+        assert(*(int*) tree_map_entry_key(e) == expected);
+        assert(*(int*) tree_map_entry_val(map, e) == expected + 1);
+        expected++;
+    }
+    assert(expected == 100);
+    for (tree_map_entry_t *e = tree_map_last(map); e != NULL; e = tree_map_prev(e)) {
+        assert(*(int*) tree_map_entry_key(e) == --expected);
+    }
+    assert(expected == 0);
+
+    /* entries can be removed while iterating once the next one is known */
+    tree_map_entry_t *e = tree_map_first(map);
+    while (e != NULL) {
+        tree_map_entry_t *next = tree_map_next(e);
+        if (*(int*) tree_map_entry_key(e) % 3 == 0) tree_map_remove(map, tree_map_entry_key(e));
+        e = next;
+    }
+    assert(tree_map_size(map) == 66);
+    check_tree(map);
+    tree_map_destroy(map);
+}
+
+static bool collect(int *key, int *val, int *keys) {
+    keys[++keys[0]] = *key;
+    return *key < 50;
+}
+
+void test_tree_map_bounds() {
+    tree_map_t *map = tree_map_create(sizeof(int), sizeof(int), (compare_t) int_cmp, NULL, NULL);
+    for (int i = 10; i <= 100; i += 10) {
+        tree_map_set(map, &i, &i);
+    }
+    assert(*(int*) tree_map_entry_key(tree_map_lower_bound(map, &(int){30})) == 30);
+    assert(*(int*) tree_map_entry_key(tree_map_lower_bound(map, &(int){31})) == 40);
+    assert(*(int*) tree_map_entry_key(tree_map_lower_bound(map, &(int){0})) == 10);
+    assert(tree_map_lower_bound(map, &(int){101}) == NULL);
+    assert(*(int*) tree_map_entry_key(tree_map_upper_bound(map, &(int){30})) == 40);
+    assert(*(int*) tree_map_entry_key(tree_map_upper_bound(map, &(int){29})) == 30);
+    assert(tree_map_upper_bound(map, &(int){100}) == NULL);
+
+    /* keys[0] counts the keys which follow it */
+    int keys[16] = {0};
+    assert(tree_map_range(map, &(int){15}, &(int){40}, (tree_map_visit_t) collect, keys) == 2);
+    assert(keys[0] == 2 && keys[1] == 20 && keys[2] == 30);
+
+    keys[0] = 0;
+    assert(tree_map_range(map, NULL, &(int){30}, (tree_map_visit_t) collect, keys) == 2);
+    assert(keys[1] == 10 && keys[2] == 20);
+
+    /* the scan stops once the visitor returns false */
+    keys[0] = 0;
+    assert(tree_map_range(map, &(int){40}, NULL, (tree_map_visit_t) collect, keys) == 2);
+    assert(keys[1] == 40 && keys[2] == 50);
+
+    keys[0] = 0;
+    assert(tree_map_range(map, &(int){41}, &(int){49}, (tree_map_visit_t) collect, keys) == 0);
+    tree_map_destroy(map);
+}
+
 int main(int argc, char *argv[]) {
     TEST(test_tree_map_create);
     TEST(test_tree_map_set);
     TEST(test_tree_map_remove);
+    TEST(test_tree_map_remove_inner);
+    TEST(test_tree_map_balanced);
+    TEST(test_tree_map_iterate);
+    TEST(test_tree_map_bounds);
 }
 
@@ -0,0 +1,147 @@
+#include <test.h>
+#include <write_queue.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+static void socket_pair(int fds[2]) {
+    int res = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    assert(res == 0);
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+}
+
+void test_write_queue_create() {
+    write_queue_t *queue = write_queue_create();
+    assert(queue != NULL);
+    assert(write_queue_size(queue) == 0);
+    write_queue_destroy(queue);
+}
+
+void test_write_queue_push() {
+    write_queue_t *queue = write_queue_create();
+    write_queue_push(queue, buffer_create_from_string("foobar"), 3);
+    assert(write_queue_size(queue) == 3);
+    write_queue_push(queue, buffer_create_from_string("baz"), 3);
+    assert(write_queue_size(queue) == 3);
+    write_queue_push_copy(queue, (buffer_view_t){(uint8_t*) "qux", 3});
+    assert(write_queue_size(queue) == 6);
+    write_queue_destroy(queue);
+}
+
+void test_write_queue_flush() {
+    int fds[2];
+    socket_pair(fds);
+    write_queue_t *queue = write_queue_create();
+    for (int i = 0; i < 100; i++) {
+        write_queue_push(queue, buffer_create_from_string("abc"), i % 3);
+    }
+    assert(write_queue_size(queue) == 201);
+
+    /* a single flush writes at most 64 buffers */
+    assert(write_queue_flush(queue, fds[0]) == 129);
+    assert(write_queue_flush(queue, fds[0]) == 72);
+    assert(write_queue_size(queue) == 0);
+    assert(write_queue_flush(queue, fds[0]) == 0);
+
+    char out[256] = {0};
+    assert(read(fds[1], out, sizeof(out)) == 201);
+    assert(memcmp(out, "abcbccabcbc", 11) == 0);
+
+    write_queue_destroy(queue);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+void test_write_queue_flush_partial() {
+    int fds[2];
+    socket_pair(fds);
+    write_queue_t *queue = write_queue_create();
+
+    /* queue more data than the socket buffer can hold */
+    size_t total = 0;
+    for (int i = 0; i < 64; i++) {
+        buffer_t buffer = buffer_create(64 * 1024);
+        memset(buffer.data, 'a' + i % 26, buffer.length);
+        total += buffer.length;
+        write_queue_push(queue, buffer, 0);
+    }
+    ssize_t nwritten = write_queue_flush(queue, fds[0]);
+    assert(nwritten > 0);
+    assert(write_queue_size(queue) == total - nwritten);
+    assert(write_queue_flush(queue, fds[0]) == 0);
+
+    /* drain the peer and flush the rest */
+    size_t nread = 0;
+    uint8_t chunk[64 * 1024];
+    while (write_queue_size(queue) > 0 || nread < total) {
+        ssize_t n = read(fds[1], chunk, sizeof(chunk));
+        if (n > 0) {
+            for (ssize_t i = 0; i < n; i++) {
+                assert(chunk[i] == 'a' + (nread + i) / (64 * 1024) % 26);
+            }
+            nread += n;
+        }
+        assert(write_queue_flush(queue, fds[0]) >= 0);
+    }
+    assert(nread == total);
+
+    write_queue_destroy(queue);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+void test_write_queue_flush_error() {
+    int fds[2];
+    socket_pair(fds);
+    close(fds[1]);
+    write_queue_t *queue = write_queue_create();
+    write_queue_push_copy(queue, (buffer_view_t){(uint8_t*) "abc", 3});
+    assert(write_queue_flush(queue, fds[0]) == -1);
+    assert(write_queue_size(queue) == 3);
+    write_queue_destroy(queue);
+    close(fds[0]);
+}
+
+void test_write_queue_flush_file() {
+    int fds[2];
+    socket_pair(fds);
+    char path[] = "/tmp/test_write_queue_XXXXXX";
+    int file = mkstemp(path);
+    assert(file >= 0);
+    unlink(path);
+    assert(write(file, "0123456789", 10) == 10);
+
+    /* file ranges are sent in order with the buffers around them */
+    write_queue_t *queue = write_queue_create();
+    write_queue_push_copy(queue, (buffer_view_t){(uint8_t*) "abc", 3});
+    write_queue_push_file(queue, dup(file), 2, 5);
+    write_queue_push_copy(queue, (buffer_view_t){(uint8_t*) "def", 3});
+    write_queue_push_file(queue, file, 0, 0);
+    assert(write_queue_size(queue) == 11);
+    assert(write_queue_flush(queue, fds[0]) == 3);
+    assert(write_queue_flush(queue, fds[0]) == 5);
+    assert(write_queue_flush(queue, fds[0]) == 3);
+    assert(write_queue_size(queue) == 0);
+
+    char out[16] = {0};
+    assert(read(fds[1], out, sizeof(out)) == 11);
+    assert(memcmp(out, "abc23456def", 11) == 0);
+
+    /* a file which is shorter than the queued range fails instead of hanging */
+    write_queue_push_file(queue, open("/dev/null", O_RDONLY), 0, 5);
+    assert(write_queue_flush(queue, fds[0]) == -1);
+
+    write_queue_destroy(queue);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+int main(int argc, char *argv[]) {
+    TEST(test_write_queue_create);
+    TEST(test_write_queue_push);
+    TEST(test_write_queue_flush);
+    TEST(test_write_queue_flush_partial);
+    TEST(test_write_queue_flush_error);
+    TEST(test_write_queue_flush_file);
+}